@@ -0,0 +1,107 @@
+/*
+按请求使用的 bump 分配器（arena），用于请求处理过程中的临时内存
+    * 从调用者提供的内联缓冲区开始分配，分配只是移动指针，不单独释放；
+      请求处理完后 reset 一次性回收全部内存
+    * 内联缓冲区用完后从堆上申请溢出块（至少 ARENA_BLOCK_SIZE 字节），
+      reset 时溢出块不释放，之后的请求继续使用，稳定状态下没有堆分配
+    * 溢出块在析构时释放
+    * 不是线程安全的：每个请求（连接）一个 arena，同一时间只有一个线程处理该请求
+*/
+
+#ifndef ARENA_H
+#define ARENA_H
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <string.h>
+#include <new>
+
+#define ARENA_BLOCK_SIZE 4096
+
+class Arena {
+public:
+    Arena(char *buf, size_t size) :
+        m_buf(buf), m_size(size), m_cur(buf), m_end(buf + size), m_blocks(nullptr), m_block(nullptr) {}
+    ~Arena() {
+        while (m_blocks != nullptr) {
+            Block *next = m_blocks->next;
+            free(m_blocks);
+            m_blocks = next;
+        }
+    }
+
+    // 分配 size 字节，按 align（2 的幂）对齐，内存不足时抛出 std::bad_alloc
+    void *alloc(size_t size, size_t align = alignof(max_align_t)) {
+        char *p = align_up(m_cur, align);
+        if (p + size > m_end) {
+            p = next_block(size, align);
+        }
+        m_cur = p + size;
+        return p;
+    }
+
+    // 复制字符串的前 len 个字符，结果以 '\0' 结尾
+    char *copy(const char *s, size_t len) {
+        char *p = static_cast<char *>(alloc(len + 1, 1));
+        memcpy(p, s, len);
+        p[len] = '\0';
+        return p;
+    }
+
+    // 回收全部内存，溢出块保留
+    void reset() {
+        m_cur = m_buf;
+        m_end = m_buf + m_size;
+        m_block = nullptr;
+    }
+
+private:
+    // 溢出块：块头后面是数据
+    struct Block {
+        Block *next;
+        size_t size;
+        char *data() {
+            return reinterpret_cast<char *>(this + 1);
+        }
+    };
+
+    static char *align_up(char *p, size_t align) {
+        return reinterpret_cast<char *>((reinterpret_cast<size_t>(p) + align - 1) & ~(align - 1));
+    }
+
+    // 切换到下一个能容纳 size 字节的溢出块，依次复用已申请的块，都不够时申请新块
+    char *next_block(size_t size, size_t align) {
+        Block **link = m_block == nullptr ? &m_blocks : &m_block->next;
+        while (*link != nullptr) {
+            Block *b = *link;
+            char *p = align_up(b->data(), align);
+            if (p + size <= b->data() + b->size) {
+                m_block = b;
+                m_end = b->data() + b->size;
+                return p;
+            }
+            link = &b->next;
+        }
+        size_t block_size = size + align > ARENA_BLOCK_SIZE ? size + align : ARENA_BLOCK_SIZE;
+        Block *b = static_cast<Block *>(malloc(sizeof(Block) + block_size));
+        if (b == nullptr) {
+            throw std::bad_alloc();
+        }
+        b->next = nullptr;
+        b->size = block_size;
+        *link = b;
+        m_block = b;
+        m_end = b->data() + b->size;
+        return align_up(b->data(), align);
+    }
+
+private:
+    char *m_buf; // 内联缓冲区
+    size_t m_size;
+    char *m_cur; // 当前块中下一次分配的位置
+    char *m_end; // 当前块的结束位置
+    Block *m_blocks; // 溢出块链表
+    Block *m_block; // 正在使用的溢出块，为 nullptr 时使用内联缓冲区
+};
+
+#endif
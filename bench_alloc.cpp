@@ -0,0 +1,109 @@
+/*
+请求处理中的堆分配测试：服务器以 LD_PRELOAD=./malloc_count.so 运行，本工具在长连接上发送各类请求，
+预热后统计每个请求的平均分配次数
+    用法：
+        LD_PRELOAD=./malloc_count.so MALLOC_COUNT_FILE=/tmp/malloc_count ./server &
+        ./bench_alloc <server pid> [port] [count file]
+    * 静态页面请求、已登录会话的请求在稳定状态下不应分配堆内存，超过 ALLOC_TOLERANCE 时返回 1；
+      登录（新建会话）只输出结果：会话本身（map 节点、token、过期队列）需要分配
+    * 会注册测试用户 bench_alloc，使用 MYSQL=0 编译时写入当前目录的 users.txt，应在临时目录中运行服务器
+    * 同一时间服务器上不应有其他请求；定时任务（SIGALRM）的少量分配由 ALLOC_TOLERANCE 容忍
+*/
+
+#include <signal.h>
+#include "bench_util.h"
+
+// 预热、统计的请求数
+#define ALLOC_WARMUP 200
+#define ALLOC_REQUESTS 1000
+// 每个请求平均分配次数的容许值
+#define ALLOC_TOLERANCE 0.01
+
+static pid_t server_pid;
+static const char *count_path = "/tmp/malloc_count";
+
+// 让服务器写出当前的分配次数，等待文件中的序号更新
+static long long read_allocs() {
+    static long long last_seq = 0;
+    kill(server_pid, SIGUSR1);
+    for (int i = 0; i < 1000; ++i) {
+        FILE *fp = fopen(count_path, "r");
+        long long seq = 0, allocs = 0;
+        if (fp != nullptr) {
+            int n = fscanf(fp, "%lld %lld", &seq, &allocs);
+            fclose(fp);
+            if (n == 2 && seq > last_seq) {
+                last_seq = seq;
+                return allocs;
+            }
+        }
+        usleep(1000);
+    }
+    fprintf(stderr, "no count from pid %d in %s (is malloc_count.so preloaded?)\n", server_pid, count_path);
+    exit(2);
+}
+
+// 在一个长连接上预热后发送 ALLOC_REQUESTS 个 req，返回每个请求的平均分配次数
+static double measure(int port, const std::string &req) {
+    Bench_conn conn;
+    if (!conn.connect(port)) {
+        perror("connect");
+        exit(2);
+    }
+    for (int i = 0; i < ALLOC_WARMUP; ++i) {
+        if (!conn.request(req)) {
+            fprintf(stderr, "request failed during warm-up\n");
+            exit(2);
+        }
+    }
+    long long before = read_allocs();
+    for (int i = 0; i < ALLOC_REQUESTS; ++i) {
+        if (!conn.request(req) || conn.close) {
+            fprintf(stderr, "request failed or connection closed (status %d)\n", conn.status);
+            exit(2);
+        }
+    }
+    long long after = read_allocs();
+    return (double)(after - before) / ALLOC_REQUESTS;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <server pid> [port] [count file]\n", argv[0]);
+        return 2;
+    }
+    server_pid = atoi(argv[1]);
+    int port = argc > 2 ? atoi(argv[2]) : 9999;
+    if (argc > 3) {
+        count_path = argv[3];
+    }
+
+    // 注册测试用户（已存在时注册失败，不影响），登录取得会话 token
+    const std::string form = "user=bench_alloc&password=bench_alloc";
+    Bench_conn conn;
+    if (!conn.connect(port) || !conn.request(bench_post("/3CGISQL.cgi", form))
+        || !conn.request(bench_post("/2CGISQL.cgi", form))) {
+        fprintf(stderr, "register/login failed\n");
+        return 2;
+    }
+    const char *sid = strstr(conn.head.c_str(), "sid=");
+    if (sid == nullptr) {
+        fprintf(stderr, "login did not return a session cookie\n");
+        return 2;
+    }
+    std::string cookie = "Cookie: " + std::string(sid, strcspn(sid, ";\r\n")) + "\r\n";
+    conn.disconnect();
+
+    bool ok = true;
+    double a = measure(port, bench_get("/"));
+    printf("%-32s %.3f allocations/request\n", "GET /", a);
+    ok = ok && a <= ALLOC_TOLERANCE;
+    a = measure(port, bench_get("/welcome.html", true, cookie.c_str()));
+    printf("%-32s %.3f allocations/request\n", "GET /welcome.html with session", a);
+    ok = ok && a <= ALLOC_TOLERANCE;
+    a = measure(port, bench_post("/2CGISQL.cgi", form));
+    printf("%-32s %.3f allocations/request (not checked)\n", "POST login (new session)", a);
+
+    printf("%s\n", ok ? "PASS" : "FAIL");
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,108 @@
+/*
+反向代理测试用的回环后端：每个连接一个线程，阻塞读写，支持长连接
+    用法：./bench_backend <port> [connection] [close every]
+        connection：响应的 Connection 头，默认 keep-alive；不是 close 时连接保持打开
+        close every：每 N 个响应带 Connection: close 并关闭连接，用于测试代理重新连接后端，默认 0 不关闭
+    * 响应体为一行 "backend <port> <方法> <路径> <请求体长度>"，bench_proxy 据此检查响应是否属于自己的请求
+    * 请求体按 Content-Length 读取并丢弃，不支持分块编码（代理也不转发分块编码的请求体）
+    * 只监听 127.0.0.1
+*/
+
+#include <signal.h>
+#include <pthread.h>
+#include "bench_util.h"
+
+static int port;
+static const char *connection = "keep-alive";
+static int close_every = 0;
+
+// 读一个请求：请求头写入 head，返回请求体长度；连接关闭或出错时返回 -1
+static long long read_request(Bench_conn &conn, std::string &head) {
+    size_t end;
+    char tmp[65536];
+    while ((end = conn.buf.find("\r\n\r\n")) == std::string::npos) {
+        ssize_t n = recv(conn.fd, tmp, sizeof(tmp), 0);
+        if (n <= 0) {
+            return -1;
+        }
+        conn.buf.append(tmp, n);
+    }
+    head.assign(conn.buf, 0, end + 4);
+    conn.buf.erase(0, end + 4);
+    const char *cl = strcasestr(head.c_str(), "Content-Length:");
+    long long length = cl != nullptr ? atoll(cl + 15) : 0;
+    // 丢弃请求体
+    long long left = length;
+    while (left > 0) {
+        if (conn.buf.empty()) {
+            ssize_t n = recv(conn.fd, tmp, sizeof(tmp), 0);
+            if (n <= 0) {
+                return -1;
+            }
+            conn.buf.append(tmp, n);
+        }
+        size_t take = std::min((long long)conn.buf.size(), left);
+        conn.buf.erase(0, take);
+        left -= take;
+    }
+    return length;
+}
+
+static void *conn_thread(void *arg) {
+    Bench_conn conn;
+    conn.fd = (int)(long)arg;
+    std::string head;
+    long long length;
+    for (int served = 1; (length = read_request(conn, head)) >= 0; ++served) {
+        // 请求行：方法 路径 版本
+        std::string method = head.substr(0, head.find(' '));
+        size_t path_begin = method.size() + 1;
+        std::string path = head.substr(path_begin, head.find(' ', path_begin) - path_begin);
+        char body[512];
+        int body_len = snprintf(body, sizeof(body), "backend %d %s %s %lld\n", port, method.c_str(), path.c_str(),
+                                length);
+        bool close = strcmp(connection, "close") == 0 || (close_every > 0 && served % close_every == 0);
+        char resp[1024];
+        int n = snprintf(resp, sizeof(resp), "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: %d\r\n"
+                         "Connection: %s\r\n\r\n%s", body_len, close ? "close" : connection, body);
+        if (!conn.send_all(std::string(resp, n)) || close) {
+            break;
+        }
+    }
+    return nullptr;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s <port> [connection] [close every]\n", argv[0]);
+        return 2;
+    }
+    port = atoi(argv[1]);
+    if (argc > 2) {
+        connection = argv[2];
+    }
+    close_every = argc > 3 ? atoi(argv[3]) : 0;
+    signal(SIGPIPE, SIG_IGN);
+
+    int listenfd = socket(AF_INET, SOCK_STREAM, 0);
+    int on = 1;
+    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+    sockaddr_in addr = bench_addr(port);
+    if (bind(listenfd, (sockaddr *)&addr, sizeof(addr)) != 0 || listen(listenfd, 1024) != 0) {
+        perror("bind/listen");
+        return 2;
+    }
+    for (;;) {
+        int fd = accept(listenfd, nullptr, nullptr);
+        if (fd < 0) {
+            continue;
+        }
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        pthread_t tid;
+        if (pthread_create(&tid, nullptr, conn_thread, (void *)(long)fd) != 0) {
+            close(fd);
+            continue;
+        }
+        pthread_detach(tid);
+    }
+}
@@ -0,0 +1,43 @@
+/*
+连接抖动压测：多个线程不断新建连接，每个连接只发送一个 Connection: close 请求，
+输出每秒完成的连接数和每个连接（connect 到读完响应）的延迟，用于观察接入、关闭连接的开销（定时器、连接表、缓冲区池）
+    用法：./bench_churn [port] [threads] [seconds] [path]
+        默认 9999 端口、4 个线程、5 秒、请求 /
+    * 同一 IP 的请求受 IP_RATE 限制，压测前应把 IP_RATE 设为 0；日志级别应调到 INFO 以上，否则测到的主要是日志开销
+    * 定时器 slab 的占用统计在每次 tick 时以 DEBUG 级别输出，需要时单独把 TIMER_LOG_LEVEL 留在 DEBUG
+    * 服务端主动关闭，TIME_WAIT 留在服务端，客户端的临时端口不会耗尽
+*/
+
+#include "bench_util.h"
+
+static int port = 9999;
+static const char *path = "/";
+static std::string req;
+
+// 新建连接，发送一个请求，读完响应后关闭
+static bool churn(Bench_worker *w) {
+    bool ok = w->conn.connect(port) && w->conn.request(req) && w->conn.status == 200;
+    w->conn.disconnect();
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    port = argc > 1 ? atoi(argv[1]) : 9999;
+    int threads = argc > 2 ? atoi(argv[2]) : 4;
+    int seconds = argc > 3 ? atoi(argv[3]) : 5;
+    if (argc > 4) {
+        path = argv[4];
+    }
+    if (threads <= 0 || seconds <= 0) {
+        fprintf(stderr, "usage: %s [port] [threads] [seconds] [path]\n", argv[0]);
+        return 2;
+    }
+
+    req = bench_get(path, false);
+
+    std::vector<Bench_worker> workers(threads);
+    Bench_result r = bench_run(workers, seconds, churn);
+    printf("%d threads, GET %s, one request per connection\n", threads, path);
+    r.print("connections", "connect + GET + close");
+    return 0;
+}
@@ -0,0 +1,112 @@
+/*
+日志吞吐量压测：多个线程同时写日志，输出每秒写入的行数
+    用法：./bench_log [sync|async|deferred|binary] [threads] [lines per thread] [segment MB]
+        默认 async、4 个线程、每个线程 1000000 行、不使用预分配段
+    * 日志追加到当前目录的 <日期>_BenchLog（binary 模式加 .bin 后缀），应在临时目录中运行
+    * 写日志的线程全部返回时统计一次（调用方看到的吞吐量），flush 之后再统计一次（日志全部写到内核）；
+      文本格式、不使用预分配段时检查文件中的行数（预分配段按大小切换，日志分布在多个段文件中）
+    * 参数和服务器的异步日志相同：单条日志最长 2000 字节，每个线程缓冲 512 条
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <pthread.h>
+#include <string>
+#include <vector>
+#include "log.h"
+
+static long long lines_per_thread = 1000000;
+
+static long long now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static void *writer_thread(void *arg) {
+    int id = (int)(long)arg;
+    for (long long i = 0; i < lines_per_thread; ++i) {
+        // 和访问日志相近的长度和参数
+        LOG_INFO_M(LOG_MODULE_ACCESS, "127.0.0.1 - - \"GET /%s HTTP/1.1\" %d %lld thread %d", "welcome.html", 200,
+                   i, id);
+    }
+    return nullptr;
+}
+
+// 文件中的换行数
+static long long count_lines(const std::string &path) {
+    FILE *fp = fopen(path.c_str(), "r");
+    if (fp == nullptr) {
+        return -1;
+    }
+    long long lines = 0;
+    char buf[65536];
+    size_t n;
+    while ((n = fread(buf, 1, sizeof(buf), fp)) > 0) {
+        for (size_t i = 0; i < n; ++i) {
+            lines += buf[i] == '\n';
+        }
+    }
+    fclose(fp);
+    return lines;
+}
+
+int main(int argc, char *argv[]) {
+    const char *mode = argc > 1 ? argv[1] : "async";
+    int threads = argc > 2 ? atoi(argv[2]) : 4;
+    lines_per_thread = argc > 3 ? atoll(argv[3]) : 1000000;
+    size_t segment = argc > 4 ? (size_t)atoi(argv[4]) * 1024 * 1024 : 0;
+
+    Log::LOG_MODE format = Log::TEXT;
+    int queue = 512;
+    if (strcmp(mode, "sync") == 0) {
+        queue = 0;
+    }
+    else if (strcmp(mode, "deferred") == 0) {
+        format = Log::DEFERRED;
+    }
+    else if (strcmp(mode, "binary") == 0) {
+        format = Log::BINARY;
+    }
+    else if (strcmp(mode, "async") != 0) {
+        threads = 0;
+    }
+    if (threads <= 0 || lines_per_thread <= 0) {
+        fprintf(stderr, "usage: %s [sync|async|deferred|binary] [threads] [lines per thread] [segment MB]\n", argv[0]);
+        return 2;
+    }
+
+    // 不按行数分文件，所有日志写在同一个文件中
+    Log *log = Log::get_instance();
+    if (!log->init("BenchLog", 2000, 2000000000, queue, 100, format, segment)) {
+        fprintf(stderr, "log init failed\n");
+        return 2;
+    }
+    std::string path = log->path();
+    long long before = count_lines(path);
+
+    std::vector<pthread_t> tids(threads);
+    long long begin = now_us();
+    for (int i = 0; i < threads; ++i) {
+        pthread_create(&tids[i], nullptr, writer_thread, (void *)(long)i);
+    }
+    for (int i = 0; i < threads; ++i) {
+        pthread_join(tids[i], nullptr);
+    }
+    long long returned = now_us();
+    log->flush();
+    long long flushed = now_us();
+
+    long long total = threads * lines_per_thread;
+    printf("%s, %d threads, %lld lines, segment %zu MB\n", mode, threads, total, segment / (1024 * 1024));
+    printf("writers returned  %8.3f s  %10.0f lines/s\n", (returned - begin) / 1e6, total * 1e6 / (returned - begin));
+    printf("after flush       %8.3f s  %10.0f lines/s\n", (flushed - begin) / 1e6, total * 1e6 / (flushed - begin));
+    if (format != Log::BINARY && segment == 0) {
+        long long written = count_lines(path) - before;
+        printf("lines in %s: %lld%s\n", path.c_str(), written, written == total ? "" : " (MISSING)");
+        return written == total ? 0 : 1;
+    }
+    return 0;
+}
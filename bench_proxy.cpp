@@ -0,0 +1,87 @@
+/*
+反向代理压测：多个线程在长连接上交替发送 GET 和带请求体的 POST，检查每个响应是否属于自己的请求，
+输出每秒请求数、延迟和各后端处理的请求数
+    用法：
+        在 server.cpp 中定义 UPSTREAM_PREFIX "/api/"（UPSTREAM_BACKENDS 默认为 127.0.0.1:8081,127.0.0.1:8082），
+        重新编译后运行服务器，再运行：
+        ./bench_backend 8081 & ./bench_backend 8082 &
+        ./bench_proxy [port] [threads] [seconds] [prefix]
+        默认 9999 端口、4 个线程、5 秒、路径前缀 /api/
+    * 后端的响应体为 "backend <port> <方法> <路径> <请求体长度>"（见 bench_backend.cpp），
+      路径或请求体长度不符说明响应串到了别的请求上，计为错误，有错误时返回 1
+    * ./bench_backend 8081 keep-alive 10 每 10 个响应关闭一次连接，测试代理重新连接后端；
+      ./bench_backend 8081 "Keep-Alive, x-close" 测试 Connection 头按逗号切分的解析
+    * 同一 IP 的请求受 IP_RATE 限制，压测前应把 IP_RATE 设为 0
+*/
+
+#include <map>
+#include "bench_util.h"
+
+static int port = 9999;
+static const char *prefix = "/api/";
+
+// 每个线程自己的请求序号和各后端处理的请求数
+struct Proxy_state {
+    Proxy_state() : next(0) {}
+    long long next;
+    std::map<int, long long> backends; // 后端端口 -> 处理的请求数
+};
+
+static bool proxy_request(Bench_worker *w) {
+    if (w->conn.fd < 0 && !w->conn.connect(port)) {
+        return false;
+    }
+    Proxy_state *st = (Proxy_state *)w->data;
+    long long i = st->next++;
+    char path[256];
+    snprintf(path, sizeof(path), "%st%d/%lld", prefix, w->id, i);
+    std::string form = i % 2 == 0 ? "" : "n=" + std::to_string(i);
+    std::string req = form.empty() ? bench_get(path) : bench_post(path, form);
+    std::string body;
+    if (!w->conn.request(req, &body) || w->conn.status != 200) {
+        return false;
+    }
+    int backend = 0;
+    char method[16], got_path[256];
+    long long length = -1;
+    if (sscanf(body.c_str(), "backend %d %15s %255s %lld", &backend, method, got_path, &length) != 4
+        || strcmp(got_path, path) != 0 || length != (long long)form.size()) {
+        fprintf(stderr, "mismatched response for %s: %s", path, body.c_str());
+        return false;
+    }
+    ++st->backends[backend];
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    port = argc > 1 ? atoi(argv[1]) : 9999;
+    int threads = argc > 2 ? atoi(argv[2]) : 4;
+    int seconds = argc > 3 ? atoi(argv[3]) : 5;
+    if (argc > 4) {
+        prefix = argv[4];
+    }
+    if (threads <= 0 || seconds <= 0) {
+        fprintf(stderr, "usage: %s [port] [threads] [seconds] [prefix]\n", argv[0]);
+        return 2;
+    }
+
+    std::vector<Proxy_state> states(threads);
+    std::vector<Bench_worker> workers(threads);
+    for (int i = 0; i < threads; ++i) {
+        workers[i].data = &states[i];
+    }
+    Bench_result r = bench_run(workers, seconds, proxy_request);
+    std::map<int, long long> backends;
+    for (int i = 0; i < threads; ++i) {
+        for (std::map<int, long long>::iterator it = states[i].backends.begin(); it != states[i].backends.end(); ++it) {
+            backends[it->first] += it->second;
+        }
+    }
+
+    printf("%d threads, %s*, GET and POST on keep-alive connections\n", threads, prefix);
+    r.print("requests", "proxied request");
+    for (std::map<int, long long>::iterator it = backends.begin(); it != backends.end(); ++it) {
+        printf("backend %d: %lld requests\n", it->first, it->second);
+    }
+    return r.errors == 0 ? 0 : 1;
+}
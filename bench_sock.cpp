@@ -0,0 +1,89 @@
+/*
+socket 选项的回环延迟测试：单线程依次请求，输出每个路径在长连接、新连接、TCP Fast Open 新连接上的延迟
+    用法：./bench_sock [port] [count] [path ...]
+        默认 9999 端口、每项 1000 次、请求 /
+    * socket 选项在编译期由 server.cpp 中的 SOCK_* 配置，修改其中一项后重新编译、运行服务器，
+      对同一组路径各运行一次，比较结果即为该选项的影响
+    * 响应大小影响 TCP_NODELAY、TCP_CORK 和发送缓冲区的效果，可在网站根目录下放入 1KB、100KB、1MB 的文件一起测试
+    * 长连接先预热一次；TFO 需要服务端开启 SOCK_FASTOPEN 且内核参数 net.ipv4.tcp_fastopen 为 3，
+      第一次连接取得 cookie，之后的请求随 SYN 发出
+    * 同一 IP 的请求受 IP_RATE 限制，次数较多时应把 IP_RATE 设为 0
+*/
+
+#include "bench_util.h"
+
+static int port = 9999;
+static int count = 1000;
+
+// 在一个长连接上请求 count 次
+static bool keep_alive(const char *path, Bench_latency &latency) {
+    std::string req = bench_get(path);
+    Bench_conn conn;
+    if (!conn.connect(port) || !conn.request(req)) {
+        return false;
+    }
+    for (int i = 0; i < count; ++i) {
+        long long begin = bench_now_us();
+        if (!conn.request(req) || conn.status != 200) {
+            return false;
+        }
+        latency.add(bench_now_us() - begin);
+        if (conn.close && !conn.connect(port)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+// 每次新建连接请求一次，fastopen 时请求随 SYN 发出
+static bool new_conn(const char *path, bool fastopen, Bench_latency &latency) {
+    std::string req = bench_get(path, false);
+    Bench_conn conn;
+    // 第一次连接取得 TFO cookie，不计入
+    for (int i = -1; i < count; ++i) {
+        long long begin = bench_now_us();
+        bool ok = fastopen ? conn.connect_fastopen(port, req) : conn.connect(port) && conn.send_all(req);
+        if (!ok || !conn.read_response() || conn.status != 200) {
+            return false;
+        }
+        conn.disconnect();
+        if (i >= 0) {
+            latency.add(bench_now_us() - begin);
+        }
+    }
+    return true;
+}
+
+int main(int argc, char *argv[]) {
+    port = argc > 1 ? atoi(argv[1]) : 9999;
+    count = argc > 2 ? atoi(argv[2]) : 1000;
+    if (count <= 0) {
+        fprintf(stderr, "usage: %s [port] [count] [path ...]\n", argv[0]);
+        return 2;
+    }
+    std::vector<const char *> paths;
+    for (int i = 3; i < argc; ++i) {
+        paths.push_back(argv[i]);
+    }
+    if (paths.empty()) {
+        paths.push_back("/");
+    }
+
+    int ret = 0;
+    for (size_t i = 0; i < paths.size(); ++i) {
+        const char *modes[] = {"keep-alive", "new", "fastopen"};
+        for (int m = 0; m < 3; ++m) {
+            Bench_latency latency;
+            bool ok = m == 0 ? keep_alive(paths[i], latency) : new_conn(paths[i], m == 2, latency);
+            char name[256];
+            snprintf(name, sizeof(name), "%-10s %s", modes[m], paths[i]);
+            if (!ok) {
+                printf("%-28s failed after %zu requests\n", name, latency.samples.size());
+                ret = 1;
+                continue;
+            }
+            latency.print(name);
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,250 @@
+/*
+定时器链表的连接抖动微基准：不经过网络，只测定时器节点的分配方式对接入、关闭连接的影响
+    用法：./bench_timer [live timers ...]
+        默认 16 1024 4096 个存活的定时器
+    * 每轮模拟一次连接抖动：随机关闭一个连接（删除它的定时器），接入一个新连接（分配并插入定时器），
+      再延长一个随机连接的定时器（adjust_timer）；输出每轮的平均耗时（纳秒）
+    * 三种分配方式使用同一份链表代码（与 lst_timer.h 中的 sort_timer_lst 相同）和同一个随机序列：
+          new/delete：原来的做法
+          slab packed：slab_allocator.h 的做法，槽按对象本身的对齐紧密排列
+          slab padded：每个槽补齐到整条缓存行（64 字节）
+      另一行是 sort_timer_lst 本身（slab packed），用于确认与上面的结果一致
+    * alloc only 只做分配和释放，不操作链表，单独比较分配器本身的开销
+*/
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <time.h>
+#include <algorithm>
+#include <vector>
+#include "lst_timer.h"
+
+static long long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// xorshift：每种分配方式使用相同的随机序列
+struct Rand {
+    unsigned long long s;
+    explicit Rand(unsigned long long seed) : s(seed) {}
+    size_t next(size_t n) {
+        s ^= s << 13;
+        s ^= s >> 7;
+        s ^= s << 17;
+        return s % n;
+    }
+};
+
+struct New_pool {
+    util_timer *alloc() {
+        return new util_timer;
+    }
+    void release(util_timer *t) {
+        delete t;
+    }
+};
+
+struct Slab_pool {
+    util_timer *alloc() {
+        return slab.alloc();
+    }
+    void release(util_timer *t) {
+        slab.release(t);
+    }
+    Slab_allocator<util_timer> slab;
+};
+
+// 补齐到整条缓存行的定时器
+struct alignas(SLAB_CACHE_LINE) Padded_timer : util_timer {};
+
+struct Padded_pool {
+    util_timer *alloc() {
+        return slab.alloc();
+    }
+    void release(util_timer *t) {
+        slab.release(static_cast<Padded_timer *>(t));
+    }
+    Slab_allocator<Padded_timer> slab;
+};
+
+// 与 sort_timer_lst 相同的升序双向链表，节点由 Pool 分配
+template <typename Pool>
+class Churn_list {
+public:
+    Churn_list() : head(nullptr), tail(nullptr) {}
+    ~Churn_list() {
+        while (head != nullptr) {
+            util_timer *next = head->next;
+            pool.release(head);
+            head = next;
+        }
+    }
+    util_timer *create_timer() {
+        return pool.alloc();
+    }
+    void add_timer(util_timer *timer) {
+        if (head == nullptr) {
+            head = tail = timer;
+            return;
+        }
+        if (timer->expire < head->expire) {
+            timer->next = head;
+            head->prev = timer;
+            head = timer;
+            return;
+        }
+        add_timer(timer, head);
+    }
+    void adjust_timer(util_timer *timer) {
+        util_timer *tmp = timer->next;
+        if (tmp == nullptr || timer->expire < tmp->expire) {
+            return;
+        }
+        if (timer == head) {
+            head = head->next;
+            head->prev = nullptr;
+            timer->next = nullptr;
+            add_timer(timer);
+        }
+        else {
+            timer->prev->next = timer->next;
+            timer->next->prev = timer->prev;
+            timer->prev = nullptr;
+            timer->next = nullptr;
+            add_timer(timer, tmp);
+        }
+    }
+    void del_timer(util_timer *timer) {
+        if (head == tail) {
+            head = tail = nullptr;
+        }
+        else if (timer == head) {
+            head = head->next;
+            head->prev = nullptr;
+        }
+        else if (timer == tail) {
+            tail = tail->prev;
+            tail->next = nullptr;
+        }
+        else {
+            timer->prev->next = timer->next;
+            timer->next->prev = timer->prev;
+        }
+        pool.release(timer);
+    }
+
+    Pool pool;
+
+private:
+    void add_timer(util_timer *timer, util_timer *lst_head) {
+        util_timer *prev = lst_head;
+        util_timer *cur = prev->next;
+        while (cur != nullptr && !(timer->expire < cur->expire)) {
+            prev = cur;
+            cur = cur->next;
+        }
+        prev->next = timer;
+        timer->prev = prev;
+        timer->next = cur;
+        if (cur != nullptr) {
+            cur->prev = timer;
+        }
+        else {
+            tail = timer;
+        }
+    }
+
+    util_timer *head, *tail;
+};
+
+// 每轮的耗时（纳秒）：关闭一个随机连接、接入一个新连接、延长一个随机连接的定时器
+template <typename List>
+static double churn(size_t live, long long rounds) {
+    List lst;
+    std::vector<util_timer *> timers(live);
+    Rand rnd(12345);
+    time_t clock = 0; // 虚拟时钟，新连接的超时时间递增，和服务器中一样插入到链表尾部附近
+    for (size_t i = 0; i < live; ++i) {
+        timers[i] = lst.create_timer();
+        timers[i]->expire = ++clock;
+        lst.add_timer(timers[i]);
+    }
+    long long begin = now_ns();
+    for (long long r = 0; r < rounds; ++r) {
+        size_t i = rnd.next(live);
+        lst.del_timer(timers[i]);
+        timers[i] = lst.create_timer();
+        timers[i]->expire = ++clock;
+        lst.add_timer(timers[i]);
+        util_timer *t = timers[rnd.next(live)];
+        t->expire = ++clock;
+        lst.adjust_timer(t);
+    }
+    return (double)(now_ns() - begin) / rounds;
+}
+
+// 只分配、释放，不操作链表
+template <typename Pool>
+static double alloc_only(size_t live, long long rounds) {
+    Pool pool;
+    std::vector<util_timer *> timers(live);
+    Rand rnd(12345);
+    for (size_t i = 0; i < live; ++i) {
+        timers[i] = pool.alloc();
+    }
+    long long begin = now_ns();
+    for (long long r = 0; r < rounds; ++r) {
+        size_t i = rnd.next(live);
+        pool.release(timers[i]);
+        timers[i] = pool.alloc();
+        timers[i]->expire = r;
+    }
+    double ns = (double)(now_ns() - begin) / rounds;
+    for (size_t i = 0; i < live; ++i) {
+        pool.release(timers[i]);
+    }
+    return ns;
+}
+
+int main(int argc, char *argv[]) {
+    std::vector<size_t> lives;
+    for (int i = 1; i < argc; ++i) {
+        lives.push_back(atol(argv[i]));
+    }
+    if (lives.empty()) {
+        lives.push_back(16);
+        lives.push_back(1024);
+        lives.push_back(4096);
+    }
+
+    printf("util_timer %zu bytes, padded slot %zu bytes; ns per round\n", sizeof(util_timer), sizeof(Padded_timer));
+    printf("%-10s %12s %12s %12s %15s\n", "live", "new/delete", "slab packed", "slab padded", "sort_timer_lst");
+    for (size_t k = 0; k < lives.size(); ++k) {
+        size_t live = lives[k];
+        if (live == 0) {
+            continue;
+        }
+        // 链表插入是 O(n) 的，存活的定时器越多轮数越少
+        long long rounds = std::max(1000LL, 200000000LL / (long long)live);
+        double a = churn<Churn_list<New_pool> >(live, rounds);
+        double b = churn<Churn_list<Slab_pool> >(live, rounds);
+        double c = churn<Churn_list<Padded_pool> >(live, rounds);
+        double d = churn<sort_timer_lst>(live, rounds);
+        printf("%-10zu %12.1f %12.1f %12.1f %15.1f\n", live, a, b, c, d);
+    }
+    printf("\nalloc only (no list), ns per release + alloc\n");
+    printf("%-10s %12s %12s %12s\n", "live", "new/delete", "slab packed", "slab padded");
+    for (size_t k = 0; k < lives.size(); ++k) {
+        size_t live = lives[k];
+        if (live == 0) {
+            continue;
+        }
+        double a = alloc_only<New_pool>(live, 10000000);
+        double b = alloc_only<Slab_pool>(live, 10000000);
+        double c = alloc_only<Padded_pool>(live, 10000000);
+        printf("%-10zu %12.1f %12.1f %12.1f\n", live, a, b, c);
+    }
+    return 0;
+}
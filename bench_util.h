@@ -0,0 +1,294 @@
+/*
+压测、测试工具（bench_*）共用的阻塞 HTTP 客户端和统计函数，只用于本机回环测试
+    * 响应只支持 Content-Length 给出长度的消息体（服务器的响应都带 Content-Length），
+      没有 Content-Length 时读到对端关闭为止
+    * 不是线程安全的：Bench_conn 的接收缓冲区属于该连接，每个线程使用自己的连接
+    * bench_run：多线程压测的公共循环，每个线程有自己的连接和延迟统计，工具只提供发送一个请求的函数
+*/
+
+#ifndef BENCH_UTIL_H
+#define BENCH_UTIL_H
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <pthread.h>
+#include <algorithm>
+#include <atomic>
+#include <string>
+#include <vector>
+
+static inline long long bench_now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+}
+
+static inline sockaddr_in bench_addr(int port) {
+    sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_port = htons(port);
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    return addr;
+}
+
+// 一个到 127.0.0.1:port 的连接，以及已收到还没有解析的数据
+struct Bench_conn {
+    Bench_conn() : fd(-1), status(0), close(false) {}
+    ~Bench_conn() {
+        disconnect();
+    }
+
+    bool connect(int port) {
+        disconnect();
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr = bench_addr(port);
+        if (fd < 0 || ::connect(fd, (sockaddr *)&addr, sizeof(addr)) != 0) {
+            disconnect();
+            return false;
+        }
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &on, sizeof(on));
+        buf.clear();
+        return true;
+    }
+    // TCP Fast Open：请求随 SYN 发出（服务端未开启或没有 cookie 时内核退回普通握手）
+    bool connect_fastopen(int port, const std::string &req) {
+        disconnect();
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in addr = bench_addr(port);
+        if (fd < 0 || sendto(fd, req.data(), req.size(), MSG_FASTOPEN, (sockaddr *)&addr, sizeof(addr))
+                      != (ssize_t)req.size()) {
+            disconnect();
+            return false;
+        }
+        buf.clear();
+        return true;
+    }
+    void disconnect() {
+        if (fd >= 0) {
+            ::close(fd);
+            fd = -1;
+        }
+    }
+
+    bool send_all(const std::string &data) {
+        size_t sent = 0;
+        while (sent < data.size()) {
+            ssize_t n = send(fd, data.data() + sent, data.size() - sent, MSG_NOSIGNAL);
+            if (n <= 0) {
+                return false;
+            }
+            sent += n;
+        }
+        return true;
+    }
+
+    /*
+        读一个完整的响应：状态码写入 status，响应头写入 head，消息体写入 body（body 为 nullptr 时丢弃），
+        close 表示服务器要求关闭连接；出错或连接关闭时返回 false
+    */
+    bool read_response(std::string *body = nullptr) {
+        size_t end;
+        while ((end = buf.find("\r\n\r\n")) == std::string::npos) {
+            if (!fill()) {
+                return false;
+            }
+        }
+        head.assign(buf, 0, end + 4);
+        status = head.size() > 12 ? atoi(head.c_str() + 9) : 0;
+        close = header_has("Connection:", "close");
+        const char *cl = strcasestr(head.c_str(), "Content-Length:");
+        long long length = cl != nullptr ? atoll(cl + 15) : -1;
+        buf.erase(0, end + 4);
+        if (length >= 0) {
+            while ((long long)buf.size() < length) {
+                if (!fill()) {
+                    return false;
+                }
+            }
+        }
+        else {
+            while (fill()) {
+            }
+        }
+        size_t take = length >= 0 ? (size_t)length : buf.size();
+        if (body != nullptr) {
+            body->assign(buf, 0, take);
+        }
+        buf.erase(0, take);
+        return true;
+    }
+
+    // 发送请求并读取响应
+    bool request(const std::string &req, std::string *body = nullptr) {
+        return send_all(req) && read_response(body);
+    }
+
+    // 响应头中 name 的值是否包含 value（不区分大小写）
+    bool header_has(const char *name, const char *value) const {
+        const char *h = strcasestr(head.c_str(), name);
+        if (h == nullptr) {
+            return false;
+        }
+        const char *eol = strstr(h, "\r\n");
+        std::string v(h + strlen(name), eol != nullptr ? eol - h - strlen(name) : strlen(h + strlen(name)));
+        return strcasestr(v.c_str(), value) != nullptr;
+    }
+
+    int fd;
+    int status;
+    bool close;
+    std::string head;
+    std::string buf;
+
+private:
+    bool fill() {
+        char tmp[65536];
+        ssize_t n = recv(fd, tmp, sizeof(tmp), 0);
+        if (n <= 0) {
+            return false;
+        }
+        buf.append(tmp, n);
+        return true;
+    }
+};
+
+// GET 请求，keep_alive 为 false 时带 Connection: close
+static inline std::string bench_get(const char *path, bool keep_alive = true, const char *extra = "") {
+    std::string req = "GET ";
+    req += path;
+    req += " HTTP/1.1\r\nHost: localhost\r\nConnection: ";
+    req += keep_alive ? "keep-alive" : "close";
+    req += "\r\n";
+    req += extra;
+    req += "\r\n";
+    return req;
+}
+
+// 表单 POST 请求
+static inline std::string bench_post(const char *path, const std::string &form, bool keep_alive = true) {
+    char head[256];
+    snprintf(head, sizeof(head), "POST %s HTTP/1.1\r\nHost: localhost\r\nConnection: %s\r\n"
+             "Content-Type: application/x-www-form-urlencoded\r\nContent-Length: %zu\r\n\r\n",
+             path, keep_alive ? "keep-alive" : "close", form.size());
+    return head + form;
+}
+
+// 延迟统计（微秒）：p50、p99、平均值
+struct Bench_latency {
+    std::vector<long long> samples;
+
+    void add(long long us) {
+        samples.push_back(us);
+    }
+    void print(const char *name) {
+        if (samples.empty()) {
+            printf("%-28s no samples\n", name);
+            return;
+        }
+        std::sort(samples.begin(), samples.end());
+        long long sum = 0;
+        for (size_t i = 0; i < samples.size(); ++i) {
+            sum += samples[i];
+        }
+        printf("%-28s n %-7zu p50 %6lld us  p99 %6lld us  mean %6lld us\n", name, samples.size(),
+               samples[samples.size() / 2], samples[samples.size() * 99 / 100], sum / (long long)samples.size());
+    }
+};
+
+struct Bench_worker;
+// 发送一个请求并读取响应，成功时返回 true；连接由该函数按需建立，失败时由 bench_run 断开
+typedef bool (*bench_request_fn)(Bench_worker *w);
+
+// 压测线程：seed、data 可由调用者在 bench_run 之前设置，其余由 bench_run 填写
+struct Bench_worker {
+    Bench_worker() : id(0), seed(0), data(nullptr), requests(0), errors(0), fn(nullptr), stop(nullptr) {}
+
+    int id; // 线程序号
+    unsigned seed; // rand_r 的种子，为 0 时由 bench_run 设置
+    void *data; // 工具自己的每线程数据
+    Bench_conn conn;
+    long long requests; // 成功的请求数
+    long long errors;
+    Bench_latency latency; // 每个成功请求的延迟（包括 fn 中建立连接的时间）
+
+    pthread_t tid;
+    bench_request_fn fn;
+    const std::atomic<bool> *stop;
+};
+
+static inline void *bench_worker_thread(void *arg) {
+    Bench_worker *w = (Bench_worker *)arg;
+    while (!w->stop->load(std::memory_order_relaxed)) {
+        long long begin = bench_now_us();
+        if (!w->fn(w)) {
+            ++w->errors;
+            w->conn.disconnect();
+            usleep(1000);
+            continue;
+        }
+        w->latency.add(bench_now_us() - begin);
+        ++w->requests;
+        // 服务器要求关闭时下一个请求重新连接
+        if (w->conn.close) {
+            w->conn.disconnect();
+        }
+    }
+    return nullptr;
+}
+
+// 汇总的结果
+struct Bench_result {
+    long long requests;
+    long long errors;
+    double elapsed; // 秒
+    Bench_latency latency;
+
+    // 输出每秒请求数和延迟，unit 为请求的单位（如 logins），name 为延迟一行的名称
+    void print(const char *unit, const char *name) {
+        printf("%lld %s in %.2f s, %.0f %s/s, %lld errors\n", requests, unit, elapsed, requests / elapsed, unit,
+               errors);
+        latency.print(name);
+    }
+};
+
+// 每个 worker 一个线程，循环调用 fn 直到 seconds 秒后，汇总所有线程的结果
+static inline Bench_result bench_run(std::vector<Bench_worker> &workers, int seconds, bench_request_fn fn) {
+    std::atomic<bool> stop(false);
+    long long begin = bench_now_us();
+    for (size_t i = 0; i < workers.size(); ++i) {
+        Bench_worker &w = workers[i];
+        w.id = (int)i;
+        if (w.seed == 0) {
+            w.seed = (unsigned)(begin + i * 7919);
+        }
+        w.fn = fn;
+        w.stop = &stop;
+        pthread_create(&w.tid, nullptr, bench_worker_thread, &w);
+    }
+    sleep(seconds);
+    stop.store(true);
+    Bench_result r;
+    r.requests = 0;
+    r.errors = 0;
+    for (size_t i = 0; i < workers.size(); ++i) {
+        pthread_join(workers[i].tid, nullptr);
+        r.requests += workers[i].requests;
+        r.errors += workers[i].errors;
+        r.latency.samples.insert(r.latency.samples.end(), workers[i].latency.samples.begin(),
+                                 workers[i].latency.samples.end());
+    }
+    r.elapsed = (bench_now_us() - begin) / 1e6;
+    return r;
+}
+
+#endif
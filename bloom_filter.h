@@ -0,0 +1,117 @@
+/*
+计数布隆过滤器
+    * 每个位置为一个 8 位计数器（饱和计数），支持删除
+    * k 个哈希位置由两个哈希值组合得到：h1 + i * h2
+    * 查询无锁，读取计数器为 relaxed 原子操作；增删计数器由调用者保证互斥
+*/
+
+#ifndef BLOOM_FILTER_H
+#define BLOOM_FILTER_H
+
+#include <stdint.h>
+#include <string.h>
+#include <math.h>
+#include <atomic>
+#include <exception>
+
+class Counting_bloom_filter {
+public:
+    /*
+        capacity：预计元素数量
+        fp_rate：元素数量达到 capacity 时期望的误判率
+    */
+    Counting_bloom_filter(uint64_t capacity, double fp_rate = 0.01) {
+        if (capacity == 0 || fp_rate <= 0 || fp_rate >= 1) {
+            throw std::exception();
+        }
+        // m = -n * ln(p) / (ln2)^2，k = m / n * ln2，m 向上取整为 2 的幂
+        double bits = -(double)capacity * log(fp_rate) / (log(2.0) * log(2.0));
+        m_size = 64;
+        while (m_size < bits) {
+            m_size <<= 1;
+        }
+        m_hash_num = (int)(bits / capacity * log(2.0) + 0.5);
+        if (m_hash_num < 1) {
+            m_hash_num = 1;
+        }
+        m_counters = new std::atomic<uint8_t>[m_size];
+        clear();
+    }
+    ~Counting_bloom_filter() {
+        delete [] m_counters;
+    }
+
+    void add(const char *key) {
+        uint32_t h1, h2;
+        hash(key, h1, h2);
+        for (int i = 0; i < m_hash_num; ++i) {
+            std::atomic<uint8_t> &c = m_counters[(h1 + i * h2) & (m_size - 1)];
+            uint8_t v = c.load(std::memory_order_relaxed);
+            if (v != UINT8_MAX) { // 饱和后不再增加，也不会再被删除
+                c.store(v + 1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void remove(const char *key) {
+        if (!maybe_contains(key)) {
+            return;
+        }
+        uint32_t h1, h2;
+        hash(key, h1, h2);
+        for (int i = 0; i < m_hash_num; ++i) {
+            std::atomic<uint8_t> &c = m_counters[(h1 + i * h2) & (m_size - 1)];
+            uint8_t v = c.load(std::memory_order_relaxed);
+            if (v != 0 && v != UINT8_MAX) {
+                c.store(v - 1, std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // 返回 false 表示一定不存在，返回 true 表示可能存在
+    bool maybe_contains(const char *key) const {
+        uint32_t h1, h2;
+        hash(key, h1, h2);
+        for (int i = 0; i < m_hash_num; ++i) {
+            if (m_counters[(h1 + i * h2) & (m_size - 1)].load(std::memory_order_relaxed) == 0) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    void clear() {
+        for (uint64_t i = 0; i < m_size; ++i) {
+            m_counters[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t size() const {
+        return m_size;
+    }
+    int hash_num() const {
+        return m_hash_num;
+    }
+
+private:
+    // 64 位 FNV-1a，高低 32 位分别作为两个哈希值，h2 取奇数保证能遍历所有位置
+    static void hash(const char *key, uint32_t &h1, uint32_t &h2) {
+        uint64_t h = 14695981039346656037ULL;
+        for (const unsigned char *p = (const unsigned char *)key; *p; ++p) {
+            h ^= *p;
+            h *= 1099511628211ULL;
+        }
+        h ^= h >> 29; // FNV 低位扩散较差，再混合一次
+        h *= 0xbf58476d1ce4e5b9ULL;
+        h ^= h >> 32;
+        h1 = (uint32_t)h;
+        h2 = (uint32_t)(h >> 32) | 1;
+    }
+
+private:
+    uint64_t m_size; // 计数器数量，2 的幂
+    int m_hash_num; // 哈希函数个数
+    std::atomic<uint8_t> *m_counters;
+};
+
+#endif
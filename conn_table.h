@@ -0,0 +1,155 @@
+/*
+连接槽表：每个连接占用一个槽，定时器、请求队列中的任务和 epoll 事件用 (槽号, 代数) 句柄引用连接
+    * 槽关闭时代数加一，持有旧句柄的定时器、任务、事件比较代数后直接丢弃，
+      不会作用到复用了同一个 fd 或槽的新连接
+    * 热数据（代数、fd、定时器）放在紧凑的槽数组中，每个槽 16 字节；
+      连接对象（请求解析状态等冷数据）放在单独的数组中，只在处理请求时访问
+    * 空闲槽后进先出复用，使用中的槽集中在数组低端，从未用过的槽和连接对象不占用物理内存
+    * 槽的分配、关闭只在主线程中进行；代数是原子变量，工作线程可以用 get 检查句柄是否过期
+*/
+
+#ifndef CONN_TABLE_H
+#define CONN_TABLE_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <new>
+#include <atomic>
+
+class util_timer;
+
+// 连接句柄：槽使用中时代数为奇数，所以有效句柄的代数不为 0
+struct Conn_handle {
+    uint32_t slot;
+    uint32_t gen;
+
+    // 编码为 epoll_event.data.u64：高 32 位不为 0，与直接登记 fd 的监听 socket、管道区分
+    uint64_t to_u64() const {
+        return ((uint64_t)gen << 32) | slot;
+    }
+    static Conn_handle from_u64(uint64_t v) {
+        Conn_handle h;
+        h.slot = (uint32_t)v;
+        h.gen = (uint32_t)(v >> 32);
+        return h;
+    }
+    static bool is_handle(uint64_t v) {
+        return (v >> 32) != 0;
+    }
+};
+
+template <typename T>
+class Conn_table {
+public:
+    explicit Conn_table(int capacity) :
+        m_capacity(capacity > 0 ? capacity : 1), m_used(0), m_free(-1), m_size(0) {
+        // 不初始化：槽第一次分配时才构造，连接对象由 T::init 初始化
+        m_slots = static_cast<Slot *>(malloc(sizeof(Slot) * m_capacity));
+        if (m_slots == nullptr) {
+            throw std::bad_alloc();
+        }
+        m_conns = new T[m_capacity];
+    }
+    ~Conn_table() {
+        free(m_slots);
+        delete [] m_conns;
+    }
+
+    // 为 fd 分配一个槽，槽已用完时返回 false
+    bool open(int fd, Conn_handle &h) {
+        int slot;
+        if (m_free != -1) {
+            slot = m_free;
+            m_free = m_slots[slot].fd;
+        }
+        else if (m_used < m_capacity) {
+            slot = m_used++;
+            new (&m_slots[slot]) Slot();
+        }
+        else {
+            return false;
+        }
+        Slot &s = m_slots[slot];
+        s.fd = fd;
+        s.timer = nullptr;
+        h.slot = slot;
+        h.gen = s.gen.load(std::memory_order_relaxed) + 1;
+        s.gen.store(h.gen, std::memory_order_release);
+        ++m_size;
+        return true;
+    }
+
+    // 关闭槽：代数加一，此后该槽的旧句柄全部失效
+    void close(Conn_handle h) {
+        if (!valid(h)) {
+            return;
+        }
+        Slot &s = m_slots[h.slot];
+        s.gen.store(h.gen + 1, std::memory_order_release);
+        s.fd = m_free;
+        s.timer = nullptr;
+        m_free = h.slot;
+        --m_size;
+    }
+
+    // 句柄有效时返回连接对象，否则返回 nullptr；可在工作线程中调用
+    T *get(Conn_handle h) {
+        return valid(h) ? &m_conns[h.slot] : nullptr;
+    }
+    // 句柄都由 open 产生，槽号一定在已构造的范围内
+    bool valid(Conn_handle h) const {
+        return h.slot < (uint32_t)m_capacity && (h.gen & 1) != 0
+               && m_slots[h.slot].gen.load(std::memory_order_acquire) == h.gen;
+    }
+
+    // 以下访问热数据，只在主线程中对有效句柄调用
+    int fd(Conn_handle h) const {
+        return m_slots[h.slot].fd;
+    }
+    util_timer *timer(Conn_handle h) const {
+        return m_slots[h.slot].timer;
+    }
+    void set_timer(Conn_handle h, util_timer *timer) {
+        m_slots[h.slot].timer = timer;
+    }
+
+    // 对每个使用中的槽调用 f(句柄)，f 中可以关闭该槽；只在主线程中调用
+    template <typename F>
+    void for_each(F f) {
+        for (int i = 0; i < m_used; ++i) {
+            uint32_t gen = m_slots[i].gen.load(std::memory_order_relaxed);
+            if (gen & 1) {
+                Conn_handle h;
+                h.slot = i;
+                h.gen = gen;
+                f(h);
+            }
+        }
+    }
+
+    // 使用中的槽数
+    int size() const {
+        return m_size;
+    }
+    int capacity() const {
+        return m_capacity;
+    }
+
+private:
+    struct Slot {
+        Slot() : gen(0), fd(-1), timer(nullptr) {}
+        std::atomic<uint32_t> gen; // 奇数表示使用中
+        int fd; // 空闲时为下一个空闲槽，-1 表示没有
+        util_timer *timer;
+    };
+
+private:
+    int m_capacity;
+    int m_used; // 构造过的槽数，之后的槽从未使用
+    int m_free; // 空闲槽链表头
+    int m_size;
+    Slot *m_slots;
+    T *m_conns;
+};
+
+#endif
@@ -1,9 +1,14 @@
-#include <map>
+#include <string>
+#include <time.h>
+#include <limits.h>
 #include "http_conn.h"
 #include "log.h"
+#include "session.h"
 
 // 网站根目录
 const char *web_root = "/home/freetime/code/c/network/web_root/";
+// 表单中用户名、密码的最大长度
+#define FORM_VALUE_LEN 99
 
 // 定义HTTP响应的一些状态
 const char *ok_200_title = "OK";
@@ -15,35 +20,123 @@ const char *error_404_title = "Not Found";
 const char *error_404_form = "The requested file was not found on this server.\n";
 const char *error_500_title = "Internal Error";
 const char *error_500_form = "There was an unusual problem serving the request file.\n";
+const char *error_503_title = "Service Unavailable";
+const char *error_503_form = "The server is overloaded, please retry later.\n";
+const char *error_429_title = "Too Many Requests";
+const char *error_429_form = "Too many requests from your address, please retry later.\n";
+const char *error_502_title = "Bad Gateway";
+const char *error_502_form = "The upstream server is unavailable or sent an invalid response.\n";
+
+// 请求方法名，与 METHOD 的顺序一致
+static const char *const method_names[] = {"GET", "POST", "HEAD", "PUT", "DELETE", "TRACE",
+                                           "OPTIONS", "CONNECT", "PATCH"};
+
+// 登录、注册校验使用的用户存储
+User_store *Http_conn::m_user_store = nullptr;
+bool Http_conn::init_user_store(User_store *store) {
+    m_user_store = store;
+    return m_user_store->init();
+}
 
-// 使用 map 将数据库中的用户名和密码载入到服务器中
-Locker users_mutex; // 向数据库插入数据时，用于同步
-std::map<std::string, std::string> users; // 将表中的用户名和密码放入 map 中
-void Http_conn::init_mysql_result(Connection_pool *conn_pool) {
-    // 从数据库连接池中获取一个连接
-    MYSQL *mysql = nullptr;
-    ConnectionRAII mysql_conn(&mysql, conn_pool);
+// 访问日志
+Http_conn::ACCESS_FORMAT Http_conn::m_access_format = Http_conn::ACCESS_OFF;
+int Http_conn::m_access_sample = 1;
+void Http_conn::set_access_log(ACCESS_FORMAT format, int sample) {
+    m_access_format = format;
+    m_access_sample = sample > 0 ? sample : 1;
+}
 
-    // 在 user 表中检索 username，passwd数据
-    if (mysql_query(mysql, "select username, passwd from user")) {
-        LOG_ERROR("select error:%s\n", mysql_error(mysql));
+// 拒绝请求时回复的 503、429、502 响应，不经过工作线程和写缓冲区
+char Http_conn::m_unavailable[256];
+int Http_conn::m_unavailable_len = 0;
+char Http_conn::m_too_many[256];
+int Http_conn::m_too_many_len = 0;
+char Http_conn::m_bad_gateway[256];
+int Http_conn::m_bad_gateway_len = 0;
+// retry_after 小于 0 时不带 Retry-After
+static int format_reject(char *buf, size_t size, int status, const char *title, const char *form, int retry_after) {
+    char retry[32] = "";
+    if (retry_after >= 0) {
+        snprintf(retry, sizeof(retry), "Retry-After: %d\r\n", retry_after);
     }
+    return snprintf(buf, size,
+                    "HTTP/1.1 %d %s\r\n%sContent-Length: %d\r\n"
+                    "Connection: close\r\n\r\n%s",
+                    status, title, retry, (int)strlen(form), form);
+}
+void Http_conn::set_retry_after(int retry_after) {
+    m_unavailable_len = format_reject(m_unavailable, sizeof(m_unavailable), 503,
+                                      error_503_title, error_503_form, retry_after);
+    m_too_many_len = format_reject(m_too_many, sizeof(m_too_many), 429,
+                                   error_429_title, error_429_form, retry_after);
+    m_bad_gateway_len = format_reject(m_bad_gateway, sizeof(m_bad_gateway), 502,
+                                      error_502_title, error_502_form, -1);
+}
 
-    // 从表中获取完整的结果集
-    MYSQL_RES *result = mysql_store_result(mysql);
-
-    // 返回结果集中的列数
-    int num_fields = mysql_num_fields(result);
+// 单调时钟（微秒），只在开启访问日志时读取
+static long long now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
 
-    // 返回所有字段结构的数组
-    MYSQL_FIELD *fields = mysql_fetch_fields(result);
+/*
+    转义访问日志中来自客户端的字段，避免破坏一行记录的格式：
+    双引号、反斜杠和控制字符转义，JSON 使用 \u00XX，CLF 使用 \xXX
+*/
+static void escape_field(const char *in, char *out, int size, bool json) {
+    static const char hex[] = "0123456789abcdef";
+    int n = 0;
+    for (; *in != '\0' && n + 6 < size; ++in) {
+        unsigned char c = *in;
+        if (c == '"' || c == '\\') {
+            out[n++] = '\\';
+            out[n++] = c;
+        }
+        else if (c < 0x20 || c == 0x7f) {
+            out[n++] = '\\';
+            if (json) {
+                memcpy(out + n, "u00", 3);
+                n += 3;
+            }
+            else {
+                out[n++] = 'x';
+            }
+            out[n++] = hex[c >> 4];
+            out[n++] = hex[c & 0xf];
+        }
+        else {
+            out[n++] = c;
+        }
+    }
+    out[n] = '\0';
+}
 
-    // 从结果集中获取下一行，将对应的用户名和密码存入map中
-    while (MYSQL_ROW row = mysql_fetch_row(result)) {
-        std::string temp1(row[0]);
-        std::string temp2(row[1]);
-        users[temp1] = temp2;
+/*
+    从表单数据 key1=value1&key2=value2 中取出 key 对应的值，复制到 arena 中
+    找不到 key 或者值的长度超过 max_len 时返回 nullptr
+*/
+static char *get_form_value(const char *form, const char *key, int max_len, Arena &arena) {
+    if (form == nullptr) {
+        return nullptr;
+    }
+    int key_len = strlen(key);
+    const char *p = form;
+    while (p != nullptr) {
+        if (strncmp(p, key, key_len) == 0 && p[key_len] == '=') {
+            p += key_len + 1;
+            int len = strcspn(p, "&");
+            if (len > max_len) {
+                return nullptr;
+            }
+            return arena.copy(p, len);
+        }
+        p = strchr(p, '&');
+        if (p != nullptr) {
+            ++p;
+        }
     }
+    return nullptr;
 }
 
 // 文件描述符设置非阻塞
@@ -61,11 +154,12 @@ void setnonblocking(int fd) {
 
 // 内核事件表注册读事件，ET模式，选择开启EPOLLONESHOT
 // 开启EPOLLONESHOT：针对与客户端连接的socket；为了让每个连接只被一个线程处理
-void addfd(int epollfd, int fd, bool one_shot) {
+// key 为事件的数据：客户连接为槽表句柄，监听 socket、管道为 fd 本身
+void addfd(int epollfd, int fd, bool one_shot, uint64_t key) {
     struct epoll_event tmp_ep;
     char buf[BUFSIZ];
     tmp_ep.events = EPOLLIN | EPOLLET | EPOLLRDHUP;
-    tmp_ep.data.fd = fd;
+    tmp_ep.data.u64 = key;
     if (one_shot) {
         tmp_ep.events |= EPOLLONESHOT;
     }
@@ -77,6 +171,10 @@ void addfd(int epollfd, int fd, bool one_shot) {
     setnonblocking(fd);
 }
 
+void addfd(int epollfd, int fd, bool one_shot) {
+    addfd(epollfd, fd, one_shot, (uint64_t)fd);
+}
+
 // 从内核事件表删除描述符
 void removefd(int epollfd, int fd) {
     epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, 0);
@@ -84,9 +182,9 @@ void removefd(int epollfd, int fd) {
 }
 
 // 将事件重置为EPOLLONESHOT
-void modfd(int epollfd, int fd, int ev) {
+void modfd(int epollfd, int fd, int ev, uint64_t key) {
     epoll_event event;
-    event.data.fd = fd;
+    event.data.u64 = key;
 
     event.events = ev | EPOLLET | EPOLLONESHOT | EPOLLRDHUP;
 
@@ -95,36 +193,74 @@ void modfd(int epollfd, int fd, int ev) {
 
 int Http_conn::m_epollfd = -1;
 int Http_conn::m_user_count = 0;
+std::atomic<bool> Http_conn::m_draining(false);
+Sock_policy Http_conn::m_sock_policy;
+// 每块 64 个缓冲区（约 250KB），按正在处理的连接数逐块增长；缓冲区只构造一次，借用之间保留 arena 的溢出块
+Slab_allocator<Http_buffer> Http_conn::m_buffer_pool(64, true);
 
 
 // 初始化新的连接
-void Http_conn::init(int sockfd, const sockaddr_in &addr) {
+void Http_conn::init(int sockfd, const sockaddr_in &addr, Conn_handle handle) {
     m_sockfd = sockfd;
     m_address = addr;
+    m_handle = handle;
+    // 槽只在工作线程全部交还后才会被回收、复用
+    m_workers.store(0, std::memory_order_relaxed);
+    m_sock_policy.apply_accept(m_sockfd, m_address.sin_family);
 
-    // reuse
-    int reuse = 1;
-    setsockopt(m_sockfd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
-
-    addfd(m_epollfd, sockfd, true);
+    addfd(m_epollfd, sockfd, true, m_handle.to_u64());
     m_user_count++;
+    // 构造函数不初始化任何成员，未使用的连接对象不占用物理内存
+    m_buf = nullptr;
     init();
 }
 
+// 从池中借用缓冲区，只在主线程中调用
+void Http_conn::acquire_buffer() {
+    m_buf = m_buffer_pool.alloc();
+    m_read_buf = m_buf->read_buf;
+    m_write_buf = m_buf->write_buf;
+    m_real_file = m_buf->real_file;
+    m_request_path = m_buf->request_path;
+    // 缓冲区不清零，只初始化需要以 '\0' 开头的部分
+    m_read_buf[0] = '\0';
+    m_write_buf[0] = '\0';
+    m_real_file[0] = '\0';
+    m_request_path[0] = '\0';
+}
+
+// 归还缓冲区，之后收到数据时再重新借用
+void Http_conn::release_buffer() {
+    if (m_buf == nullptr) {
+        return;
+    }
+    // 回收这个请求的临时内存，溢出块保留
+    m_buf->arena.reset();
+    m_buffer_pool.release(m_buf);
+    m_buf = nullptr;
+    m_read_buf = nullptr;
+    m_write_buf = nullptr;
+    m_real_file = nullptr;
+    m_request_path = nullptr;
+}
+
 // 初始化新连接
 void Http_conn::init() {
-    // 数据库初始化
-    mysql = nullptr;
     // check_state 从分析请求行状态开始
     m_check_state = CHECK_STATE_REQUESTLINE;
     
     // 请求行数据初始化
     m_method = GET;
+    m_upstream.slot = 0;
+    m_upstream.gen = 0;
     is_post = 0;
     m_url = nullptr;
     m_version = nullptr;   
     m_linger = false;
     m_host = 0;
+    m_string = nullptr;
+    m_cookie_sid = nullptr;
+    m_session[0] = '\0';
 
     // 请求头中数据初始化
     m_content_length = 0;
@@ -133,40 +269,52 @@ void Http_conn::init() {
     m_checked_idx = 0;
     m_read_idx = 0;
     m_start_line = 0; 
-    memset(m_read_buf, '\0', READ_BUFFER_SIZE);
-    memset(m_write_buf, '\0', WRITE_BUFFER_SIZE);
 
-    // 写缓冲区相关数据初始化
+    // 写缓冲区相关数据初始化，缓冲区本身在借用时初始化
     m_write_idx = 0;
 
-    // 客户端请求资源相关数据初始化
-    memset(m_real_file, '\0', FILENAME_LEN);
-
     // 向客户端写入数据初始化
     bytes_to_send = 0;
     bytes_have_send = 0;
     m_iv_count = 0;
+
+    // 访问日志数据初始化
+    m_status = 0;
+    m_time_read = 0;
+    m_time_process = 0;
+    m_time_response = 0;
 }
 
 // 服务器端关闭一个连接
 void Http_conn::close_conn(bool real_close) {
     if (real_close && (m_sockfd != -1)) {
-        removefd(m_epollfd, m_sockfd);
-        m_sockfd = -1;
-        m_user_count--;
+        // 不在工作线程中 close：fd 关闭后可能立即被新连接复用，而主线程仍持有旧连接的定时器。
+        // 关闭读写后重新注册事件，主线程收到 EPOLLHUP 后按句柄关闭 fd、删除定时器、回收槽
+        shutdown(m_sockfd, SHUT_RDWR);
+        modfd(m_epollfd, m_sockfd, EPOLLIN, m_handle.to_u64());
     }
 }
 
+Slab_allocator<Http_buffer>::Stats Http_conn::buffer_stats() {
+    return m_buffer_pool.stats();
+}
+
 
 // 循环读取从客户端中传输的数据，直到无数据可读或者对方关闭连接
 // 非阻塞ET模式下，需要一次性将数据读完
 bool Http_conn::read() {
     if (m_read_idx >= READ_BUFFER_SIZE) {
+        release_buffer();
         return false;
     } 
+    // 空闲连接不持有缓冲区，收到数据时才借用
+    if (m_buf == nullptr) {
+        acquire_buffer();
+    }
 
     int num_read = 0;
-    while (true) {
+    // 缓冲区读满时停止：剩下的数据（反向代理转发的请求体）留在 socket 中
+    while (m_read_idx < READ_BUFFER_SIZE) {
         // 非阻塞IO读取
         num_read = ::read(m_sockfd, m_read_buf + m_read_idx, READ_BUFFER_SIZE - m_read_idx);
         if (num_read == -1) {
@@ -174,34 +322,50 @@ bool Http_conn::read() {
                 break;
             }
             // 读取数据时发生错误，返回false，关闭连接
+            release_buffer();
             return false;
         }
         else if (num_read == 0) { // 对方关闭连接，则服务器也关闭连接，并且移除定时器
+            release_buffer();
             return false;
         }
         m_read_idx += num_read;
     }
+    // 缓冲区不再预先清零，保证读入的数据以 '\0' 结尾
+    m_read_buf[m_read_idx] = '\0';
 
+    // 读完后由主线程放入请求队列，用于计算排队时间
+    if (m_access_format != ACCESS_OFF) {
+        m_time_read = now_us();
+    }
     return true;
 }
 
 
 void Http_conn::process() {
+    if (m_access_format != ACCESS_OFF) {
+        m_time_process = now_us();
+    }
     // 解析请求报文
     HTTP_CODE read_ret = process_read();
     // NO_REQUEST：请求不完整，需要继续接收客户端请求报文
     if (read_ret == NO_REQUEST) {
         // 注册并且监听读事件，设置EPOLLIN和EPOLLONESHOT
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
+        modfd(m_epollfd, m_sockfd, EPOLLIN, m_handle.to_u64());
         return;
     }
     // 调用 process_write 完成报文响应
     bool write_ret = process_write(read_ret);
     if (!write_ret) {
+        // 关闭后不能再注册事件，主线程可能已经回收了该连接
         close_conn();
+        return;
+    }
+    if (m_access_format != ACCESS_OFF) {
+        m_time_response = now_us();
     }
     // 注册并且监听写事件：设置EPOLLOUT和EPOLLONESHOT
-    modfd(m_epollfd, m_sockfd, EPOLLOUT);
+    modfd(m_epollfd, m_sockfd, EPOLLOUT, m_handle.to_u64());
 }
 
 
@@ -216,8 +380,7 @@ Http_conn::HTTP_CODE Http_conn::process_read() {
             || ((line_status = parse_line()) == LINE_OK)) {
         text = get_line(); // 获取一行的起始地址
         m_start_line = m_checked_idx; // 新的一行的下标
-        LOG_INFO("%s", text);
-        Log::get_instance()->flush();
+        LOG_INFO_M(LOG_MODULE_HTTP, "%s", text);
         // 主状态机的三种状态转移逻辑
         switch (m_check_state) {
             case CHECK_STATE_REQUESTLINE: { // 解析请求行
@@ -347,6 +510,11 @@ Http_conn::HTTP_CODE Http_conn::parse_request_line(char *text) {
     if (m_url == nullptr || m_url[0] != '/') {
         return BAD_REQUEST;
     }
+    // 保存原始路径用于访问日志，过长时截断
+    if (m_access_format != ACCESS_OFF) {
+        strncpy(m_request_path, m_url, FILENAME_LEN - 1);
+        m_request_path[FILENAME_LEN - 1] = '\0';
+    }
     // 当url为 / 时，显示欢迎页面
     if (strlen(m_url) == 1) {
         strcat(m_url, "root.html");
@@ -386,9 +554,21 @@ Http_conn::HTTP_CODE Http_conn::parse_request_headers(char *text) {
         text += strspn(text, " \t");
         m_host = text;
     }
+    else if (strncasecmp(text, "Cookie:", 7) == 0) { // 取出会话 token：sid=xxx
+        text += 7;
+        while (*text != '\0') {
+            text += strspn(text, " \t;");
+            if (strncmp(text, "sid=", 4) == 0) {
+                text += 4;
+                text[strcspn(text, "; \t")] = '\0';
+                m_cookie_sid = text;
+                break;
+            }
+            text += strcspn(text, ";");
+        }
+    }
     else {
-        LOG_INFO("oop! Unknow header: %s", text);
-        Log::get_instance()->flush();
+        LOG_INFO_M(LOG_MODULE_HTTP, "oop! Unknow header: %s", text);
     }
     return NO_REQUEST;
 }
@@ -443,106 +623,76 @@ Http_conn::HTTP_CODE Http_conn::do_request() {
     // 处理 POST 请求，实现登录和注册校验
     if (is_post == 1 && (*(p+1) == '2' || *(p+1) == '3')) {
 
-        char *m_url_real = (char*)malloc(sizeof(char)*200);
-        strcpy(m_url_real, "/");
-        strcat(m_url_real, m_url+2);
-        strncpy(m_real_file + len, m_url_real, FILENAME_LEN - len - 1);
-        free(m_url_real);
-
-        // 将用户名和密码提取出来：user=123&passwd=123
-        char name[100], password[100];
-        int i;
-        for (i = 5; m_string[i] != '&'; ++i) { // &为分隔符，前面为用户名
-            name[i-5] = m_string[i];
-        }
-        name[i-5] = '\0';
+        // 请求处理中的临时内存都从 arena 分配，归还缓冲区时回收
+        Arena &arena = m_buf->arena;
+        // 资源路径为 "/" 加上 m_url 去掉开头 "/2" 后的部分，直接拼接到 m_real_file，超长时截断
+        m_real_file[len] = '/';
+        strncpy(m_real_file + len + 1, m_url + 2, FILENAME_LEN - len - 2);
+        m_real_file[FILENAME_LEN - 1] = '\0';
 
-        int j = 0; 
-        for (i = i + 10; m_string[i] != '\0'; ++i, ++j) { // &为分隔符，后面为密码
-            password[j] = m_string[i];
-        }
-        password[j] = '\0';
+        // 将用户名和密码提取出来：user=123&password=123
+        char *name = get_form_value(m_string, "user", FORM_VALUE_LEN, arena);
+        char *password = get_form_value(m_string, "password", FORM_VALUE_LEN, arena);
+        bool has_form = name != nullptr && password != nullptr && name[0] != '\0';
 
         // 通过m_url定位/所在位置，根据/后的第一个字符判断是登录还是注册校验，2：登录校验，3：注册校验
         if (*(p+1) == '3') { // 注册校验
-            // 先检查数据库中是否有重名，没有重名，就增加数据
-            char *sql_insert = (char *)malloc(sizeof(char)*200);
-            strcpy(sql_insert, "INSERT INTO user(username, passwd) VALUES(");
-            strcat(sql_insert, "'");
-            strcat(sql_insert, name);
-            strcat(sql_insert, "', '");
-            strcat(sql_insert, password);
-            strcat(sql_insert, "')");
-            if (users.find(name) == users.end()) {
-                users_mutex.lock();
-                int res = mysql_query(mysql, sql_insert);
-                users.insert(std::pair<std::string, std::string>(name, password));
-                users_mutex.unlock();
-
-                if (!res) {
-                    strcpy(m_url, "/log.html");
-                }
-                else {
-                    strcpy(m_url, "registerError.html");
-                }
+            // 用户名不存在且写入成功则注册成功
+            if (has_form && m_user_store->insert(name, password)) {
+                strcpy(m_url, "/log.html");
             }
             else {
                 strcpy(m_url, "/registerError.html");
             }
         }
-        else if (*(p+1) == '2'){ // 登录校验，直接判断
-            // 若浏览器输入的用户名和密码在表中可以查找到，返回1，否则返回0
-            if (users.find(name) != users.end() && users[name] == password) {
+        else if (*(p+1) == '2'){ // 登录校验
+            // 已登录：会话有效则不再校验用户名和密码
+            if (Session_store::get_instance()->validate(m_cookie_sid)) {
                 strcpy(m_url, "/welcome.html");
             }
             else {
-                strcpy(m_url, "/logError.html");
+                // 若浏览器输入的用户名和密码在表中可以查找到，登录成功并创建会话
+                // 查询结果写入线程局部的 string，复用其容量，不在每次登录时分配
+                static thread_local std::string passwd;
+                if (has_form && m_user_store->lookup(name, passwd) == User_store::USER_FOUND && passwd == password) {
+                    if (!Session_store::get_instance()->create(name, m_session)) {
+                        m_session[0] = '\0';
+                    }
+                    strcpy(m_url, "/welcome.html");
+                }
+                else {
+                    strcpy(m_url, "/logError.html");
+                }
             }
         }
     }
+    // 直接访问欢迎页面需要有效的会话，否则返回登录页面
+    else if (strcmp(m_url, "/welcome.html") == 0 && !Session_store::get_instance()->validate(m_cookie_sid)) {
+        strcpy(m_url, "/log.html");
+    }
 
     // 如果请求资源为 /0，表示跳转注册界面，POST请求
     if (*(p+1) == '0') {
-        char *m_url_real = (char*)malloc(sizeof(char)*200);
-        strcpy(m_url_real, "/register.html");
-
         // 将网站目录和 /register.html 进行拼接，更新到 m_real_file 中
-        strncpy(m_real_file+len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
+        strcpy(m_real_file + len, "/register.html");
     } 
     else if (*(p+1) == '1') { // 如果请求资源为1，跳转登录界面，POST请求
-         char *m_url_real = (char*)malloc(sizeof(char)*200);
-        strcpy(m_url_real, "/log.html");
-
         // 将网站目录和 /log.html 进行拼接，更新到 m_real_file 中
-        strncpy(m_real_file+len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);      
+        strcpy(m_real_file + len, "/log.html");
     }
     else if (*(p + 1) == '5') { // 请求资源为图片，POST请求
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/image.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
+        strcpy(m_real_file + len, "/image.html");
     } 
     else if (*(p + 1) == '6') { // 请求视频，POST请求
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/video.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
+        strcpy(m_real_file + len, "/video.html");
     }
     else if (*(p + 1) == '7') { // 跳转到关注页面，POST请求
-        char *m_url_real = (char *)malloc(sizeof(char) * 200);
-        strcpy(m_url_real, "/about.html");
-        strncpy(m_real_file + len, m_url_real, strlen(m_url_real));
-
-        free(m_url_real);
+        strcpy(m_real_file + len, "/about.html");
     }
     else // 都不符合，跳转到欢迎界面，GET请求，m_url在parse_request_line函数中已经被赋值为 "/root.html"
         strncpy(m_real_file + len, m_url, FILENAME_LEN - len - 1);
+    // 对所有分支生效：strncpy 截断时不写入 '\0'
+    m_real_file[FILENAME_LEN - 1] = '\0';
 
     // 通过 stat 获取资源信息，成功则将信息更新到 m_file_stat，失败返回 NO_RESOURCE
     if (stat(m_real_file, &m_file_stat) < 0)
@@ -644,8 +794,7 @@ bool Http_conn::add_response(const char *format, ...) {
     m_write_idx += len;
     // 清空可变参数列表
     va_end(arg_list);
-    LOG_INFO("request:%s", m_write_buf);
-    Log::get_instance()->flush();
+    LOG_INFO_M(LOG_MODULE_HTTP, "request:%s", m_write_buf);
     return true;
 }
 //添加文本content
@@ -654,13 +803,15 @@ bool Http_conn::add_content(const char *content){
 }
 // 添加状态行
 bool Http_conn::add_status_line(int status, const char *title) { // 添加状态行
+    m_status = status;
     return add_response("%s %d %s\r\n", "HTTP/1.1", status, title);
 }
-// 添加消息报头：文本长度、连接状态、空行
+// 添加消息报头：文本长度、连接状态、会话 Cookie、空行
 bool Http_conn::add_headers(int content_length) {                // 添加消息报头，内部调用 add_content_length 和 add_linger
     add_content_length(content_length);
     add_linger();
-    add_blank_line();
+    add_session_cookie();
+    return add_blank_line();
 }
 //添加文本类型，这里是html
 bool Http_conn::add_content_type() {
@@ -672,8 +823,19 @@ bool Http_conn::add_content_length(int content_length) {
 }
 //添加连接状态，通知浏览器端是保持连接还是关闭
 bool Http_conn::add_linger() {
+    // 热重启排空时不再保持连接
+    if (m_draining.load(std::memory_order_relaxed)) {
+        m_linger = false;
+    }
     return add_response("Connection:%s\r\n", (m_linger == true) ? "keep-alive" : "close");
 }
+//登录成功时通过 Set-Cookie 返回新建的会话 token
+bool Http_conn::add_session_cookie() {
+    if (m_session[0] == '\0') {
+        return true;
+    }
+    return add_response("Set-Cookie:sid=%s; Path=/; HttpOnly\r\n", m_session);
+}
 //添加空行
 bool Http_conn::add_blank_line() {// 添加空行
     return add_response("%s", "\r\n");
@@ -683,12 +845,17 @@ bool Http_conn::add_blank_line() {// 添加空行
 bool Http_conn::write() {
     // 发送的数据为0，表示若响应报文为空，一般不会出现这种情况
     if (bytes_to_send == 0) {
-        modfd(m_epollfd, m_sockfd, EPOLLIN);
+        modfd(m_epollfd, m_sockfd, EPOLLIN, m_handle.to_u64());
+        release_buffer();
         init();
         return true;
     }
 
     int temp = 0;
+    // 响应的第一次写：设置 TCP_CORK，响应头和文件内容按满的报文段发出，写完后取消
+    if (bytes_have_send == 0) {
+        m_sock_policy.begin_write(m_sockfd, m_address.sin_family);
+    }
     while (1) {
         // 将响应报文发送给客户端
         temp = writev(m_sockfd, m_iv, m_iv_count);
@@ -698,11 +865,13 @@ bool Http_conn::write() {
             if (errno == EAGAIN) { // 写缓冲区满了
                 // 重新注册写事件，重置EPOLLONESHOT事件，等待下一次写事件
                 // 由于注册了写事件，无法立即接受同一用户的下一次请求
-                modfd(m_epollfd, m_sockfd, EPOLLOUT);
+                modfd(m_epollfd, m_sockfd, EPOLLOUT, m_handle.to_u64());
                 return true; // 返回true，表示还有数据要发送，主线程延迟定时器
             }
             // 发送失败，且不是缓冲区问题，则取消映射，并且在主线程中关闭连接
+            access_log();
             unmap();
+            release_buffer();
             return false;
         }
 
@@ -721,9 +890,13 @@ bool Http_conn::write() {
         
         // 发送数据成功，且响应报文整体发送成功，判断是否是长连接
         if (bytes_to_send <= 0) {
+            m_sock_policy.end_write(m_sockfd, m_address.sin_family);
+            access_log();
             unmap(); // 整个响应报文发送成功，关闭文件映射
+            // 响应已发送完，归还缓冲区：长连接空闲等待下一个请求时不占用缓冲区
+            release_buffer();
             // 重新注册读事件，重置EPOLLONESHOT事件，等待下一次读事件
-            modfd(m_epollfd, m_sockfd, EPOLLIN);
+            modfd(m_epollfd, m_sockfd, EPOLLIN, m_handle.to_u64());
             
             if (m_linger) { 
                 init(); // 浏览器的请求为长连接，重新初始化HTTP对象，不关闭连接
@@ -738,28 +911,131 @@ bool Http_conn::write() {
 }
 
 /*
-    取消对数据的映射
+    请求队列或限速拒绝请求时由主线程直接回复：socket 是非阻塞的，响应很短，一般一次写完；
+    写不完也不等待 EPOLLOUT，随后由主线程关闭连接
 */
-void Http_conn::unmap() {
-    if (m_file_address) {
-        munmap(m_file_address, m_file_stat.st_size);
-        m_file_address = 0;
+void Http_conn::send_reject(int sockfd, int status) {
+    if (status == 429) {
+        send(sockfd, m_too_many, m_too_many_len, MSG_NOSIGNAL);
+    }
+    else {
+        send(sockfd, m_unavailable, m_unavailable_len, MSG_NOSIGNAL);
     }
 }
 
+void Http_conn::reject(int status) {
+    m_status = status;
+    const char *resp = m_unavailable;
+    int len = m_unavailable_len;
+    if (status == 429) {
+        resp = m_too_many;
+        len = m_too_many_len;
+    }
+    else if (status == 502) {
+        resp = m_bad_gateway;
+        len = m_bad_gateway_len;
+    }
+    int n = send(m_sockfd, resp, len, MSG_NOSIGNAL);
+    bytes_have_send = n > 0 ? n : 0;
+    if (m_access_format != ACCESS_OFF) {
+        m_time_process = m_time_response = now_us();
+    }
+    access_log();
+}
 
+bool Http_conn::parse_method(const char *text, int len, METHOD &method) {
+    for (int i = 0; i < (int)(sizeof(method_names) / sizeof(method_names[0])); ++i) {
+        if ((int)strlen(method_names[i]) == len && strncasecmp(text, method_names[i], len) == 0) {
+            method = (METHOD)i;
+            return true;
+        }
+    }
+    return false;
+}
 
+void Http_conn::begin_proxy(METHOD method, const char *path, int path_len) {
+    m_method = method;
+    if (m_access_format != ACCESS_OFF) {
+        int n = path_len < FILENAME_LEN - 1 ? path_len : FILENAME_LEN - 1;
+        memcpy(m_request_path, path, n);
+        m_request_path[n] = '\0';
+        // 不经过请求队列，开始转发即开始处理
+        m_time_process = now_us();
+    }
+}
 
+void Http_conn::proxy_response(int status) {
+    m_status = status;
+    if (m_access_format != ACCESS_OFF) {
+        m_time_response = now_us();
+    }
+}
 
+void Http_conn::end_proxy(long long bytes, bool keep_alive) {
+    bytes_have_send = bytes < INT_MAX ? (int)bytes : INT_MAX;
+    access_log();
+    release_buffer();
+    init();
+    if (keep_alive) {
+        modfd(m_epollfd, m_sockfd, EPOLLIN, m_handle.to_u64());
+    }
+}
 
+/*
+    取消对数据的映射
+*/
+void Http_conn::unmap() {
+    if (m_file_address) {
+        munmap(m_file_address, m_file_stat.st_size);
+        m_file_address = 0;
+    }
+}
 
+/*
+    输出一条访问日志，由主线程在响应发送完成或发送失败时调用
+    排队时间：主线程读完请求 ~ 工作线程开始处理；处理时间：解析请求、生成响应；
+    写时间：响应生成完成 ~ 发送完成（含等待 EPOLLOUT 的时间），单位均为微秒
+*/
+void Http_conn::access_log() {
+    if (m_access_format == ACCESS_OFF || m_time_response == 0) {
+        return;
+    }
+    // 成功的响应按比例采样，只由主线程调用，计数不需要同步
+    static int sampled = 0;
+    if (m_status < 400 && m_access_sample > 1 && ++sampled % m_access_sample != 0) {
+        return;
+    }
 
-
-
-
-
-
-
-
-
-
+    long long queue_us = m_time_process - m_time_read;
+    long long process_us = m_time_response - m_time_process;
+    long long write_us = now_us() - m_time_response;
+    char buf[INET_ADDRSTRLEN];
+    const char *ip = peer_name(buf, sizeof(buf));
+    const char *method = m_request_path[0] == '\0' ? "-" : method_names[m_method];
+    char path[FILENAME_LEN * 2];
+    escape_field(m_request_path[0] == '\0' ? "-" : m_request_path, path, sizeof(path),
+                 m_access_format == ACCESS_JSON);
+
+    if (m_access_format == ACCESS_JSON) {
+        LOG_INFO_M(LOG_MODULE_ACCESS,
+                   "{\"remote\":\"%s\",\"method\":\"%s\",\"path\":\"%s\",\"status\":%d,\"bytes\":%d,"
+                   "\"queue_us\":%lld,\"process_us\":%lld,\"write_us\":%lld}",
+                   ip, method, path, m_status, bytes_have_send, queue_us, process_us, write_us);
+    }
+    else {
+        // Common Log Format，末尾追加三个耗时字段；时区按 +hhmm 输出
+        static const char *const months[] = {"Jan", "Feb", "Mar", "Apr", "May", "Jun",
+                                             "Jul", "Aug", "Sep", "Oct", "Nov", "Dec"};
+        const struct tm &tm = log_localtime(time(nullptr)).tm;
+        long off = tm.tm_gmtoff / 60;
+        const char *sign = off < 0 ? "-" : "+";
+        if (off < 0) {
+            off = -off;
+        }
+        LOG_INFO_M(LOG_MODULE_ACCESS,
+                   "%s - - [%02d/%s/%d:%02d:%02d:%02d %s%02ld%02ld] \"%s %s HTTP/1.1\" %d %d %lld %lld %lld",
+                   ip, tm.tm_mday, months[tm.tm_mon], tm.tm_year + 1900, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                   sign, off / 60, off % 60, method, path, m_status, bytes_have_send, queue_us, process_us,
+                   write_us);
+    }
+}
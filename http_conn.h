@@ -16,17 +16,49 @@
 #include <errno.h>
 #include <cstdarg>
 #include <sys/uio.h>
+#include <atomic>
 #include "wrap.h"
-#include "sql_connection_pool.h"
+#include "user_store.h"
+#include "session.h"
+#include "slab_allocator.h"
+#include "arena.h"
+#include "conn_table.h"
+#include "sock_policy.h"
+
+// 客户端请求的文件名称长度的最大值
+#define HTTP_FILENAME_LEN 200
+// 读缓冲区大小
+#define HTTP_READ_BUFFER_SIZE 2048
+// 写缓冲区大小
+#define HTTP_WRITE_BUFFER_SIZE 1024
+// 请求处理过程中临时内存的内联部分大小
+#define HTTP_ARENA_SIZE 512
+
+/*
+    一个请求处理期间使用的缓冲区：连接收到数据时从池中借用，响应发送完成（或连接出错）后归还，
+    空闲的长连接和已关闭的连接不占用缓冲区，内存随正在处理的连接数增长，而不是随 FD_LIMIT
+    请求处理中的临时内存从 arena 分配，归还缓冲区时 reset；缓冲区池是 persistent 的，
+    arena 只在缓冲区第一次创建时构造，申请过的溢出块留给之后借用该缓冲区的请求
+*/
+struct Http_buffer {
+    Http_buffer() : arena(scratch, sizeof(scratch)) {}
+
+    char read_buf[HTTP_READ_BUFFER_SIZE + 1]; // 多一个字节，保证读入的数据后总有 '\0'
+    char write_buf[HTTP_WRITE_BUFFER_SIZE];
+    char real_file[HTTP_FILENAME_LEN];
+    char request_path[HTTP_FILENAME_LEN];
+    char scratch[HTTP_ARENA_SIZE];
+    Arena arena;
+};
 
 class Http_conn {
 public:
     // 客户端请求的文件名称长度的最大值
-    static const int FILENAME_LEN = 200;
+    static const int FILENAME_LEN = HTTP_FILENAME_LEN;
     // 读缓冲区大小
-    static const int READ_BUFFER_SIZE = 2048;
+    static const int READ_BUFFER_SIZE = HTTP_READ_BUFFER_SIZE;
     // 写缓冲区大小
-    static const int WRITE_BUFFER_SIZE = 1024;
+    static const int WRITE_BUFFER_SIZE = HTTP_WRITE_BUFFER_SIZE;
     // 支持的请求方法
     enum METHOD { 
         GET = 0, 
@@ -50,6 +82,12 @@ public:
         INTERNAL_ERROR, // 服务器内部错误
         CLOSED_CONNECTION 
     };
+    // 访问日志格式：不输出、Common Log Format、JSON
+    enum ACCESS_FORMAT {
+        ACCESS_OFF = 0,
+        ACCESS_CLF,
+        ACCESS_JSON
+    };
     // 从状态机状态
     enum LINE_STATUS { 
         LINE_OK = 0, // 完整读取一行 
@@ -62,7 +100,9 @@ public:
     ~Http_conn() {}
 
 public:
-    void init(int sockfd, const sockaddr_in &addr);
+    // handle 为连接在槽表中的句柄，作为 epoll 事件的数据
+    void init(int sockfd, const sockaddr_in &addr, Conn_handle handle);
+    // 工作线程中关闭连接：只关闭 socket 的读写，fd、定时器和槽由主线程在随后的 EPOLLHUP 事件中回收
     void close_conn(bool real = true); 
     // 往读缓冲区读入数据
     bool read();
@@ -72,14 +112,102 @@ public:
     void process();
     // 将响应报文写入客户端
     bool write();
-    // 将数据库中的用户名和密码载入到服务器中
-    void init_mysql_result(Connection_pool *conn_pool);
+    // 设置客户连接的 socket 选项，在接受连接之前调用
+    static void set_sock_policy(const Sock_policy &policy) {
+        m_sock_policy = policy;
+    }
+    // 设置登录、注册校验使用的用户存储，并载入用户数据
+    static bool init_user_store(User_store *store);
+    /*
+        设置访问日志：每个发送完成的响应输出一条记录（LOG_MODULE_ACCESS 模块的 INFO 日志），
+        sample 为 N 时成功的响应每 N 条记录一条，状态码不低于 400 的响应总是记录
+    */
+    static void set_access_log(ACCESS_FORMAT format, int sample);
+    /*
+        预先格式化拒绝请求时回复的 503（过载）、429（客户端超出限速）响应，retry_after 为 Retry-After 头的秒数；
+        同时格式化反向代理转发失败时回复的 502（不带 Retry-After）
+    */
+    static void set_retry_after(int retry_after);
+    // 直接在 socket 上发送预先格式化的 503 或 429 响应，用于还没有分配连接对象的 socket
+    static void send_reject(int sockfd, int status);
+    // 主线程拒绝该请求时调用：发送 503、429 或 502 响应并记录访问日志，之后由主线程关闭连接
+    void reject(int status);
+    // 对端地址：Unix 域 socket 的连接没有 IP，只有 sin_family 为 AF_UNIX
     sockaddr_in *get_address() {
         return &m_address;
     }
+    // 对端地址的文本形式，Unix 域 socket 的连接为 "unix"
+    const char *peer_name(char *buf, socklen_t len) const {
+        if (m_address.sin_family == AF_UNIX) {
+            return "unix";
+        }
+        return inet_ntop(AF_INET, &m_address.sin_addr, buf, len);
+    }
+    /*
+        工作线程持有该连接的任务数：放入请求队列时加一，工作线程处理完（最后一次访问连接对象）后减一。
+        不为 0 时工作线程可能正在使用缓冲区、即将重新注册事件，主线程不能回收缓冲区、fd 和槽
+    */
+    void enter_worker() {
+        m_workers.fetch_add(1, std::memory_order_relaxed);
+    }
+    void leave_worker() {
+        m_workers.fetch_sub(1, std::memory_order_release);
+    }
+    bool in_worker() const {
+        return m_workers.load(std::memory_order_acquire) != 0;
+    }
+    // 没有正在处理的请求（不持有缓冲区），只在主线程中调用
+    bool idle() const {
+        return m_buf == nullptr;
+    }
+    // 已收到当前请求的部分数据（请求分多次到达），新请求的第一次读取之前为 false
+    bool request_started() const {
+        return m_read_idx > 0;
+    }
+    // 进入排空状态：之后的响应都带 Connection: close，发送完后关闭连接
+    static void set_draining() {
+        m_draining.store(true, std::memory_order_relaxed);
+    }
+    // 归还读写缓冲区，主线程关闭连接时调用
+    void release_buffer();
+
+    /*
+        反向代理（upstream.h）使用，都只在主线程中调用：
+        请求由主线程转发到后端，不经过工作线程，连接在转发期间的事件交给 Upstream 处理
+    */
+    // 读缓冲区中收到的原始请求数据（工作线程没有解析过），len 为数据长度
+    const char *raw_request(int &len) const {
+        len = m_read_idx;
+        return m_read_buf;
+    }
+    // 开始转发：记录访问日志使用的请求方法和路径
+    void begin_proxy(METHOD method, const char *path, int path_len);
+    // 收到后端的响应头，记录状态码
+    void proxy_response(int status);
+    /*
+        转发结束：bytes 为发送给客户端的字节数，输出访问日志并归还缓冲区；
+        keep_alive 时重新注册读事件等待下一个请求，否则由调用者关闭连接
+    */
+    void end_proxy(long long bytes, bool keep_alive);
+    // 正在转发的上游连接，没有转发时句柄无效（代数为 0）
+    Conn_handle upstream() const {
+        return m_upstream;
+    }
+    void set_upstream(Conn_handle upstream) {
+        m_upstream = upstream;
+    }
+    bool proxying() const {
+        return m_upstream.gen != 0;
+    }
+    // 请求方法名，不支持的方法返回 false
+    static bool parse_method(const char *text, int len, METHOD &method);
+    // 缓冲区池的占用统计
+    static Slab_allocator<Http_buffer>::Stats buffer_stats();
 
 private:
     void init();
+    // 从池中借用缓冲区
+    void acquire_buffer();
     // 完成报文解析
     HTTP_CODE process_read();
     // 完成响应报文：根据HTTP解析的结果，将相应的响应报文写入写缓冲区中
@@ -110,20 +238,40 @@ private:
     bool add_content_type();
     bool add_content_length(int content_length);
     bool add_linger();
+    bool add_session_cookie(); // 登录成功时添加 Set-Cookie
     bool add_blank_line(); // 添加空行
     void unmap();
+    // 响应发送结束（或发送失败）时输出访问日志
+    void access_log();
 
 public:
     static int m_epollfd;
     static int m_user_count;
-    MYSQL *mysql;
+    static User_store *m_user_store;
+    // 读写缓冲区池，只在主线程（reactor）中借用和归还
+    static Slab_allocator<Http_buffer> m_buffer_pool;
+    static ACCESS_FORMAT m_access_format;
+    static int m_access_sample;
+    static char m_unavailable[256];
+    static int m_unavailable_len;
+    static char m_too_many[256];
+    static int m_too_many_len;
+    static char m_bad_gateway[256];
+    static int m_bad_gateway_len;
+    static std::atomic<bool> m_draining;
+    static Sock_policy m_sock_policy;
 
 private:
     int m_sockfd;
+    Conn_handle m_handle;
     sockaddr_in m_address;
+    Conn_handle m_upstream; // 反向代理正在转发请求的上游连接
+    std::atomic<int> m_workers; // 工作线程持有的任务数
 
+    // 借用的缓冲区，没有正在处理的请求时为 nullptr，以下指针都指向其中
+    Http_buffer *m_buf;
     // 读缓冲区
-    char m_read_buf[READ_BUFFER_SIZE];
+    char *m_read_buf;
     // 读缓冲区中的数据大小
     int m_read_idx;
     // 指向读缓冲区中，将要解析的字符
@@ -131,7 +279,7 @@ private:
     // 读缓存区中，一行的起始位置
     int m_start_line;
     // 写缓冲区
-    char m_write_buf[WRITE_BUFFER_SIZE];
+    char *m_write_buf;
     // 写缓冲区中指针
     int m_write_idx;
 
@@ -148,9 +296,11 @@ private:
     int m_content_length; // 内容长度字段
     bool m_linger; // Http 请求是否要保持连接
     char *m_string; // 存储请求头数据
+    char *m_cookie_sid; // Cookie 中携带的会话 token
+    char m_session[Session_store::TOKEN_LEN + 1]; // 登录成功后新建的会话 token
 
     // 解析客户端请求数据
-    char m_real_file[FILENAME_LEN];
+    char *m_real_file;
     struct stat m_file_stat; // 请求文件信息
     char *m_file_address; // 映射的文件在内存中地址
 
@@ -159,6 +309,13 @@ private:
     int m_iv_count;
     int bytes_to_send; // 向客户端发送响应报文的大小
     int bytes_have_send;
+
+    // 访问日志使用的数据，时间均为单调时钟（微秒）
+    char *m_request_path; // 请求行中的原始资源路径，do_request 会改写 m_url
+    int m_status; // 响应的状态码
+    long long m_time_read; // 主线程读完数据、放入请求队列的时间
+    long long m_time_process; // 工作线程开始处理的时间
+    long long m_time_response; // 响应报文生成完成的时间
 };
 
 
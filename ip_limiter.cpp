@@ -0,0 +1,171 @@
+#include <stdlib.h>
+#include <time.h>
+#include <exception>
+#include "ip_limiter.h"
+
+Ip_limiter::Ip_limiter(size_t capacity, int max_conns, double rate, double burst) :
+    m_size(0),
+    m_max_conns(max_conns > 0 ? max_conns : 0),
+    m_rate(rate > 0 ? rate / 1000 : 0),
+    m_burst(burst > 1 ? burst : 1),
+    m_conn_rejects(0),
+    m_rate_rejects(0),
+    m_untracked(0) {
+
+    // 槽数取整为 2 的幂，哈希值取乘积的高 log2(capacity) 位
+    m_capacity = 16;
+    m_shift = 28;
+    while (m_capacity < capacity && m_shift > 0) {
+        m_capacity <<= 1;
+        --m_shift;
+    }
+    m_mask = m_capacity - 1;
+    // calloc：大块内存直接映射，没有记录的页不占用物理内存
+    m_table = static_cast<Entry *>(calloc(m_capacity, sizeof(Entry)));
+    if (m_table == nullptr) {
+        throw std::exception();
+    }
+}
+
+Ip_limiter::~Ip_limiter() {
+    free(m_table);
+}
+
+uint32_t Ip_limiter::now_ms() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)(ts.tv_sec * 1000LL + ts.tv_nsec / 1000000);
+}
+
+// 乘法哈希：同一网段的地址只有低位不同，取乘积的高位使其分散
+size_t Ip_limiter::home(uint32_t addr) const {
+    return (uint32_t)(addr * 2654435769u) >> m_shift;
+}
+
+Ip_limiter::Entry *Ip_limiter::find(uint32_t addr) {
+    for (size_t i = home(addr); m_table[i].addr != 0; i = (i + 1) & m_mask) {
+        if (m_table[i].addr == addr) {
+            return &m_table[i];
+        }
+    }
+    return nullptr;
+}
+
+// 插入新记录，令牌桶初始为满；记录数达到容量的 3/4 时返回 nullptr
+Ip_limiter::Entry *Ip_limiter::insert(uint32_t addr, uint32_t now) {
+    if (m_size >= m_capacity / 4 * 3) {
+        return nullptr;
+    }
+    size_t i = home(addr);
+    while (m_table[i].addr != 0) {
+        i = (i + 1) & m_mask;
+    }
+    Entry &e = m_table[i];
+    e.addr = addr;
+    e.conns = 0;
+    e.tokens = m_burst;
+    e.last_ms = now;
+    ++m_size;
+    return &e;
+}
+
+/*
+    删除槽 i 中的记录：依次检查其后同一簇中的记录，
+    起始槽不在 (i, j] 之间的记录可以前移到 i，以保证线性探测仍能找到它们
+*/
+void Ip_limiter::erase(size_t i) {
+    size_t j = i;
+    for (;;) {
+        j = (j + 1) & m_mask;
+        if (m_table[j].addr == 0) {
+            break;
+        }
+        size_t k = home(m_table[j].addr);
+        bool movable = i <= j ? (k <= i || k > j) : (k <= i && k > j);
+        if (movable) {
+            m_table[i] = m_table[j];
+            i = j;
+        }
+    }
+    m_table[i].addr = 0;
+    --m_size;
+}
+
+// 按距上次补充的时间补充令牌，最多补到 burst 个
+void Ip_limiter::refill(Entry *e, uint32_t now) {
+    uint32_t elapsed = now - e->last_ms;
+    float tokens = e->tokens + elapsed * m_rate;
+    e->tokens = tokens < m_burst ? tokens : m_burst;
+    e->last_ms = now;
+}
+
+bool Ip_limiter::acquire(uint32_t addr) {
+    Entry *e = find(addr);
+    if (e == nullptr) {
+        e = insert(addr, now_ms());
+        if (e == nullptr) {
+            ++m_untracked;
+            return true;
+        }
+    }
+    if (m_max_conns > 0 && e->conns >= m_max_conns) {
+        ++m_conn_rejects;
+        return false;
+    }
+    ++e->conns;
+    return true;
+}
+
+void Ip_limiter::release(uint32_t addr) {
+    Entry *e = find(addr);
+    // 表满时接受的连接没有计入
+    if (e != nullptr && e->conns > 0) {
+        --e->conns;
+    }
+}
+
+bool Ip_limiter::allow_request(uint32_t addr) {
+    if (m_rate <= 0) {
+        return true;
+    }
+    Entry *e = find(addr);
+    if (e == nullptr) {
+        return true;
+    }
+    refill(e, now_ms());
+    if (e->tokens < 1) {
+        ++m_rate_rejects;
+        return false;
+    }
+    e->tokens -= 1;
+    return true;
+}
+
+int Ip_limiter::reap() {
+    uint32_t now = now_ms();
+    int reaped = 0;
+    for (size_t i = 0; i < m_capacity; ++i) {
+        // 删除后其他记录可能前移到槽 i，继续检查同一个槽
+        while (m_table[i].addr != 0 && m_table[i].conns == 0) {
+            if (m_rate > 0) {
+                refill(&m_table[i], now);
+                if (m_table[i].tokens < m_burst) {
+                    break;
+                }
+            }
+            erase(i);
+            ++reaped;
+        }
+    }
+    return reaped;
+}
+
+Ip_limiter::Stats Ip_limiter::stats() const {
+    Stats s;
+    s.size = m_size;
+    s.capacity = m_capacity;
+    s.conn_rejects = m_conn_rejects;
+    s.rate_rejects = m_rate_rejects;
+    s.untracked = m_untracked;
+    return s;
+}
@@ -0,0 +1,78 @@
+/*
+按客户端 IP 的连接数限制和请求限速
+    * 每个 IP 一个令牌桶：每秒补充 rate 个令牌，最多积累 burst 个，每个请求消耗一个；
+      令牌在访问时按距上次访问的时间一次补足（惰性补充），不需要定时遍历
+    * 同时限制每个 IP 的并发连接数，接受连接时检查，连接关闭时归还
+    * IP 记录放在开放寻址（线性探测）的哈希表中，每条 16 字节，删除时后移簇中的记录，不留墓碑；
+      没有连接且令牌已补满的记录不再有状态，由定时器周期性调用 reap 清除
+    * 表中记录数达到容量的 3/4 时不再记录新的 IP，这些 IP 不受限制（放行而不是拒绝），
+      次数在统计中输出
+    * 不是线程安全的：只在主线程（reactor）中使用
+*/
+
+#ifndef IP_LIMITER_H
+#define IP_LIMITER_H
+
+#include <stdint.h>
+#include <stddef.h>
+
+class Ip_limiter {
+public:
+    // 统计
+    struct Stats {
+        size_t size; // 表中的 IP 数
+        size_t capacity;
+        long long conn_rejects; // 因连接数超限拒绝的连接数
+        long long rate_rejects; // 因令牌不足拒绝的请求数
+        long long untracked; // 表满而未记录（未限制）的连接数
+    };
+
+    /*
+        capacity：哈希表槽数，取整为 2 的幂
+        max_conns：每个 IP 的最大并发连接数，0 表示不限制
+        rate、burst：每个 IP 每秒的请求数及允许的突发请求数，rate 为 0 表示不限速
+    */
+    Ip_limiter(size_t capacity, int max_conns, double rate, double burst);
+    ~Ip_limiter();
+
+    // 接受连接时调用：连接数未超限时计入并返回 true；返回 false 时不计入，调用者应关闭连接
+    bool acquire(uint32_t addr);
+    // 连接关闭时调用，只对 acquire 返回 true 的连接调用一次
+    void release(uint32_t addr);
+    // 收到请求时调用：消耗一个令牌，令牌不足时返回 false
+    bool allow_request(uint32_t addr);
+    // 清除没有连接且令牌已补满的记录，返回清除的条数，由定时器调用
+    int reap();
+
+    Stats stats() const;
+
+private:
+    struct Entry {
+        uint32_t addr; // 网络字节序，0 表示空槽（0.0.0.0 不会是对端地址）
+        uint32_t conns;
+        float tokens;
+        uint32_t last_ms; // 上次补充令牌的时间（单调时钟，毫秒，回绕后按差值计算）
+    };
+
+    static uint32_t now_ms();
+    size_t home(uint32_t addr) const;
+    Entry *find(uint32_t addr);
+    Entry *insert(uint32_t addr, uint32_t now);
+    void erase(size_t i);
+    void refill(Entry *e, uint32_t now);
+
+private:
+    Entry *m_table;
+    size_t m_capacity;
+    size_t m_mask;
+    size_t m_size;
+    int m_shift; // 哈希值右移的位数
+    uint32_t m_max_conns;
+    float m_rate; // 每毫秒补充的令牌数
+    float m_burst;
+    long long m_conn_rejects;
+    long long m_rate_rejects;
+    long long m_untracked;
+};
+
+#endif
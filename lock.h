@@ -4,6 +4,7 @@
 #include <pthread.h>
 #include <exception>
 #include <semaphore.h>
+#include <time.h>
 
 class Sem {
 public:
@@ -83,6 +84,10 @@ public:
         // pthread_mutex_unlock(&m_mutex);
         return ret == 0;
     }
+    // 等待到绝对时间 t，超时返回 false
+    bool timewait(pthread_mutex_t *pmutex, struct timespec t) {
+        return pthread_cond_timedwait(&m_cond, pmutex, &t) == 0;
+    }
     bool signal() {
         return pthread_cond_signal(&m_cond) == 0;
     }
@@ -2,52 +2,142 @@
 #include <cstring>
 #include <time.h>
 #include <sys/time.h>
+#include <sys/uio.h>
+#include <limits.h>
+#include <unistd.h>
+#include <errno.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdarg.h>
+#include <sys/stat.h>
+#include <string>
 #include "log.h"
 
+// 线程退出时标记该线程的缓冲区，由后台线程取空后释放
+struct Log_ring_owner {
+    Log_ring *ring;
+    Log_ring_owner() : ring(nullptr) {}
+    ~Log_ring_owner() {
+        if (ring != nullptr) {
+            ring->closed.store(true, std::memory_order_release);
+        }
+    }
+};
+static thread_local Log_ring_owner t_ring;
+// 每个线程格式化日志使用的缓冲区，不再共享同一个 m_buf
+static thread_local std::string t_line;
+
+// 将一条日志追加到缓冲区，空间不足时返回 false
+static bool ring_push(Log_ring *ring, const char *data, size_t n) {
+    size_t head = ring->head.load(std::memory_order_relaxed);
+    size_t tail = ring->tail.load(std::memory_order_acquire);
+    if (ring->capacity - (head - tail) < n) {
+        return false;
+    }
+    size_t pos = head & (ring->capacity - 1);
+    size_t first = ring->capacity - pos < n ? ring->capacity - pos : n;
+    memcpy(ring->buf + pos, data, first);
+    memcpy(ring->buf, data + first, n - first);
+    ring->head.store(head + n, std::memory_order_release);
+    return true;
+}
+
+// 从缓冲区的位置 pos（只增不减的计数）复制 n 字节，处理绕回
+static void ring_copy(Log_ring *ring, size_t pos, char *dst, size_t n) {
+    size_t off = pos & (ring->capacity - 1);
+    size_t first = ring->capacity - off < n ? ring->capacity - off : n;
+    memcpy(dst, ring->buf + off, first);
+    memcpy(dst + first, ring->buf, n - first);
+}
+
+// 写完所有数据，处理部分写入
+static void writev_all(int fd, struct iovec *iov, int cnt) {
+    while (cnt > 0) {
+        ssize_t n = writev(fd, iov, cnt);
+        if (n < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return;
+        }
+        while (cnt > 0 && (size_t)n >= iov->iov_len) {
+            n -= iov->iov_len;
+            ++iov;
+            --cnt;
+        }
+        if (cnt > 0) {
+            iov->iov_base = (char *)iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+}
 
 Log::Log() {
     m_count = 0;
     m_is_async = false;
+    m_fp = nullptr;
+    m_ring_size = 0;
+    m_flush_interval = 100;
+    m_flush_now = false;
+    m_stop = false;
+    m_segment_size = 0;
+    m_archive = false;
+    m_archive_files = 0;
+    m_archive_days = 0;
+    m_archive_rate = 0;
+    m_flush_bytes = 0;
+    m_flush_level = 3;
+    m_unflushed = 0;
+    m_last_flush = 0;
+    for (int i = 0; i < LOG_MODULE_NUM; ++i) {
+        m_levels[i] = LOG_LEVEL_DEBUG;
+    }
+    m_mode = TEXT;
+    m_format_count = 0;
+    m_formats_written = 0;
+    m_limiters = nullptr;
+    memset(dir_name, '\0', sizeof(dir_name));
 }
 
 Log::~Log() {
+    // 通知后台线程退出，并写出剩余的日志
+    if (m_is_async) {
+        m_mutex.lock();
+        m_stop = true;
+        m_cond.signal();
+        m_mutex.unlock();
+        pthread_join(m_tid, NULL);
+        for (size_t i = 0; i < m_rings.size(); ++i) {
+            delete [] m_rings[i]->buf;
+            delete m_rings[i];
+        }
+    }
     if (m_fp != nullptr) {
         fclose(m_fp);
     }
+    m_file.close();
+    m_archiver.stop();
 }
 
-bool Log::init(const char *filename, int log_buf_size, int split_lines, int max_queue_size) {
+bool Log::init(const char *filename, int log_buf_size, int split_lines, int max_queue_size, int flush_interval,
+               LOG_MODE mode, size_t segment_size) {
     /*
         初始化日志文件，实现日志创建
         日志名：事件_filename；（其中时间为启动时间，日志名如：2021_06_01_ServerLog）
     */
 
-    // 如果设置了max_queue_size，则采用异步
-    if (max_queue_size >= 1) {  // 异步需要设置阻塞队列的长度，同步不需要设置
-        // 需要异步写日志
-        m_is_async = true;
-        // 创建阻塞队列
-        m_log_queue = new Block_queue<std::string>(max_queue_size);
-
-        // 创建线程，用于日志的异步写
-        pthread_t tid;
-        pthread_create(&tid, NULL, flush_log_thread, NULL);
-    }
-
-    // 日志内容长度
+    // 单条日志的最大长度
     m_log_buf_size = log_buf_size;
-    m_buf = new char[m_log_buf_size];
-    memset(m_buf, '\0', sizeof(m_buf));
 
     // 日志的最大行数
     m_split_lines = split_lines;
 
+    // 延迟格式化需要后台线程
+    m_mode = max_queue_size >= 1 ? mode : TEXT;
+
     time_t t = time(nullptr);
-    struct tm *sys_tm = localtime(&t);
-    struct tm my_tm = *sys_tm;
+    struct tm my_tm;
+    localtime_r(&t, &my_tm);
 
     // 获得文件名
     const char *p = strrchr(filename, '/'); // 从后往前找到第一个 / 的位置
@@ -56,10 +146,16 @@ bool Log::init(const char *filename, int log_buf_size, int split_lines, int max_
     // 存储时日志文件名：时间_文件名
     if (p == nullptr) { // 文件名中不含有 /
         strcpy(log_name, filename); // 当日志系统已经运行后，修复当filename不包含"/"时，在write_log函数中，创建新的日志文件的文件名中只包含日期的错误
-        snprintf(log_full_name, 255, "%d_%02d_%02d_%s", my_tm.tm_year+1900, my_tm.tm_mon+1, my_tm.tm_mday, filename);
+        if (m_mode == BINARY) {
+            strcat(log_name, ".bin");
+        }
+        snprintf(log_full_name, 255, "%d_%02d_%02d_%s", my_tm.tm_year+1900, my_tm.tm_mon+1, my_tm.tm_mday, log_name);
     }
     else {
         strcpy(log_name, p+1); // 获得日志文件名
+        if (m_mode == BINARY) {
+            strcat(log_name, ".bin");
+        }
         strncpy(dir_name, filename, p-filename+1); // 获得存放日志的路径名
 
         // 获得日志文件的绝对路径名
@@ -68,132 +164,600 @@ bool Log::init(const char *filename, int log_buf_size, int split_lines, int max_
 
     m_today = my_tm.tm_mday;
 
-    m_fp = fopen(log_full_name, "a");
-    if (m_fp == nullptr) {
-        return false;
+    if (max_queue_size >= 1) {
+        // 每个线程缓冲区的大小取 2 的幂，便于计算环形缓冲区中的位置
+        size_t need = (size_t)max_queue_size * m_log_buf_size;
+        m_ring_size = 4096;
+        while (m_ring_size < need) {
+            m_ring_size <<= 1;
+        }
+    }
+
+    if (segment_size > 0) {
+        // 一次写入最多是一个线程缓冲区的内容，段至少能容纳两次，避免一次写入被拆到两个段中
+        m_segment_size = segment_size > 2 * m_ring_size ? segment_size : 2 * m_ring_size;
+        if (m_archive) {
+            m_file.set_callback(Log_archiver::on_open, Log_archiver::on_close, &m_archiver);
+        }
+        if (!m_file.open(dir_name, log_name, my_tm, m_segment_size)) {
+            m_segment_size = 0;
+            return false;
+        }
+    }
+    else {
+        m_fp = fopen(log_full_name, "a");
+        if (m_fp == nullptr) {
+            return false;
+        }
+        m_path = log_full_name;
+    }
+    if (m_archive) {
+        m_archiver.start(dir_name, log_name, m_segment_size > 0 ? m_file.path() : m_path,
+                         m_archive_files, m_archive_days, m_archive_rate, m_archive_keep);
+    }
+    m_flush_interval = flush_interval;
+    start_file();
+    if (m_mode != TEXT) {
+        // 编号 0~3 预留给各级别的 "%s"，供调用线程已格式化好的日志使用
+        for (int level = 0; level <= 3; ++level) {
+            register_format(level, "%s");
+        }
+    }
+
+    // 如果设置了max_queue_size，则采用异步
+    if (max_queue_size >= 1) {  // 异步需要设置线程缓冲区的大小，同步不需要设置
+        // 需要异步写日志
+        m_is_async = true;
+
+        // 创建线程，用于日志的异步写
+        if (pthread_create(&m_tid, NULL, flush_log_thread, NULL) != 0) {
+            m_is_async = false;
+            m_mode = TEXT;
+            return false;
+        }
     }
 
     return true;
 }
 
-void Log::write_log(int level, const char *format, ...)
-{
+Log_ring *Log::thread_ring() {
+    if (t_ring.ring != nullptr) {
+        return t_ring.ring;
+    }
+    // 每个线程只在第一次写日志时加锁登记一次
+    Log_ring *ring = new Log_ring;
+    ring->buf = new char[m_ring_size];
+    ring->capacity = m_ring_size;
+    ring->head.store(0, std::memory_order_relaxed);
+    ring->tail.store(0, std::memory_order_relaxed);
+    ring->closed.store(false, std::memory_order_relaxed);
+    m_mutex.lock();
+    m_rings.push_back(ring);
+    m_mutex.unlock();
+    t_ring.ring = ring;
+    return ring;
+}
+
+int Log::register_format(int level, const char *format) {
+    m_format_mutex.lock();
+    int id = m_format_count.load(std::memory_order_relaxed);
+    if (id < LOG_MAX_FORMATS) {
+        m_formats[id].format = format;
+        m_formats[id].level = level;
+        // 先写好格式串再发布编号，后台线程读到编号时格式串一定可见
+        m_format_count.store(id + 1, std::memory_order_release);
+    }
+    else {
+        id = -1;
+    }
+    m_format_mutex.unlock();
+    return id;
+}
+
+bool Log::rotate(int lines) {
     /*
-        日志级别：DEBUG, INFO, WARN（未使用）, ERROR
-            DEBUG：调试代码时的输出，在系统实际运行时，一般不使用；
-            Warn：这种警告与调试时终端的warning类似，同样是调试代码时使用；
-            Info：报告系统当前的状态，当前执行的流程或接收的信息等；
-            Error：输出系统的错误信息；
-        
         日志文件按照最大行数、不同日期分文件：
             日志写入前判断当前时间是否为创建日志时间，行数是否超过最大行数限制
                 若为创建日志时间，写入日志，否则创建当前时间的新的日志文件
                 若当前文件已经到了最大行数，创建新的日志文件，文件名为在日志文件名末尾加上（m_count/m_split_lines）
-
-        将要写入日志的信息进行格式化
     */
+    // 当天日期取自按秒缓存的本地时间，同一秒内不再调用 localtime_r
+    const struct tm &my_tm = log_localtime(time(nullptr)).tm;
 
+    // 日志行数记录
+    long long before = m_count;
+    m_count += lines;
+    bool split = m_split_lines > 0 && before / m_split_lines != m_count / m_split_lines;
 
-   // 获取当前时间
-   struct timeval now = {0, 0};
-   gettimeofday(&now, NULL);
-   time_t t = now.tv_sec;
-   struct tm *sys_tm = localtime(&t);
-   struct tm my_tm = *sys_tm;
-   char s[16] = {0};
-
-    // 日志分级
-    switch (level)
-    {
-    case 0:
-        strcpy(s, "[debug]:");
-        break;
-    case 1:
-        strcpy(s, "[info]:");
-        break;
-    case 2:
-        strcpy(s, "[warn]:");
-        break;
-    case 3:
-        strcpy(s, "[erro]:");
-        break;
-    default:
-        strcpy(s, "[info]:");
-        break;
+    if (m_segment_size > 0) {
+        // 预分配段按大小切换（见 out_write），这里只处理日期变化
+        if (m_today == my_tm.tm_mday) {
+            return false;
+        }
+        m_today = my_tm.tm_mday;
+        m_count = lines;
+        if (m_file.reopen(my_tm)) {
+            start_file();
+        }
+        return true;
     }
 
-
-    m_mutex.lock();
-    // 日志行数记录
-    m_count++; // 更新行数
-
-    // 日志不是今天或写入的日志行数是最大行的倍数
-    if (m_today != my_tm.tm_mday || m_count % m_split_lines == 0) //everyday log
+    // 日志不是今天或写入的日志行数超过了最大行的倍数
+    if (m_today != my_tm.tm_mday || split) //everyday log
     {
         // 新的日志文件
         char new_log[256] = {0};
         fflush(m_fp);
         fclose(m_fp);
         char tail[16] = {0};
-       
+
         // 更新日志名中的时间部分
         snprintf(tail, 16, "%d_%02d_%02d_", my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday);
-       
+
         // 如果时间不是今天，创建当天的日志文件，更新 m_today 和 m_count
         if (m_today != my_tm.tm_mday)
         {
             snprintf(new_log, 255, "%s%s%s", dir_name, tail, log_name);
             m_today = my_tm.tm_mday;
-            m_count = 0;
+            m_count = lines;
         }
         else // 时间是当天，但是日志行数是最大行的倍数，创建新的日志，日志名：之前日志名的基础上加后缀（m_count/m_split_lines）
         {
             snprintf(new_log, 255, "%s%s%s.%lld", dir_name, tail, log_name, m_count / m_split_lines);
         }
         m_fp = fopen(new_log, "a");
+        if (m_archive) {
+            // 写完的文件交给后台线程压缩
+            m_archiver.set_active(new_log);
+            m_archiver.add(m_path);
+        }
+        m_path = new_log;
+        start_file();
+        return true;
     }
- 
-    m_mutex.unlock();
+    return false;
+}
+
+void Log::write_log(int level, const char *format, ...)
+{
+    /*
+        日志级别：DEBUG, INFO, WARN（未使用）, ERROR
+            DEBUG：调试代码时的输出，在系统实际运行时，一般不使用；
+            Warn：这种警告与调试时终端的warning类似，同样是调试代码时使用；
+            Info：报告系统当前的状态，当前执行的流程或接收的信息等；
+            Error：输出系统的错误信息；
+
+        将要写入日志的信息格式化到当前线程的缓冲区中，不需要加锁
+    */
+
+    // 获取当前时间
+    struct timeval now = {0, 0};
+    gettimeofday(&now, NULL);
+    int64_t usec = (int64_t)now.tv_sec * 1000000 + now.tv_usec;
+
+    if (t_line.size() < (size_t)m_log_buf_size) {
+        t_line.resize(m_log_buf_size);
+    }
+    char *buf = &t_line[0];
 
     // 可变参数初始化
     va_list valst;
     va_start(valst, format);
 
-    std::string log_str;
-    m_mutex.lock();
+    if (m_mode != TEXT) {
+        // 延迟格式化模式下格式串登记已满的调用点：在这里格式化内容，作为预留的 "%s" 格式串的参数记录
+        vsnprintf(buf, m_log_buf_size, format, valst);
+        va_end(valst);
+        write_deferred(level >= 0 && level <= 3 ? level : 1, buf);
+        return;
+    }
 
     //格式化写入日志的内容，写入的内容格式：时间+内容
     // 时间格式化
-    int n = snprintf(m_buf, 48, "%d-%02d-%02d %02d:%02d:%02d.%06ld %s ",
-                     my_tm.tm_year + 1900, my_tm.tm_mon + 1, my_tm.tm_mday,
-                     my_tm.tm_hour, my_tm.tm_min, my_tm.tm_sec, now.tv_usec, s);
-    // 内容格式化
-    int m = vsnprintf(m_buf + n, m_log_buf_size - 1, format, valst);
-    m_buf[n + m] = '\n';
-    m_buf[n + m + 1] = '\0';
-    log_str = m_buf;
+    int n = log_format_prefix(buf, 48, usec, level);
+    // 内容格式化，过长的日志被截断，保留换行符的位置
+    int m = vsnprintf(buf + n, m_log_buf_size - n - 1, format, valst);
+    if (m < 0) {
+        m = 0;
+    }
+    else if (m > m_log_buf_size - n - 2) {
+        m = m_log_buf_size - n - 2;
+    }
+    buf[n + m] = '\n';
+    size_t len = n + m + 1;
 
-    m_mutex.unlock();
+    va_end(valst);
 
     // 若 m_is_async 为 true表示异步，默认为同步
-    if (m_is_async && !m_log_queue->full()) // 若异步，则将日志信息加入阻塞队列
+    if (m_is_async) // 若异步，则将日志追加到当前线程的缓冲区
     {
-        m_log_queue->push(log_str);
+        Log_ring *ring = thread_ring();
+        if (ring_push(ring, buf, len)) {
+            if (level >= m_flush_level.load(std::memory_order_relaxed)) {
+                // 按级别刷新：由当前线程立即写出，保证进程崩溃前错误日志已写入文件
+                m_mutex.lock();
+                drain();
+                m_mutex.unlock();
+            }
+            else {
+                wake_if_full(ring);
+            }
+            return;
+        }
     }
-    else // 同步写日志，直接对日志文件加锁写
-    {
+
+    m_mutex.lock();
+    if (m_is_async) {
+        // 缓冲区已满：先写出已缓冲的日志，保证同一线程的日志顺序
+        drain();
+    }
+    // 同步写日志，直接对日志文件加锁写
+    rotate(1);
+    out_write(buf, len);
+    flush_if_needed(level, len, usec);
+    m_mutex.unlock();
+}
+
+void Log::flush_if_needed(int level, size_t len, int64_t usec) {
+    if (m_fp == nullptr) {
+        // 写入预分配段的日志已在页缓存中，不需要 fflush
+        return;
+    }
+    m_unflushed += len;
+    size_t bytes = m_flush_bytes.load(std::memory_order_relaxed);
+    if (level >= m_flush_level.load(std::memory_order_relaxed)
+        || (bytes > 0 && m_unflushed >= bytes)
+        || (m_flush_interval > 0 && usec - m_last_flush >= m_flush_interval * 1000LL)) {
+        fflush(m_fp);
+        m_unflushed = 0;
+        m_last_flush = usec;
+    }
+}
+
+void Log::set_level(int level, int module) {
+    for (int i = 0; i < LOG_MODULE_NUM; ++i) {
+        if (module < 0 || module == i) {
+            m_levels[i].store(level, std::memory_order_relaxed);
+        }
+    }
+}
+
+Log_limiter::Log_limiter(int module, int level, const char *format, int every_n, int per_second) :
+    m_module(module), m_level(level), m_format(format), m_every_n(every_n), m_per_second(per_second),
+    m_count(0), m_window(0), m_window_count(0), m_suppressed(0), m_sampled_out(0), m_next(nullptr) {
+    Log::get_instance()->add_limiter(this);
+}
+
+void Log::add_limiter(Log_limiter *limiter) {
+    // 静态局部变量的构造只执行一次，无锁地插入链表头部
+    Log_limiter *head = m_limiters.load();
+    do {
+        limiter->m_next = head;
+    } while (!m_limiters.compare_exchange_weak(head, limiter));
+}
+
+void Log::report_suppressed() {
+    for (Log_limiter *l = m_limiters.load(); l != nullptr; l = l->m_next) {
+        unsigned long n = l->m_suppressed.exchange(0, std::memory_order_relaxed);
+        if (l->m_every_n > 1) {
+            // 前 count 次调用中输出了 ceil(count / every_n) 次
+            unsigned long count = l->m_count.load(std::memory_order_relaxed);
+            unsigned long sampled_out = count - (count + l->m_every_n - 1) / l->m_every_n;
+            n += sampled_out - l->m_sampled_out;
+            l->m_sampled_out = sampled_out;
+        }
+        // 汇总行的级别、模块与被丢弃的日志相同，按同样的规则过滤
+        if (n > 0 && enabled(l->m_level, l->m_module)) {
+            write_log(l->m_level, "suppressed %lu messages: %s", n, l->m_format);
+        }
+    }
+}
+
+void Log::set_archive(int max_files, int max_days, size_t rate, const char *keep) {
+    m_archive = true;
+    m_archive_files = max_files;
+    m_archive_days = max_days;
+    m_archive_rate = rate;
+    m_archive_keep = keep != nullptr ? keep : "";
+}
+
+std::string Log::path() {
+    m_mutex.lock();
+    std::string path = m_segment_size > 0 ? m_file.path() : m_path;
+    m_mutex.unlock();
+    return path;
+}
+
+void Log::set_flush_policy(int interval_ms, size_t bytes, int level) {
+    m_flush_bytes.store(bytes, std::memory_order_relaxed);
+    m_flush_level.store(level >= 0 ? level : INT_MAX, std::memory_order_relaxed);
+    m_mutex.lock();
+    m_flush_interval = interval_ms;
+    // 唤醒后台线程按新的周期等待
+    m_cond.signal();
+    m_mutex.unlock();
+}
+
+void Log::wake_if_full(Log_ring *ring) {
+    // 按大小刷新，最多等到缓冲区使用一半，避免写满
+    size_t limit = m_flush_bytes.load(std::memory_order_relaxed);
+    if (limit == 0 || limit > ring->capacity / 2) {
+        limit = ring->capacity / 2;
+    }
+    size_t used = ring->head.load(std::memory_order_relaxed) - ring->tail.load(std::memory_order_relaxed);
+    if (used >= limit && !m_flush_now.exchange(true, std::memory_order_relaxed)) {
+        m_cond.signal();
+    }
+}
+
+void Log::push_record(int level, const char *rec, size_t len) {
+    Log_ring *ring = thread_ring();
+    if (ring_push(ring, rec, len)) {
+        if (level < m_flush_level.load(std::memory_order_relaxed)) {
+            wake_if_full(ring);
+            return;
+        }
+        // 按级别刷新：由当前线程立即写出
         m_mutex.lock();
-        fputs(log_str.c_str(), m_fp); // 若同步，则加锁向文件中写
+        drain();
         m_mutex.unlock();
+        return;
+    }
+    // 缓冲区已满：先写出已缓冲的日志，再追加本条
+    m_mutex.lock();
+    drain();
+    if (ring_push(ring, rec, len) && level >= m_flush_level.load(std::memory_order_relaxed)) {
+        drain();
     }
+    m_mutex.unlock();
+}
 
-    va_end(valst);
+void *Log::async_write_log() {
+    m_mutex.lock();
+    while (!m_stop) {
+        // 每隔一个刷新周期，或被 flush 唤醒时，写出所有线程缓冲区中的日志
+        if (!m_flush_now.load(std::memory_order_relaxed)) {
+            // 不按时间刷新时也每秒检查一次，唤醒信号不加锁发送，可能错过
+            int interval = m_flush_interval > 0 ? m_flush_interval : 1000;
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += interval / 1000;
+            ts.tv_nsec += (interval % 1000) * 1000000L;
+            if (ts.tv_nsec >= 1000000000L) {
+                ts.tv_sec += 1;
+                ts.tv_nsec -= 1000000000L;
+            }
+            m_cond.timewait(m_mutex.get(), ts);
+        }
+        m_flush_now.store(false, std::memory_order_relaxed);
+        drain();
+    }
+    drain();
+    m_mutex.unlock();
+    return NULL;
+}
+
+void Log::start_file() {
+    if (m_mode != BINARY) {
+        return;
+    }
+    // 文件为空时写入文件头；每个二进制日志文件都带有完整的格式串定义，可以单独解码
+    bool empty = true;
+    struct stat st;
+    if (m_fp != nullptr && fstat(fileno(m_fp), &st) == 0) {
+        empty = st.st_size == 0;
+    }
+    if (empty) {
+        out_write(LOG_BINARY_MAGIC, LOG_BINARY_MAGIC_LEN);
+    }
+    m_formats_written = 0;
+    write_formats();
+}
+
+void Log::out_write(const char *data, size_t n) {
+    if (m_segment_size == 0) {
+        fwrite(data, 1, n, m_fp);
+        return;
+    }
+    // 当前段放不下时整体写入下一个段，不拆开一次写入
+    if (m_file.remaining() < n && n <= m_segment_size && m_file.next_segment()) {
+        start_file();
+    }
+    m_file.write(data, n);
+}
+
+void Log::out_writev(struct iovec *iov, int cnt) {
+    if (m_segment_size == 0) {
+        fflush(m_fp); // 同步写入的日志先于本批日志
+        writev_all(fileno(m_fp), iov, cnt);
+        return;
+    }
+    // 当前段放不下时整体写入下一个段，不拆开一次写入
+    size_t total = 0;
+    for (int i = 0; i < cnt; ++i) {
+        total += iov[i].iov_len;
+    }
+    if (total > 0 && m_file.remaining() < total && total <= m_segment_size && m_file.next_segment()) {
+        start_file();
+    }
+    for (int i = 0; i < cnt; ++i) {
+        m_file.write((const char *)iov[i].iov_base, iov[i].iov_len);
+    }
+}
+
+int Log::count_records(Log_ring *ring, size_t tail, size_t head) {
+    int cnt = 0;
+    while (tail < head) {
+        Log_record_header header;
+        ring_copy(ring, tail, (char *)&header, sizeof(header));
+        tail += header.len;
+        ++cnt;
+    }
+    return cnt;
+}
+
+void Log::write_formats() {
+    int count = m_format_count.load(std::memory_order_acquire);
+    for (; m_formats_written < count; ++m_formats_written) {
+        const Format &f = m_formats[m_formats_written];
+        // 格式串定义记录：记录头 | 格式串编号 | 日志级别 | 格式串
+        uint32_t id = m_formats_written;
+        uint8_t level = f.level;
+        size_t flen = strlen(f.format);
+        Log_record_header header;
+        header.len = sizeof(header) + sizeof(id) + sizeof(level) + flen;
+        header.id = LOG_DEF_ID;
+        header.usec = 0;
+        std::string def((const char *)&header, sizeof(header));
+        def.append((const char *)&id, sizeof(id));
+        def.append((const char *)&level, sizeof(level));
+        def.append(f.format, flen);
+        out_write(def.data(), def.size());
+    }
+}
+
+void Log::drain_deferred() {
+    char rec[LOG_RECORD_MAX];
+    int count = m_format_count.load(std::memory_order_acquire);
+    int lines = 0;
+    m_out.clear();
+    for (size_t i = 0; i < m_rings.size(); ++i) {
+        Log_ring *ring = m_rings[i];
+        size_t head = ring->head.load(std::memory_order_acquire);
+        size_t tail = ring->tail.load(std::memory_order_relaxed);
+        while (tail < head) {
+            Log_record_header header;
+            ring_copy(ring, tail, (char *)&header, sizeof(header));
+            ring_copy(ring, tail, rec, header.len);
+            tail += header.len;
+            if (header.id >= (uint32_t)count) {
+                continue;
+            }
+            const Format &f = m_formats[header.id];
+            size_t old = m_out.size();
+            m_out.resize(old + m_log_buf_size);
+            size_t n = log_format_record(&m_out[old], m_log_buf_size, f.level, f.format, rec);
+            m_out.resize(old + n);
+            ++lines;
+        }
+        // 记录已格式化到 m_out，释放缓冲区空间
+        ring->tail.store(head, std::memory_order_release);
+    }
+    if (lines > 0) {
+        rotate(lines);
+        struct iovec iov;
+        iov.iov_base = &m_out[0];
+        iov.iov_len = m_out.size();
+        out_writev(&iov, 1);
+    }
+}
+
+void Log::drain() {
+    if (m_mode == DEFERRED) {
+        drain_deferred();
+    }
+    else {
+        drain_raw();
+    }
+
+    // 释放已退出线程的缓冲区
+    for (size_t i = 0; i < m_rings.size(); ) {
+        Log_ring *ring = m_rings[i];
+        if (ring->closed.load(std::memory_order_acquire)
+            && ring->head.load(std::memory_order_acquire) == ring->tail.load(std::memory_order_relaxed)) {
+            delete [] ring->buf;
+            delete ring;
+            m_rings[i] = m_rings.back();
+            m_rings.pop_back();
+        }
+        else {
+            ++i;
+        }
+    }
+}
+
+void Log::drain_raw() {
+    struct iovec iov[IOV_MAX];
+    size_t heads[IOV_MAX];
+    int starts[IOV_MAX + 1]; // 每个缓冲区的第一段在 iov 中的下标
+    size_t ring_idx = 0;
+
+    while (ring_idx < m_rings.size()) {
+        // 收集一批缓冲区中的日志，每个缓冲区最多两段（环形缓冲区绕回时）
+        int cnt = 0;
+        int lines = 0;
+        size_t begin = ring_idx;
+        for (; ring_idx < m_rings.size() && cnt + 2 <= IOV_MAX; ++ring_idx) {
+            Log_ring *ring = m_rings[ring_idx];
+            size_t head = ring->head.load(std::memory_order_acquire);
+            size_t tail = ring->tail.load(std::memory_order_relaxed);
+            heads[ring_idx - begin] = head;
+            starts[ring_idx - begin] = cnt;
+            if (head == tail) {
+                continue;
+            }
+            size_t pos = tail & (ring->capacity - 1);
+            size_t n = head - tail;
+            size_t first = ring->capacity - pos < n ? ring->capacity - pos : n;
+            iov[cnt].iov_base = ring->buf + pos;
+            iov[cnt].iov_len = first;
+            ++cnt;
+            if (n > first) {
+                iov[cnt].iov_base = ring->buf;
+                iov[cnt].iov_len = n - first;
+                ++cnt;
+            }
+        }
+        starts[ring_idx - begin] = cnt;
+        if (m_mode == BINARY) {
+            for (size_t i = begin; i < ring_idx; ++i) {
+                lines += count_records(m_rings[i], m_rings[i]->tail.load(std::memory_order_relaxed), heads[i - begin]);
+            }
+        }
+        else {
+            for (int i = 0; i < cnt; ++i) {
+                const char *p = (const char *)iov[i].iov_base;
+                const char *end = p + iov[i].iov_len;
+                while ((p = (const char *)memchr(p, '\n', end - p)) != nullptr) {
+                    ++lines;
+                    ++p;
+                }
+            }
+        }
+
+        if (cnt > 0) {
+            rotate(lines);
+            if (m_mode == BINARY) {
+                // 本批记录用到的格式串都已登记，先写出它们的定义
+                write_formats();
+            }
+            if (m_segment_size > 0) {
+                // 按缓冲区写入预分配段，同一缓冲区绕回的两段不会被拆到两个段中
+                for (size_t i = 0; i < ring_idx - begin; ++i) {
+                    out_writev(iov + starts[i], starts[i + 1] - starts[i]);
+                }
+            }
+            else {
+                out_writev(iov, cnt);
+            }
+        }
+        // 日志已写出，释放缓冲区空间
+        for (size_t i = begin; i < ring_idx; ++i) {
+            m_rings[i]->tail.store(heads[i - begin], std::memory_order_release);
+        }
+    }
 }
 
 void Log::flush(void)
 {
     m_mutex.lock();
+    // 异步模式下由调用线程写出所有线程缓冲区中的日志，和按级别刷新相同，不等待后台线程
+    if (m_is_async) {
+        drain();
+    }
     //强制刷新写入流缓冲区
-    fflush(m_fp);
+    if (m_fp != nullptr) {
+        fflush(m_fp);
+    }
     m_mutex.unlock();
 }
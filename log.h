@@ -5,31 +5,115 @@
     Warn：这种警告与调试时终端的warning类似，同样是调试代码时使用；
     Info：报告系统当前的状态，当前执行的流程或接收的信息等；
     Error：输出系统的错误信息；
+3. 异步模式：每个线程有自己的环形缓冲区（单生产者单消费者，无锁），
+   写日志的线程只把格式化好的日志追加到自己的缓冲区；
+   后台线程每隔一个刷新周期取出所有线程缓冲区中的日志，用一次 writev 写入文件
+4. 延迟格式化（DEFERRED、BINARY，需异步模式）：每个调用点的格式串在第一次执行时登记一个编号，
+   写日志的线程只把编号、时间戳和参数的原始字节（见 log_format.h）追加到缓冲区；
+   DEFERRED 由后台线程格式化为文本写入文件，
+   BINARY 直接把记录写入二进制日志文件（文件名加 .bin 后缀），由 log_decode 离线解码为文本
+5. 刷新策略：调用方不再在每条日志后 flush，满足以下任一条件时日志才写到内核（进程崩溃也不会丢失）：
+    时间：距离上次刷新超过 interval_ms（异步模式下即后台线程的刷新周期）
+    大小：未刷新的日志超过 bytes（异步模式下按每个线程的缓冲区计算）
+    级别：级别不低于 level 的日志写入后立即刷新，异步模式下由写日志的线程自己写出，默认为 ERROR
+6. 日志级别过滤：
+    编译期：低于 LOG_COMPILE_LEVEL（make LOG_COMPILE_LEVEL=1）的日志调用在编译时被去掉
+    运行期：每个模块一个最低级别（http、timer、pool、access 及其他），宏在做任何事之前只读一次该级别（relaxed 原子读），
+    低于最低级别的日志不取时间、不格式化、不登记格式串
+7. 预分配段（segment_size 不为 0）：日志写入固定大小、预分配并 mmap 的段文件（见 log_file.h），写入只是 memcpy，
+   按大小切换段，下一个段由后台线程提前创建；此时不再按行数分文件，仍按日期分文件
+8. 归档（set_archive）：切换后写完的日志文件由低优先级的后台线程限速压缩为 .gz，并按数量、时间删除旧文件（见 log_archive.h）
+9. 限流和采样（LOG_*_EVERY_N_M、LOG_*_RATE_M）：每个调用点一个计数器（Log_limiter），每 N 次只输出一次，
+   或每秒最多输出 N 次，被丢弃的日志不取时间、不格式化；report_suppressed 为每个调用点输出一行被丢弃的条数
 */
 
 #ifndef LOG_H
 #define LOG_H
 
+#include <stdio.h>
+#include <time.h>
+#include <atomic>
 #include <string>
-#include "block_queue.h"
+#include <vector>
 #include "lock.h"
+#include "log_archive.h"
+#include "log_file.h"
+#include "log_format.h"
+
+struct iovec;
+
+// 可登记的格式串数量上限，超出后的调用点退回到调用线程格式化
+#define LOG_MAX_FORMATS 4096
+
+// 编译期的最低日志级别，低于该级别的日志调用被去掉
+#ifndef LOG_COMPILE_LEVEL
+#define LOG_COMPILE_LEVEL 0
+#endif
+
+// 日志级别，LOG_LEVEL_OFF 关闭日志
+enum LOG_LEVEL {
+    LOG_LEVEL_DEBUG = 0,
+    LOG_LEVEL_INFO,
+    LOG_LEVEL_WARN,
+    LOG_LEVEL_ERROR,
+    LOG_LEVEL_OFF
+};
+
+// 日志模块，每个模块可以单独设置最低级别
+enum LOG_MODULE {
+    LOG_MODULE_DEFAULT = 0, // 未指定模块的日志
+    LOG_MODULE_HTTP, // 连接读写和 HTTP 请求解析
+    LOG_MODULE_TIMER, // 定时器
+    LOG_MODULE_POOL, // 线程池和用户存储（原数据库连接池）
+    LOG_MODULE_ACCESS, // 访问日志，每个响应一条
+    LOG_MODULE_NUM
+};
+
+// 单个线程的日志缓冲区：写日志的线程移动 head，后台线程移动 tail
+struct Log_ring {
+    char *buf;
+    size_t capacity; // 2 的幂
+    std::atomic<size_t> head; // 写入位置，只增不减
+    std::atomic<size_t> tail; // 读取位置，只增不减
+    std::atomic<bool> closed; // 所属线程已退出，取空后由后台线程释放
+};
+
+class Log_limiter;
 
 class Log {
+public:
+    // 日志格式：调用线程格式化、后台线程格式化、二进制
+    enum LOG_MODE {
+        TEXT = 0,
+        DEFERRED,
+        BINARY
+    };
+
 private:
-    Log(); 
+    Log();
     virtual ~Log();
 
-    // 异步写日志方法
-    void *async_write_log() {
-        std::string single_log;
-
-        // 从阻塞队列中取出一条日志内容，写入文件
-        while (m_log_queue->pop(single_log)) {
-            m_mutex.lock();
-            fputs(single_log.c_str(), m_fp);
-            m_mutex.unlock();
-        }
-    }
+    // 异步写日志方法：后台线程周期性地取出各线程缓冲区中的日志写入文件
+    void *async_write_log();
+    // 取出所有线程缓冲区中的日志写入文件，并释放已退出线程的缓冲区，需持有 m_mutex
+    void drain();
+    // 取出所有线程缓冲区中的日志，一次 writev 写入文件（TEXT、BINARY 模式）
+    void drain_raw();
+    // 取出所有线程缓冲区中的记录，格式化后一次写入文件（DEFERRED 模式）
+    void drain_deferred();
+    // 按日期、行数判断是否需要新建日志文件，需持有 m_mutex，新建了文件时返回 true
+    bool rotate(int lines);
+    // 二进制模式下写出尚未写入当前文件的格式串定义，需持有 m_mutex
+    void write_formats();
+    // 开始写一个新的日志文件：二进制模式下写入文件头和所有格式串定义，需持有 m_mutex
+    void start_file();
+    // 写入日志文件或预分配段，需持有 m_mutex
+    void out_write(const char *data, size_t n);
+    void out_writev(struct iovec *iov, int cnt);
+    // 统计缓冲区 [tail, head) 中的记录条数
+    int count_records(Log_ring *ring, size_t tail, size_t head);
+    // 获取当前线程的缓冲区，第一次调用时创建并登记
+    Log_ring *thread_ring();
 
 public:
     // C++11之后，静态局部变量懒汉模式获取实例不需要加锁
@@ -40,24 +124,85 @@ public:
 
     // 异步写日志公有方法，调用私有方法 async_write_log
     static void *flush_log_thread(void *args) {
-        Log::get_instance()->async_write_log();
+        return Log::get_instance()->async_write_log();
     }
 
     /*
         实现日志创建，写入方式的判断：同步、异步
         filename: 日志文件名
-        lgo_buf_size：日志缓冲区大小
+        lgo_buf_size：单条日志的最大长度
         split_lines：最大行数
-        max_queue_size：日志队列长度
+        max_queue_size：异步模式下每个线程缓冲区可容纳的日志条数（按最大长度计算），为 0 时同步写日志
+        flush_interval：异步模式下后台线程的刷新周期（毫秒）
+        mode：日志格式，DEFERRED、BINARY 只在异步模式下生效
+        segment_size：预分配段的大小（字节），为 0 时直接追加写日志文件
     */
-    bool init(const char *filename, int log_buf_size = 8192, int split_lines = 5000000, int max_queue_size = 0);
+    bool init(const char *filename, int log_buf_size = 8192, int split_lines = 5000000, int max_queue_size = 0,
+              int flush_interval = 100, LOG_MODE mode = TEXT, size_t segment_size = 0);
 
     // 将写入日志的内容按照标准格式整理，主要有日志分级、分文件、格式化输出
     void write_log(int level, const char *format, ...);
 
-    // 强制刷新缓冲区
+    // 设置模块的最低日志级别，module 为 -1 时设置所有模块
+    void set_level(int level, int module = -1);
+    // 模块是否输出该级别的日志，只有一次 relaxed 原子读
+    bool enabled(int level, int module) const {
+        return level >= m_levels[module].load(std::memory_order_relaxed);
+    }
+
+    // 是否延迟格式化，init 之后不再改变
+    bool is_deferred() const {
+        return m_mode != TEXT;
+    }
+    // 登记调用点的格式串（必须是字符串常量），返回编号，登记已满时返回 -1
+    int register_format(int level, const char *format);
+
+    // 只记录格式串编号、时间戳和参数，不在调用线程格式化
+    template <typename... Args>
+    void write_deferred(int id, Args... args) {
+        char rec[LOG_RECORD_MAX];
+        Log_encoder encoder(rec, sizeof(Log_record_header), sizeof(rec));
+        log_encode_args(encoder, args...);
+
+        struct timespec ts;
+        clock_gettime(CLOCK_REALTIME, &ts);
+        Log_record_header header;
+        header.len = encoder.len();
+        header.id = id;
+        header.usec = (int64_t)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+        memcpy(rec, &header, sizeof(header));
+        push_record(m_formats[id].level, rec, header.len);
+    }
+
+    // 强制刷新缓冲区：返回时，调用前（任何线程）写入的日志都已写到内核
     void flush(void);
 
+    // 设置刷新策略，参数为 0（level 为 -1）时不按该条件刷新，见文件开头的说明
+    void set_flush_policy(int interval_ms, size_t bytes, int level);
+
+    /*
+        开启写完的日志文件的后台压缩和保留，需在 init 之前调用
+        max_files：最多保留的日志文件数（含正在写的文件），max_days：保留天数，0 表示不限
+        rate：压缩时每秒最多读取的字节数，0 表示不限速
+        keep：启动时不压缩的文件，热重启时为旧进程正在写的日志文件
+    */
+    void set_archive(int max_files, int max_days, size_t rate, const char *keep = nullptr);
+    // 正在写的日志文件名
+    std::string path();
+
+    // 登记限流的调用点，由 Log_limiter 的构造函数调用
+    void add_limiter(Log_limiter *limiter);
+    // 输出上次调用以来各调用点被限流、采样丢弃的日志条数，由定时任务周期性调用
+    void report_suppressed();
+
+private:
+    // 将一条记录追加到当前线程的缓冲区
+    void push_record(int level, const char *rec, size_t len);
+    // 同步写入后按刷新策略判断是否 fflush，需持有 m_mutex
+    void flush_if_needed(int level, size_t len, int64_t usec);
+    // 缓冲区超过一半时提前唤醒后台线程，避免写满
+    void wake_if_full(Log_ring *ring);
+
 private:
     char dir_name[128]; // 路径名
     char log_name[128]; // 日志文件名
@@ -65,21 +210,152 @@ private:
     int m_log_buf_size; // 日志缓冲区大小
     long long m_count; // 日志行数记录
     int m_today; // 按天分文件，记录当前时间是哪一天
-    Block_queue<std::string> *m_log_queue; // 阻塞队列
-    Locker m_mutex; // 互斥锁：写日志文件时进行同步
-    FILE *m_fp; // 日志文件指针
-    char *m_buf; // 要输出的内容
+    Locker m_mutex; // 互斥锁：同步模式下写日志文件，以及登记线程缓冲区、切换日志文件时使用
+    FILE *m_fp; // 日志文件指针，使用预分配段时为 nullptr
+    size_t m_segment_size; // 预分配段的大小，为 0 时不使用
+    Log_file m_file; // 预分配段
+    std::string m_path; // 不使用预分配段时，正在写的日志文件名
+    bool m_archive; // 是否压缩归档
+    int m_archive_files;
+    int m_archive_days;
+    size_t m_archive_rate;
+    std::string m_archive_keep;
+    Log_archiver m_archiver;
     bool m_is_async; // 是否同步标志位
 
+    size_t m_ring_size; // 每个线程缓冲区的大小
+    int m_flush_interval; // 按时间刷新的周期（毫秒），异步模式下即后台线程的刷新周期
+    std::atomic<size_t> m_flush_bytes; // 按大小刷新的阈值
+    std::atomic<int> m_flush_level; // 按级别刷新的最低级别
+    size_t m_unflushed; // 同步模式下未刷新的字节数
+    int64_t m_last_flush; // 同步模式下上次刷新的时间（微秒）
+    std::vector<Log_ring *> m_rings; // 所有线程的缓冲区
+    Cond m_cond; // 唤醒后台线程立即刷新
+    std::atomic<bool> m_flush_now;
+    bool m_stop; // 通知后台线程退出
+    pthread_t m_tid; // 后台线程
+
+    std::atomic<int> m_levels[LOG_MODULE_NUM]; // 每个模块的最低日志级别
+    LOG_MODE m_mode; // 日志格式
+    struct Format {
+        const char *format;
+        int level;
+    };
+    Format m_formats[LOG_MAX_FORMATS]; // 已登记的格式串，下标为编号，登记后不再修改
+    std::atomic<int> m_format_count; // 已登记的格式串数量
+    Locker m_format_mutex; // 登记格式串时使用
+    int m_formats_written; // 二进制模式下已写入当前文件的格式串数量
+    std::string m_out; // DEFERRED 模式下后台线程格式化日志的缓冲区
+    std::atomic<Log_limiter *> m_limiters; // 已登记的限流调用点（链表），只增不减
+};
+
+/*
+    限流、采样日志的调用点计数器，作为静态局部变量定义在每个调用点
+    every_n：每 every_n 次输出一次（第 1、N+1 ... 次），为 0 时不采样
+    per_second：每秒最多输出的次数，为 0 时不限速
+    计数使用 relaxed 原子操作，多线程下的输出条数是近似值
+*/
+class Log_limiter {
+public:
+    Log_limiter(int module, int level, const char *format, int every_n, int per_second);
+
+    // 本次调用是否输出，不输出时计入被丢弃的条数
+    bool allow() {
+        // 采样丢弃的条数由调用次数推算，每次调用只有一次原子操作
+        if (m_every_n > 1 && m_count.fetch_add(1, std::memory_order_relaxed) % m_every_n != 0) {
+            return false;
+        }
+        if (m_per_second > 0) {
+            // 粗粒度时钟只读 vDSO 中的时间，不进入内核
+            struct timespec ts;
+            clock_gettime(CLOCK_MONOTONIC_COARSE, &ts);
+            long long window = m_window.load(std::memory_order_relaxed);
+            if (window != ts.tv_sec && m_window.compare_exchange_strong(window, ts.tv_sec)) {
+                m_window_count.store(0, std::memory_order_relaxed);
+            }
+            if (m_window_count.fetch_add(1, std::memory_order_relaxed) >= m_per_second) {
+                m_suppressed.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    friend class Log;
+    int m_module;
+    int m_level;
+    const char *m_format;
+    int m_every_n;
+    int m_per_second;
+    std::atomic<unsigned long> m_count; // 采样的调用次数
+    std::atomic<long long> m_window; // 限速的当前秒
+    std::atomic<int> m_window_count; // 当前秒内的调用次数
+    std::atomic<unsigned long> m_suppressed; // 上次汇总以来被限速丢弃的条数
+    unsigned long m_sampled_out; // 已汇总的被采样丢弃的条数，只由 report_suppressed 访问
+    Log_limiter *m_next;
 };
 
-/* 
+/*
 这四个宏在其他文件中使用，用于不同等级的日志的输出
 日志类中的方法都不会被其他函数直接调用，使用这四个宏供其他程序调用
+延迟格式化时，每个调用点用静态局部变量保存格式串编号，只在第一次执行时登记
+带 _M 后缀的宏指定日志所属的模块
+*/
+#define LOG_BASE(module, level, format, ...) \
+    do { \
+        if ((level) < LOG_COMPILE_LEVEL) { \
+            break; \
+        } \
+        Log *log_ = Log::get_instance(); \
+        if (!log_->enabled(level, module)) { \
+            break; \
+        } \
+        if (log_->is_deferred()) { \
+            static const int log_id_ = log_->register_format(level, format); \
+            if (log_id_ >= 0) { \
+                log_->write_deferred(log_id_, __VA_ARGS__); \
+                break; \
+            } \
+        } \
+        log_->write_log(level, format, __VA_ARGS__); \
+    } while (0)
+
+#define LOG_DEBUG_M(module, format, ...) LOG_BASE(module, LOG_LEVEL_DEBUG, format, __VA_ARGS__)
+#define LOG_INFO_M(module, format, ...) LOG_BASE(module, LOG_LEVEL_INFO, format, __VA_ARGS__)
+#define LOG_WARN_M(module, format, ...) LOG_BASE(module, LOG_LEVEL_WARN, format, __VA_ARGS__)
+#define LOG_ERROR_M(module, format, ...) LOG_BASE(module, LOG_LEVEL_ERROR, format, __VA_ARGS__)
+
+/*
+限流、采样的日志宏，用于每个请求、每个事件都会执行的调用点：
+    LOG_INFO_EVERY_N_M(module, n, format, ...)：每 n 次输出一次
+    LOG_INFO_RATE_M(module, per_second, format, ...)：每秒最多输出 per_second 次
+级别被过滤时不计数；被丢弃时参数不会被求值
 */
-#define LOG_DEBUG(format, ...) Log::get_instance()->write_log(0, format, __VA_ARGS__)
-#define LOG_INFO(format, ...) Log::get_instance()->write_log(1, format, __VA_ARGS__)
-#define LOG_WARN(format, ...) Log::get_instance()->write_log(2, format, __VA_ARGS__)
-#define LOG_ERROR(format, ...) Log::get_instance()->write_log(3, format, __VA_ARGS__)
+#define LOG_LIMITED(module, level, every_n, per_second, format, ...) \
+    do { \
+        if ((level) < LOG_COMPILE_LEVEL || !Log::get_instance()->enabled(level, module)) { \
+            break; \
+        } \
+        static Log_limiter log_limiter_(module, level, format, every_n, per_second); \
+        if (log_limiter_.allow()) { \
+            LOG_BASE(module, level, format, __VA_ARGS__); \
+        } \
+    } while (0)
+
+#define LOG_DEBUG_EVERY_N_M(module, n, format, ...) LOG_LIMITED(module, LOG_LEVEL_DEBUG, n, 0, format, __VA_ARGS__)
+#define LOG_INFO_EVERY_N_M(module, n, format, ...) LOG_LIMITED(module, LOG_LEVEL_INFO, n, 0, format, __VA_ARGS__)
+#define LOG_WARN_EVERY_N_M(module, n, format, ...) LOG_LIMITED(module, LOG_LEVEL_WARN, n, 0, format, __VA_ARGS__)
+#define LOG_ERROR_EVERY_N_M(module, n, format, ...) LOG_LIMITED(module, LOG_LEVEL_ERROR, n, 0, format, __VA_ARGS__)
+
+#define LOG_DEBUG_RATE_M(module, n, format, ...) LOG_LIMITED(module, LOG_LEVEL_DEBUG, 0, n, format, __VA_ARGS__)
+#define LOG_INFO_RATE_M(module, n, format, ...) LOG_LIMITED(module, LOG_LEVEL_INFO, 0, n, format, __VA_ARGS__)
+#define LOG_WARN_RATE_M(module, n, format, ...) LOG_LIMITED(module, LOG_LEVEL_WARN, 0, n, format, __VA_ARGS__)
+#define LOG_ERROR_RATE_M(module, n, format, ...) LOG_LIMITED(module, LOG_LEVEL_ERROR, 0, n, format, __VA_ARGS__)
+
+#define LOG_DEBUG(format, ...) LOG_DEBUG_M(LOG_MODULE_DEFAULT, format, __VA_ARGS__)
+#define LOG_INFO(format, ...) LOG_INFO_M(LOG_MODULE_DEFAULT, format, __VA_ARGS__)
+#define LOG_WARN(format, ...) LOG_WARN_M(LOG_MODULE_DEFAULT, format, __VA_ARGS__)
+#define LOG_ERROR(format, ...) LOG_ERROR_M(LOG_MODULE_DEFAULT, format, __VA_ARGS__)
 
-#endif
\ No newline at end of file
+#endif
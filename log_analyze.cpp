@@ -0,0 +1,483 @@
+/*
+文本日志离线分析工具：统计 Log::write_log 写出的日志文件（如 2021_06_01_ServerLog，或压缩后的 .gz）
+    用法：./log_analyze [-t 线程数] [-i 统计间隔秒数] [-n 排名数] 日志文件 [...]（多个文件按时间顺序给出）
+    * 文件用 mmap 映射（.gz 先解压到内存），按日志行的边界切分为多段，由多个线程并行扫描，最后合并结果
+    * 统计每个时间间隔的请求数、平均和峰值每秒请求数，客户端 IP 分布，请求路径、请求头的分布，以及连接时长
+    * 连接时长：有 "accept fd: N (ip)" 日志时按 fd 与 "close fd: N" 精确配对；
+      旧的日志没有 accept 日志，以某个 IP 的第一次读写作为开始，"close fd" 按定时器的顺序
+      配对给最久没有读写的连接，结果是近似值
+    * 每行以 "YYYY-MM-DD HH:MM:SS.uuuuuu [level]: " 开头，不以时间开头的行（如多行的响应报文）属于上一条日志
+*/
+
+#include <ctype.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <zlib.h>
+#include <algorithm>
+#include <map>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+// "YYYY-MM-DD HH:MM:SS.uuuuuu " 的长度
+#define TIME_LEN 27
+
+typedef std::unordered_map<std::string, long> Counter;
+
+// 连接时长相关的事件，按文件中的顺序处理
+struct Event {
+    enum TYPE { ACCEPT, CLOSE, ACTIVE };
+    TYPE type;
+    long long usec;
+    int fd;
+    std::string ip;
+};
+
+// 每个线程扫描一段日志的结果
+struct Stats {
+    long entries;
+    long requests;
+    std::unordered_map<long long, int> per_second; // 每秒的请求数
+    Counter ips; // 客户端 IP 的读事件数
+    Counter paths; // 请求方法和路径
+    Counter headers; // 请求头名称
+    std::vector<Event> events;
+
+    Stats() : entries(0), requests(0) {}
+};
+
+struct Task {
+    const char *begin;
+    const char *end;
+    Stats stats;
+};
+
+static bool is_digit(char c) {
+    return c >= '0' && c <= '9';
+}
+
+// p 是否是一条日志的开头：YYYY-MM-DD HH:MM:SS.uuuuuu
+static bool is_entry(const char *p, const char *end) {
+    static const char pattern[] = "dddd-dd-dd dd:dd:dd.dddddd ";
+    if (end - p < TIME_LEN) {
+        return false;
+    }
+    for (int i = 0; i < TIME_LEN; ++i) {
+        if (pattern[i] == 'd' ? !is_digit(p[i]) : p[i] != pattern[i]) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static int number(const char *p, int n) {
+    int v = 0;
+    for (int i = 0; i < n; ++i) {
+        v = v * 10 + p[i] - '0';
+    }
+    return v;
+}
+
+// 日志中的本地时间按 UTC 换算为微秒，输出时再按 UTC 格式化，显示的仍是日志中的时间
+static long long parse_time(const char *p) {
+    int y = number(p, 4), m = number(p + 5, 2), d = number(p + 8, 2);
+    // 公历日期到 1970-01-01 的天数
+    y -= m <= 2;
+    int era = (y >= 0 ? y : y - 399) / 400;
+    int yoe = y - era * 400;
+    int doy = (153 * (m + (m > 2 ? -3 : 9)) + 2) / 5 + d - 1;
+    int doe = yoe * 365 + yoe / 4 - yoe / 100 + doy;
+    long long days = (long long)era * 146097 + doe - 719468;
+    long long sec = days * 86400 + number(p + 11, 2) * 3600 + number(p + 14, 2) * 60 + number(p + 17, 2);
+    return sec * 1000000 + number(p + 20, 6);
+}
+
+static bool starts_with(const char *p, const char *end, const char *prefix) {
+    size_t n = strlen(prefix);
+    return (size_t)(end - p) >= n && memcmp(p, prefix, n) == 0;
+}
+
+// 取出 "(ip)" 中的 ip
+static std::string paren_value(const char *p, const char *end) {
+    const char *q = (const char *)memchr(p, ')', end - p);
+    return std::string(p, q == nullptr ? end : q);
+}
+
+// 请求行：方法 路径 HTTP/x.x
+static bool is_request_line(const char *msg, const char *end) {
+    const char *p = msg;
+    while (p < end && *p >= 'A' && *p <= 'Z') {
+        ++p;
+    }
+    if (p == msg || p == end || *p != ' ' || end - p < 10) {
+        return false;
+    }
+    return memcmp(end - 9, " HTTP/", 6) == 0;
+}
+
+// 请求头：名称（token 字符）后紧跟冒号和空格
+static bool header_name(const char *msg, const char *end, std::string &name) {
+    const char *p = msg;
+    while (p < end && (isalnum((unsigned char)*p) || *p == '-' || *p == '_')) {
+        ++p;
+    }
+    if (p == msg || end - p < 2 || p[0] != ':' || p[1] != ' ') {
+        return false;
+    }
+    name.assign(msg, p);
+    return true;
+}
+
+static void parse_entry(const char *line, const char *end, Stats &s) {
+    ++s.entries;
+    const char *msg = (const char *)memchr(line + TIME_LEN, ']', end - line - TIME_LEN);
+    if (msg == nullptr || end - msg < 2) {
+        return;
+    }
+    msg += 2; // "]:"
+    if (msg < end && *msg == ' ') {
+        ++msg;
+    }
+
+    std::string name;
+    if (starts_with(msg, end, "deal with the client (")) {
+        std::string ip = paren_value(msg + 22, end);
+        ++s.ips[ip];
+        Event e = {Event::ACTIVE, parse_time(line), -1, ip};
+        s.events.push_back(e);
+    }
+    else if (starts_with(msg, end, "send data to the client(")) {
+        Event e = {Event::ACTIVE, parse_time(line), -1, paren_value(msg + 24, end)};
+        s.events.push_back(e);
+    }
+    else if (starts_with(msg, end, "accept fd: ")) {
+        const char *ip = (const char *)memchr(msg, '(', end - msg);
+        Event e = {Event::ACCEPT, parse_time(line), atoi(msg + 11), ip ? paren_value(ip + 1, end) : ""};
+        s.events.push_back(e);
+    }
+    else if (starts_with(msg, end, "close fd: ")) {
+        Event e = {Event::CLOSE, parse_time(line), atoi(msg + 10), ""};
+        s.events.push_back(e);
+    }
+    else if (is_request_line(msg, end)) {
+        ++s.requests;
+        ++s.per_second[parse_time(line) / 1000000];
+        // 路径过长时截断，避免异常请求占用过多内存
+        const char *path_end = end - 9;
+        if (path_end - msg > 120) {
+            path_end = msg + 120;
+        }
+        ++s.paths[std::string(msg, path_end)];
+    }
+    else if (starts_with(msg, end, "request:") || starts_with(msg, end, "oop! ")) {
+        // 响应报文、未知请求头的提示
+    }
+    else if (header_name(msg, end, name)) {
+        ++s.headers[name];
+    }
+}
+
+static void *scan(void *arg) {
+    Task *task = (Task *)arg;
+    const char *p = task->begin;
+    while (p < task->end) {
+        const char *nl = (const char *)memchr(p, '\n', task->end - p);
+        const char *line_end = nl == nullptr ? task->end : nl;
+        if (is_entry(p, line_end)) {
+            parse_entry(p, line_end, task->stats);
+        }
+        p = line_end + 1;
+    }
+    return NULL;
+}
+
+// 从 pos 开始找到下一条日志的开头
+static const char *next_entry(const char *pos, const char *begin, const char *end) {
+    const char *p = pos;
+    if (p > begin && p[-1] != '\n') {
+        const char *nl = (const char *)memchr(p, '\n', end - p);
+        p = nl == nullptr ? end : nl + 1;
+    }
+    while (p < end && !is_entry(p, end)) {
+        const char *nl = (const char *)memchr(p, '\n', end - p);
+        p = nl == nullptr ? end : nl + 1;
+    }
+    return p;
+}
+
+template <typename K, typename V>
+static void merge(std::unordered_map<K, V> &to, const std::unordered_map<K, V> &from) {
+    for (typename std::unordered_map<K, V>::const_iterator it = from.begin(); it != from.end(); ++it) {
+        to[it->first] += it->second;
+    }
+}
+
+// 并行扫描 [data, data + size)，结果合并到 total
+static void analyze(const char *data, size_t size, int threads, Stats &total) {
+    // 每段至少 1MB，小文件不必开多个线程
+    size_t min_chunk = 1 << 20;
+    if ((size_t)threads > size / min_chunk + 1) {
+        threads = size / min_chunk + 1;
+    }
+    std::vector<Task> tasks(threads);
+    const char *end = data + size;
+    const char *p = data;
+    for (int i = 0; i < threads; ++i) {
+        tasks[i].begin = p;
+        const char *pos = std::max(p, data + size / threads * (i + 1));
+        p = i == threads - 1 ? end : next_entry(pos, data, end);
+        tasks[i].end = p;
+    }
+
+    std::vector<pthread_t> tids(threads);
+    for (int i = 1; i < threads; ++i) {
+        if (pthread_create(&tids[i], NULL, scan, &tasks[i]) != 0) {
+            tids[i] = 0;
+            scan(&tasks[i]);
+        }
+    }
+    scan(&tasks[0]);
+    for (int i = 1; i < threads; ++i) {
+        if (tids[i] != 0) {
+            pthread_join(tids[i], NULL);
+        }
+    }
+
+    // 各段按文件顺序合并，连接事件保持原来的顺序
+    for (int i = 0; i < threads; ++i) {
+        Stats &s = tasks[i].stats;
+        total.entries += s.entries;
+        total.requests += s.requests;
+        merge(total.per_second, s.per_second);
+        merge(total.ips, s.ips);
+        merge(total.paths, s.paths);
+        merge(total.headers, s.headers);
+        total.events.insert(total.events.end(), s.events.begin(), s.events.end());
+    }
+}
+
+// 读入 .gz 文件的全部内容
+static bool read_gz(const char *path, std::string &out) {
+    gzFile gz = gzopen(path, "rb");
+    if (gz == nullptr) {
+        return false;
+    }
+    char buf[64 * 1024];
+    int n;
+    while ((n = gzread(gz, buf, sizeof(buf))) > 0) {
+        out.append(buf, n);
+    }
+    return gzclose(gz) == Z_OK && n == 0;
+}
+
+static bool analyze_file(const char *path, int threads, Stats &total) {
+    size_t len = strlen(path);
+    if (len > 3 && strcmp(path + len - 3, ".gz") == 0) {
+        std::string data;
+        if (!read_gz(path, data)) {
+            fprintf(stderr, "%s: read failed\n", path);
+            return false;
+        }
+        analyze(data.data(), data.size(), threads, total);
+        return true;
+    }
+
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0) {
+        perror(path);
+        close(fd);
+        return false;
+    }
+    if (st.st_size == 0) {
+        close(fd);
+        return true;
+    }
+    const char *data = (const char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror(path);
+        return false;
+    }
+    madvise((void *)data, st.st_size, MADV_SEQUENTIAL);
+    analyze(data, st.st_size, threads, total);
+    munmap((void *)data, st.st_size);
+    return true;
+}
+
+static void format_time(long long sec, char *out, size_t size) {
+    time_t t = sec;
+    struct tm tm;
+    gmtime_r(&t, &tm);
+    strftime(out, size, "%Y-%m-%d %H:%M:%S", &tm);
+}
+
+static void print_top(const char *title, const Counter &counter, long total, int top) {
+    std::vector<std::pair<long, std::string> > items;
+    for (Counter::const_iterator it = counter.begin(); it != counter.end(); ++it) {
+        items.push_back(std::make_pair(-it->second, it->first));
+    }
+    std::sort(items.begin(), items.end());
+    printf("\n%s (%zu distinct)\n", title, items.size());
+    for (size_t i = 0; i < items.size() && (int)i < top; ++i) {
+        printf("  %8ld  %5.1f%%  %s\n", -items[i].first, total ? -items[i].first * 100.0 / total : 0.0,
+               items[i].second.c_str());
+    }
+}
+
+static void print_rate(const Stats &s, int interval) {
+    printf("\nrequests per second (interval %ds)\n", interval);
+    if (s.per_second.empty()) {
+        return;
+    }
+    std::map<long long, int> seconds(s.per_second.begin(), s.per_second.end());
+    std::map<long long, std::pair<long, int> > buckets; // 起始秒 -> 请求数、峰值
+    for (std::map<long long, int>::iterator it = seconds.begin(); it != seconds.end(); ++it) {
+        std::pair<long, int> &b = buckets[it->first - it->first % interval];
+        b.first += it->second;
+        b.second = std::max(b.second, it->second);
+    }
+    char time_buf[32];
+    printf("  %-19s  %8s  %8s  %6s\n", "start", "requests", "avg/s", "peak/s");
+    for (std::map<long long, std::pair<long, int> >::iterator it = buckets.begin(); it != buckets.end(); ++it) {
+        format_time(it->first, time_buf, sizeof(time_buf));
+        printf("  %-19s  %8ld  %8.2f  %6d\n", time_buf, it->second.first, (double)it->second.first / interval,
+               it->second.second);
+    }
+}
+
+static void print_lifetimes(const std::vector<Event> &events) {
+    bool exact = false;
+    for (size_t i = 0; i < events.size() && !exact; ++i) {
+        exact = events[i].type == Event::ACCEPT;
+    }
+
+    struct Conn {
+        long long start;
+        long long last;
+    };
+    std::vector<long long> lifetimes;
+    std::unordered_map<int, Conn> by_fd;
+    std::unordered_map<std::string, Conn> by_ip;
+    for (size_t i = 0; i < events.size(); ++i) {
+        const Event &e = events[i];
+        if (exact) {
+            if (e.type == Event::ACCEPT) {
+                Conn c = {e.usec, e.usec};
+                by_fd[e.fd] = c;
+            }
+            else if (e.type == Event::CLOSE) {
+                std::unordered_map<int, Conn>::iterator it = by_fd.find(e.fd);
+                if (it != by_fd.end()) {
+                    lifetimes.push_back(e.usec - it->second.start);
+                    by_fd.erase(it);
+                }
+            }
+        }
+        else if (e.type == Event::ACTIVE) {
+            std::unordered_map<std::string, Conn>::iterator it = by_ip.find(e.ip);
+            if (it == by_ip.end()) {
+                Conn c = {e.usec, e.usec};
+                by_ip[e.ip] = c;
+            }
+            else {
+                it->second.last = e.usec;
+            }
+        }
+        else if (e.type == Event::CLOSE && !by_ip.empty()) {
+            // 定时器按过期时间（最后一次读写 + 超时）依次关闭连接
+            std::unordered_map<std::string, Conn>::iterator oldest = by_ip.begin();
+            for (std::unordered_map<std::string, Conn>::iterator it = by_ip.begin(); it != by_ip.end(); ++it) {
+                if (it->second.last < oldest->second.last) {
+                    oldest = it;
+                }
+            }
+            lifetimes.push_back(e.usec - oldest->second.start);
+            by_ip.erase(oldest);
+        }
+    }
+
+    printf("\nconnection lifetimes (%s)\n", exact ? "accept -> close fd" : "approximate, first activity -> close fd");
+    size_t open = exact ? by_fd.size() : by_ip.size();
+    if (lifetimes.empty()) {
+        printf("  no closed connections, %zu still open\n", open);
+        return;
+    }
+    std::sort(lifetimes.begin(), lifetimes.end());
+    size_t n = lifetimes.size();
+    long long sum = 0;
+    for (size_t i = 0; i < n; ++i) {
+        sum += lifetimes[i];
+    }
+    printf("  closed %zu, still open %zu\n", n, open);
+    printf("  avg %.3fs  p50 %.3fs  p90 %.3fs  p99 %.3fs  max %.3fs\n", sum / 1e6 / n, lifetimes[n / 2] / 1e6,
+           lifetimes[n * 9 / 10] / 1e6, lifetimes[n * 99 / 100] / 1e6, lifetimes[n - 1] / 1e6);
+}
+
+int main(int argc, char *argv[]) {
+    int threads = sysconf(_SC_NPROCESSORS_ONLN);
+    int interval = 60;
+    int top = 10;
+    int opt;
+    while ((opt = getopt(argc, argv, "t:i:n:")) != -1) {
+        switch (opt) {
+        case 't':
+            threads = atoi(optarg);
+            break;
+        case 'i':
+            interval = atoi(optarg);
+            break;
+        case 'n':
+            top = atoi(optarg);
+            break;
+        default:
+            optind = argc + 1;
+        }
+    }
+    if (optind >= argc || threads <= 0 || interval <= 0 || top <= 0) {
+        fprintf(stderr, "usage: %s [-t threads] [-i interval_sec] [-n top] log_file [...]\n", argv[0]);
+        return 1;
+    }
+
+    Stats total;
+    int ret = 0;
+    for (int i = optind; i < argc; ++i) {
+        if (!analyze_file(argv[i], threads, total)) {
+            ret = 1;
+        }
+    }
+
+    printf("entries %ld, requests %ld", total.entries, total.requests);
+    if (!total.per_second.empty()) {
+        // 日志可能跨越多天，平均值只按有请求的秒数计算
+        int peak = 0;
+        for (std::unordered_map<long long, int>::iterator it = total.per_second.begin();
+             it != total.per_second.end(); ++it) {
+            peak = std::max(peak, it->second);
+        }
+        printf(", %zu active seconds, %.2f req/active s, peak %d req/s", total.per_second.size(),
+               (double)total.requests / total.per_second.size(), peak);
+    }
+    printf("\n");
+    print_rate(total, interval);
+    long reads = 0;
+    for (Counter::iterator it = total.ips.begin(); it != total.ips.end(); ++it) {
+        reads += it->second;
+    }
+    print_top("client ips (reads)", total.ips, reads, top);
+    print_top("request paths", total.paths, total.requests, top);
+    print_top("request headers (share of requests)", total.headers, total.requests, top);
+    print_lifetimes(total.events);
+    return ret;
+}
@@ -0,0 +1,399 @@
+#include <fcntl.h>
+#include <unistd.h>
+#include <dirent.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include <sys/stat.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <algorithm>
+#include <vector>
+#include <zlib.h>
+#include "log_archive.h"
+
+// ioprio_set 没有 glibc 封装，按内核头文件定义
+#define IOPRIO_WHO_PROCESS 1
+#define IOPRIO_CLASS_IDLE 3
+#define IOPRIO_CLASS_SHIFT 13
+
+static long long now_us() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (long long)ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+static bool ends_with(const char *s, const char *suffix) {
+    size_t n = strlen(s), m = strlen(suffix);
+    return n >= m && strcmp(s + n - m, suffix) == 0;
+}
+
+Log_archiver::Log_archiver() {
+    m_max_files = 0;
+    m_max_days = 0;
+    m_rate = 0;
+    m_stop = false;
+    m_running = false;
+    m_window_start = 0;
+    m_window_bytes = 0;
+}
+
+Log_archiver::~Log_archiver() {
+    stop();
+}
+
+bool Log_archiver::start(const char *dir, const char *name, const std::string &active, int max_files,
+                         int max_days, size_t rate, const std::string &keep) {
+    m_dir = dir;
+    m_name = name;
+    m_active = active;
+    m_keep = keep;
+    m_max_files = max_files;
+    m_max_days = max_days;
+    m_rate = rate;
+    m_stop = false;
+    m_manifest = m_dir + m_name + ".manifest";
+    m_mutex.lock();
+    load_manifest();
+    own(active);
+    m_mutex.unlock();
+    if (pthread_create(&m_tid, NULL, worker, this) != 0) {
+        return false;
+    }
+    m_running = true;
+    return true;
+}
+
+void Log_archiver::set_active(const std::string &active) {
+    m_mutex.lock();
+    m_active = active;
+    // 分段模式下第一个段在 start 之前打开，由 start 记入清单
+    if (!m_manifest.empty()) {
+        own(active);
+    }
+    m_mutex.unlock();
+}
+
+// 清单中的文件名不含目录，日志目录固定，按文件名比较
+static std::string base_name(const std::string &path) {
+    size_t slash = path.rfind('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+}
+
+bool Log_archiver::is_owned(const std::string &file) const {
+    std::string name = base_name(file);
+    if (ends_with(name.c_str(), ".gz")) {
+        name.resize(name.size() - 3);
+    }
+    return m_owned.count(name) != 0;
+}
+
+void Log_archiver::own(const std::string &path) {
+    std::string name = base_name(path);
+    if (name.empty() || !m_owned.insert(name).second) {
+        return;
+    }
+    // 追加一行；热重启时新旧进程可能同时追加，O_APPEND 的单次 write 不会交错
+    int fd = open(m_manifest.c_str(), O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return;
+    }
+    name += '\n';
+    ssize_t n = write(fd, name.data(), name.size());
+    (void)n;
+    close(fd);
+}
+
+void Log_archiver::load_manifest() {
+    m_owned.clear();
+    FILE *fp = fopen(m_manifest.c_str(), "re");
+    if (fp == nullptr) {
+        return;
+    }
+    char line[512];
+    bool stale = false;
+    while (fgets(line, sizeof(line), fp) != nullptr) {
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] == '\0') {
+            continue;
+        }
+        // 正在写的段在记入清单之后才创建，还不存在时同样保留
+        std::string path = m_dir + line;
+        if (access(path.c_str(), F_OK) == 0 || access((path + ".gz").c_str(), F_OK) == 0
+            || line == base_name(m_active)) {
+            m_owned.insert(line);
+        }
+        else {
+            stale = true;
+        }
+    }
+    fclose(fp);
+    if (stale) {
+        save_manifest();
+    }
+}
+
+void Log_archiver::save_manifest() {
+    std::string tmp = m_manifest + ".tmp";
+    FILE *fp = fopen(tmp.c_str(), "we");
+    if (fp == nullptr) {
+        return;
+    }
+    for (std::set<std::string>::const_iterator it = m_owned.begin(); it != m_owned.end(); ++it) {
+        fprintf(fp, "%s\n", it->c_str());
+    }
+    if (fclose(fp) != 0 || rename(tmp.c_str(), m_manifest.c_str()) != 0) {
+        unlink(tmp.c_str());
+    }
+}
+
+void Log_archiver::add(const std::string &path) {
+    m_mutex.lock();
+    m_pending.push_back(path);
+    m_cond.signal();
+    m_mutex.unlock();
+}
+
+void Log_archiver::stop() {
+    if (!m_running) {
+        return;
+    }
+    m_mutex.lock();
+    m_stop = true;
+    m_cond.signal();
+    m_mutex.unlock();
+    pthread_join(m_tid, NULL);
+    m_running = false;
+}
+
+void *Log_archiver::worker(void *arg) {
+    Log_archiver *archiver = (Log_archiver *)arg;
+    archiver->run();
+    return NULL;
+}
+
+void Log_archiver::run() {
+    // 只降低本线程的优先级（Linux 上按线程号设置）
+    pid_t tid = syscall(SYS_gettid);
+    setpriority(PRIO_PROCESS, tid, 19);
+    syscall(SYS_ioprio_set, IOPRIO_WHO_PROCESS, tid, IOPRIO_CLASS_IDLE << IOPRIO_CLASS_SHIFT);
+
+    // 启动时遗留的未压缩日志文件
+    std::string dir = m_dir.empty() ? "." : m_dir;
+    DIR *d = opendir(dir.c_str());
+    if (d != nullptr) {
+        m_mutex.lock();
+        struct dirent *ent;
+        while ((ent = readdir(d)) != nullptr) {
+            std::string path = m_dir + ent->d_name;
+            if (is_log_file(ent->d_name) && !ends_with(ent->d_name, ".gz") && is_owned(ent->d_name)
+                && path != m_active && path != m_keep) {
+                m_pending.push_back(path);
+            }
+        }
+        m_mutex.unlock();
+        closedir(d);
+    }
+    retain();
+
+    m_window_start = now_us();
+    m_mutex.lock();
+    while (!m_stop) {
+        if (m_pending.empty()) {
+            // 没有待压缩的文件时每分钟检查一次保留策略（按时间删除）
+            struct timespec ts;
+            clock_gettime(CLOCK_REALTIME, &ts);
+            ts.tv_sec += 60;
+            m_cond.timewait(m_mutex.get(), ts);
+            if (m_pending.empty() && !m_stop) {
+                m_mutex.unlock();
+                retain();
+                m_mutex.lock();
+            }
+            continue;
+        }
+        std::string path = m_pending.front();
+        m_pending.pop_front();
+        m_mutex.unlock();
+        if (compress(path)) {
+            retain();
+        }
+        m_mutex.lock();
+    }
+    m_mutex.unlock();
+}
+
+bool Log_archiver::compress(const std::string &path) {
+    int fd = open(path.c_str(), O_RDONLY | O_CLOEXEC);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    fstat(fd, &st);
+
+    std::string gz_path = path + ".gz";
+    std::string tmp_path = gz_path + ".tmp";
+    gzFile gz = gzopen(tmp_path.c_str(), "wb6");
+    if (gz == nullptr) {
+        close(fd);
+        return false;
+    }
+    char buf[64 * 1024];
+    bool ok = true;
+    ssize_t n;
+    while ((n = read(fd, buf, sizeof(buf))) > 0) {
+        if (gzwrite(gz, buf, n) != n) {
+            ok = false;
+            break;
+        }
+        throttle(n);
+        // 退出时放弃本次压缩，下次启动时重新处理
+        m_mutex.lock();
+        bool stop = m_stop;
+        m_mutex.unlock();
+        if (stop) {
+            ok = false;
+            break;
+        }
+    }
+    close(fd);
+    if (gzclose(gz) != Z_OK || n < 0 || !ok) {
+        unlink(tmp_path.c_str());
+        return false;
+    }
+
+    // 同名的 .gz 已存在（如重启后同一天继续追加写的日志文件）：拼接为多个 gzip 成员，zcat 可以连续解压
+    if (access(gz_path.c_str(), F_OK) == 0 && !join(gz_path, tmp_path)) {
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    // 保留原文件的修改时间，按时间保留时以日志的时间为准
+    struct timespec times[2] = {st.st_atim, st.st_mtim};
+    utimensat(AT_FDCWD, tmp_path.c_str(), times, 0);
+    if (rename(tmp_path.c_str(), gz_path.c_str()) != 0) {
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    unlink(path.c_str());
+    return true;
+}
+
+bool Log_archiver::join(const std::string &gz_path, const std::string &tmp_path) {
+    // 写到新的临时文件再替换 tmp_path，中途失败不会损坏已有的归档
+    std::string joined = tmp_path + ".join";
+    int out = open(joined.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (out < 0) {
+        return false;
+    }
+    const std::string *parts[2] = {&gz_path, &tmp_path};
+    char buf[64 * 1024];
+    bool ok = true;
+    for (int i = 0; i < 2 && ok; ++i) {
+        int in = open(parts[i]->c_str(), O_RDONLY | O_CLOEXEC);
+        if (in < 0) {
+            ok = false;
+            break;
+        }
+        ssize_t n;
+        while ((n = read(in, buf, sizeof(buf))) > 0) {
+            if (write(out, buf, n) != n) {
+                ok = false;
+                break;
+            }
+            throttle(n);
+        }
+        ok = ok && n == 0;
+        close(in);
+    }
+    close(out);
+    if (!ok || rename(joined.c_str(), tmp_path.c_str()) != 0) {
+        unlink(joined.c_str());
+        return false;
+    }
+    return true;
+}
+
+void Log_archiver::retain() {
+    if (m_max_files <= 0 && m_max_days <= 0) {
+        return;
+    }
+    std::string dir = m_dir.empty() ? "." : m_dir;
+    DIR *d = opendir(dir.c_str());
+    if (d == nullptr) {
+        return;
+    }
+    m_mutex.lock();
+    std::string active = m_active;
+    std::vector<std::pair<long long, std::string> > files; // 修改时间（纳秒）和文件名
+    struct dirent *ent;
+    while ((ent = readdir(d)) != nullptr) {
+        if (!is_log_file(ent->d_name) || !is_owned(ent->d_name)) {
+            continue;
+        }
+        std::string path = m_dir + ent->d_name;
+        struct stat st;
+        // 热重启时旧进程还在写 m_keep，和正在写的文件一样不删除
+        if (path != active && path != m_keep && stat(path.c_str(), &st) == 0) {
+            files.push_back(std::make_pair((long long)st.st_mtim.tv_sec * 1000000000 + st.st_mtim.tv_nsec, path));
+        }
+    }
+    m_mutex.unlock();
+    closedir(d);
+
+    // 从最旧的开始删除；正在写的文件不在列表中，但占一个保留名额（旧进程在写的文件不占）
+    std::sort(files.begin(), files.end());
+    long long expire = (time(nullptr) - (long long)m_max_days * 86400) * 1000000000;
+    size_t keep = m_max_files > 0 ? m_max_files - 1 : files.size();
+    bool removed = false;
+    for (size_t i = 0; i < files.size(); ++i) {
+        bool too_many = files.size() - i > keep;
+        bool too_old = m_max_days > 0 && files[i].first < expire;
+        if (too_many || too_old) {
+            unlink(files[i].second.c_str());
+            removed = true;
+        }
+    }
+    if (!removed) {
+        return;
+    }
+    // 压缩前后的文件都已不存在的记录从清单中删除
+    m_mutex.lock();
+    load_manifest();
+    m_mutex.unlock();
+}
+
+bool Log_archiver::is_log_file(const char *file) const {
+    // 日期_日志名，如 2021_06_01_ServerLog、2021_06_01_ServerLog.1.gz
+    if (strlen(file) < 11 + m_name.size() || file[4] != '_' || file[7] != '_' || file[10] != '_') {
+        return false;
+    }
+    for (int i = 0; i < 10; ++i) {
+        if (i != 4 && i != 7 && (file[i] < '0' || file[i] > '9')) {
+            return false;
+        }
+    }
+    if (strncmp(file + 11, m_name.c_str(), m_name.size()) != 0) {
+        return false;
+    }
+    const char *rest = file + 11 + m_name.size();
+    return *rest == '\0' || (*rest == '.' && !ends_with(rest, ".tmp") && !ends_with(rest, ".join"));
+}
+
+void Log_archiver::throttle(size_t bytes) {
+    if (m_rate == 0) {
+        return;
+    }
+    m_window_bytes += bytes;
+    long long now = now_us();
+    long long expect = m_window_start + (long long)(m_window_bytes * 1000000.0 / m_rate);
+    if (expect > now) {
+        usleep(expect - now);
+        now = expect;
+    }
+    // 空闲一段时间后不累计之前的额度
+    if (now - m_window_start > 1000000) {
+        m_window_start = now;
+        m_window_bytes = 0;
+    }
+}
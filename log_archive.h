@@ -0,0 +1,94 @@
+/*
+已完成日志文件的后台压缩与保留
+    * 日志切换后，写完的文件（或预分配段）交给后台线程用 gzip 压缩为 .gz，压缩完成后删除原文件；
+      启动时目录中遗留的未压缩日志文件（除正在写的文件外）也会被压缩
+    * 保留策略：只保留最近的 max_files 个日志文件，删除修改时间早于 max_days 天的日志文件，0 表示不限
+    * 只处理本进程（及热重启前的进程）写过的文件：打开的每个日志文件都记入日志目录下的清单文件
+      （日志名.manifest，如 ServerLog.manifest），启动时的压缩和保留策略只作用于清单中的文件（及其 .gz），
+      目录中其他同名格式的日志（如复制进来、随代码提交的旧日志）不会被压缩或删除
+    * 后台线程以最低的 CPU 优先级（nice 19）和空闲 I/O 优先级运行，并按 rate 字节/秒限速读取，不与请求争用资源
+*/
+
+#ifndef LOG_ARCHIVE_H
+#define LOG_ARCHIVE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <deque>
+#include <set>
+#include <string>
+#include "lock.h"
+
+class Log_archiver {
+public:
+    Log_archiver();
+    ~Log_archiver();
+
+    /*
+        启动后台线程：dir、name 为日志路径和日志名，active 为正在写的文件，不会被压缩或删除；
+        keep 为另一个进程正在写的文件（热重启），启动时不压缩，保留时也不删除
+    */
+    bool start(const char *dir, const char *name, const std::string &active, int max_files, int max_days,
+               size_t rate, const std::string &keep = std::string());
+    // 更新正在写的文件
+    void set_active(const std::string &active);
+    // 提交一个已写完的日志文件
+    void add(const std::string &path);
+    // 停止后台线程，未压缩的文件留到下次启动时处理
+    void stop();
+
+    // 供 Log_file 切换段时回调
+    static void on_open(const char *path, void *arg) {
+        ((Log_archiver *)arg)->set_active(path);
+    }
+    static void on_close(const char *path, void *arg) {
+        ((Log_archiver *)arg)->add(path);
+    }
+
+private:
+    static void *worker(void *arg);
+    void run();
+    // 把 path 压缩为 path.gz，成功后删除 path
+    bool compress(const std::string &path);
+    // 把已有的 gz_path 与新压缩的 tmp_path 拼接，结果写回 tmp_path
+    bool join(const std::string &gz_path, const std::string &tmp_path);
+    // 按数量、时间删除旧的日志文件
+    void retain();
+    // 目录中属于本日志的文件名：日期_日志名...
+    bool is_log_file(const char *file) const;
+    // 文件（去掉 .gz 后）是否在清单中，调用时持有 m_mutex
+    bool is_owned(const std::string &file) const;
+    // 把 path 记入清单，调用时持有 m_mutex
+    void own(const std::string &path);
+    // 读取清单，丢弃文件已不存在的记录
+    void load_manifest();
+    // 重写清单（删除文件后），调用时持有 m_mutex
+    void save_manifest();
+    // 限速：已读取 bytes 字节后按速率休眠
+    void throttle(size_t bytes);
+
+private:
+    std::string m_dir;
+    std::string m_name;
+    int m_max_files;
+    int m_max_days;
+    size_t m_rate;
+
+    std::string m_manifest; // 清单文件路径
+
+    Locker m_mutex; // 保护以下成员
+    Cond m_cond;
+    std::set<std::string> m_owned; // 清单中的文件名（不含目录）
+    std::deque<std::string> m_pending; // 待压缩的文件
+    std::string m_active;
+    std::string m_keep;
+    bool m_stop;
+    bool m_running;
+    pthread_t m_tid;
+
+    // 限速计数，只由后台线程访问
+    long long m_window_start; // 微秒
+    size_t m_window_bytes;
+};
+
+#endif
@@ -0,0 +1,101 @@
+/*
+二进制日志解码工具：将 BINARY 模式写出的日志文件（*.bin）还原为文本日志，输出到标准输出
+    用法：./log_decode 2021_06_01_ServerLog.bin [...]
+    * 文件中格式串定义记录先于使用它的日志记录；服务器重启后追加到同一文件时编号会重新分配，
+      后出现的定义覆盖之前的定义
+*/
+
+#include <stdio.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <string>
+#include <unordered_map>
+#include "log_format.h"
+
+struct Format {
+    std::string format;
+    int level;
+};
+
+static bool decode(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        perror(path);
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || st.st_size < LOG_BINARY_MAGIC_LEN) {
+        fprintf(stderr, "%s: not a binary log\n", path);
+        close(fd);
+        return false;
+    }
+    const char *data = (const char *)mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        perror(path);
+        return false;
+    }
+    if (memcmp(data, LOG_BINARY_MAGIC, LOG_BINARY_MAGIC_LEN) != 0) {
+        fprintf(stderr, "%s: not a binary log\n", path);
+        munmap((void *)data, st.st_size);
+        return false;
+    }
+
+    std::unordered_map<uint32_t, Format> formats;
+    char line[LOG_RECORD_MAX * 4];
+    const char *p = data + LOG_BINARY_MAGIC_LEN;
+    const char *end = data + st.st_size;
+    bool ok = true;
+    while (p + sizeof(Log_record_header) <= end) {
+        Log_record_header header;
+        memcpy(&header, p, sizeof(header));
+        if (header.len < sizeof(header) || header.len > (size_t)(end - p)) {
+            fprintf(stderr, "%s: truncated record at offset %ld\n", path, (long)(p - data));
+            ok = false;
+            break;
+        }
+        if (header.id == LOG_DEF_ID) {
+            // 格式串定义：编号 | 级别 | 格式串
+            const char *q = p + sizeof(header);
+            uint32_t id;
+            uint8_t level;
+            if (header.len >= sizeof(header) + sizeof(id) + sizeof(level)) {
+                memcpy(&id, q, sizeof(id));
+                memcpy(&level, q + sizeof(id), sizeof(level));
+                Format &f = formats[id];
+                f.level = level;
+                f.format.assign(q + sizeof(id) + sizeof(level), p + header.len - q - sizeof(id) - sizeof(level));
+            }
+        }
+        else {
+            std::unordered_map<uint32_t, Format>::iterator it = formats.find(header.id);
+            if (it == formats.end()) {
+                fprintf(stderr, "%s: unknown format id %u at offset %ld\n", path, header.id, (long)(p - data));
+            }
+            else {
+                int n = log_format_record(line, sizeof(line), it->second.level, it->second.format.c_str(), p);
+                fwrite(line, 1, n, stdout);
+            }
+        }
+        p += header.len;
+    }
+    munmap((void *)data, st.st_size);
+    return ok;
+}
+
+int main(int argc, char *argv[]) {
+    if (argc < 2) {
+        fprintf(stderr, "usage: %s binary_log [...]\n", argv[0]);
+        return 1;
+    }
+    int ret = 0;
+    for (int i = 1; i < argc; ++i) {
+        if (!decode(argv[i])) {
+            ret = 1;
+        }
+    }
+    return ret;
+}
@@ -0,0 +1,314 @@
+#include <fcntl.h>
+#include <errno.h>
+#include <unistd.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/file.h>
+#include <sys/stat.h>
+#include "log_file.h"
+#include "log_format.h"
+
+Log_file::Log_file() {
+    m_index = 0;
+    m_segment_size = 0;
+    m_cur.fd = -1;
+    m_cur.base = nullptr;
+    m_next.fd = -1;
+    m_next.base = nullptr;
+    m_want_next = false;
+    m_stop = false;
+    m_running = false;
+    m_on_open = nullptr;
+    m_on_close = nullptr;
+    m_cb_arg = nullptr;
+    memset(m_date, '\0', sizeof(m_date));
+}
+
+Log_file::~Log_file() {
+    close();
+}
+
+bool Log_file::open(const char *dir, const char *name, const struct tm &day, size_t segment_size) {
+    m_dir = dir;
+    m_name = name;
+    // 临时文件名带进程号：热重启时新旧进程同时写同一目录的日志，各自预先创建段
+    m_tmp_path = m_dir + "." + m_name + ".next." + std::to_string(getpid());
+    m_segment_size = segment_size;
+    snprintf(m_date, sizeof(m_date), "%d_%02d_%02d_", day.tm_year + 1900, day.tm_mon + 1, day.tm_mday);
+    m_index = 0;
+
+    repair();
+    if (!create(m_cur) || !activate(m_cur)) {
+        return false;
+    }
+
+    // 启动后台线程，立即开始创建下一个段
+    m_want_next = true;
+    m_stop = false;
+    if (pthread_create(&m_tid, NULL, worker, this) == 0) {
+        m_running = true;
+    }
+    return true;
+}
+
+bool Log_file::reopen(const struct tm &day) {
+    snprintf(m_date, sizeof(m_date), "%d_%02d_%02d_", day.tm_year + 1900, day.tm_mon + 1, day.tm_mday);
+    m_index = 0;
+    return next_segment();
+}
+
+bool Log_file::next_segment() {
+    Segment seg;
+    seg.fd = -1;
+    seg.base = nullptr;
+    m_mutex.lock();
+    if (m_running) {
+        // 一般后台线程早已创建好；否则等待它创建完成，创建失败时由当前线程同步创建
+        if (m_next.base == nullptr) {
+            m_want_next = true;
+            m_cond.broadcast();
+        }
+        while (m_next.base == nullptr && m_want_next) {
+            m_cond.wait(m_mutex.get());
+        }
+        seg = m_next;
+        m_next.base = nullptr;
+    }
+    m_mutex.unlock();
+
+    if (seg.base == nullptr && !create(seg)) {
+        return false;
+    }
+    if (!activate(seg)) {
+        release(seg);
+        unlink(m_tmp_path.c_str());
+        return false;
+    }
+
+    // 写满的段交给后台线程关闭，并请求创建下一个段
+    m_mutex.lock();
+    if (m_cur.base != nullptr) {
+        m_retired.push_back(m_cur);
+    }
+    m_want_next = true;
+    m_cond.broadcast();
+    m_mutex.unlock();
+    m_cur = seg;
+    return true;
+}
+
+void Log_file::write(const char *data, size_t n) {
+    while (n > 0) {
+        if (remaining() == 0 && !next_segment()) {
+            return;
+        }
+        size_t len = remaining() < n ? remaining() : n;
+        memcpy(m_cur.base + m_cur.used, data, len);
+        m_cur.used += len;
+        data += len;
+        n -= len;
+    }
+}
+
+void Log_file::close() {
+    if (m_running) {
+        m_mutex.lock();
+        m_stop = true;
+        m_cond.broadcast();
+        m_mutex.unlock();
+        pthread_join(m_tid, NULL);
+        m_running = false;
+    }
+    for (size_t i = 0; i < m_retired.size(); ++i) {
+        release(m_retired[i]);
+    }
+    m_retired.clear();
+    if (m_cur.base != nullptr) {
+        release(m_cur);
+        m_cur.base = nullptr;
+    }
+    if (m_next.base != nullptr) {
+        // 预先创建但未使用的段
+        munmap(m_next.base, m_next.size);
+        ::close(m_next.fd);
+        unlink(m_tmp_path.c_str());
+        m_next.base = nullptr;
+    }
+}
+
+void *Log_file::worker(void *arg) {
+    Log_file *file = (Log_file *)arg;
+    file->run();
+    return NULL;
+}
+
+void Log_file::run() {
+    m_mutex.lock();
+    while (true) {
+        while (!m_stop && m_retired.empty() && !(m_want_next && m_next.base == nullptr)) {
+            m_cond.wait(m_mutex.get());
+        }
+        if (m_stop) {
+            break;
+        }
+        std::vector<Segment> retired;
+        retired.swap(m_retired);
+        bool want = m_want_next && m_next.base == nullptr;
+        m_mutex.unlock();
+
+        for (size_t i = 0; i < retired.size(); ++i) {
+            release(retired[i]);
+            if (m_on_close != nullptr) {
+                m_on_close(retired[i].path.c_str(), m_cb_arg);
+            }
+        }
+        Segment seg;
+        bool ok = want && create(seg);
+
+        m_mutex.lock();
+        if (want) {
+            if (ok) {
+                m_next = seg;
+            }
+            m_want_next = false;
+            m_cond.broadcast();
+        }
+    }
+    m_mutex.unlock();
+}
+
+bool Log_file::create(Segment &seg) {
+    int fd = ::open(m_tmp_path.c_str(), O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    if (fd < 0) {
+        return false;
+    }
+    // 预分配磁盘空间，文件系统不支持时退回 ftruncate
+    if (fallocate(fd, 0, 0, m_segment_size) != 0 && ftruncate(fd, m_segment_size) != 0) {
+        ::close(fd);
+        unlink(m_tmp_path.c_str());
+        return false;
+    }
+    void *base = mmap(NULL, m_segment_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, 0);
+    if (base == MAP_FAILED) {
+        ::close(fd);
+        unlink(m_tmp_path.c_str());
+        return false;
+    }
+    // 写入期间持有锁，其他进程启动时不修复该段
+    flock(fd, LOCK_EX | LOCK_NB);
+    seg.fd = fd;
+    seg.base = (char *)base;
+    seg.size = m_segment_size;
+    seg.used = 0;
+    return true;
+}
+
+bool Log_file::activate(Segment &seg) {
+    // 跳过已存在的文件（如重启前写入的段、已压缩的段），不覆盖
+    char path[512];
+    while (true) {
+        if (m_index == 0) {
+            snprintf(path, sizeof(path), "%s%s%s", m_dir.c_str(), m_date, m_name.c_str());
+        }
+        else {
+            snprintf(path, sizeof(path), "%s%s%s.%d", m_dir.c_str(), m_date, m_name.c_str(), m_index);
+        }
+        ++m_index;
+        // 已被压缩归档的段也不能重名
+        std::string gz = std::string(path) + ".gz";
+        if (access(path, F_OK) == 0 || access(gz.c_str(), F_OK) == 0) {
+            continue;
+        }
+        // 先通知回调，新段出现时已被视为正在写的文件
+        if (m_on_open != nullptr) {
+            m_on_open(path, m_cb_arg);
+        }
+        // link 在文件名已存在时失败，不会覆盖另一个进程刚刚启用的同名段
+        if (link(m_tmp_path.c_str(), path) == 0) {
+            unlink(m_tmp_path.c_str());
+            break;
+        }
+        if (errno != EEXIST) {
+            // 不支持硬链接的文件系统退回 rename
+            if (rename(m_tmp_path.c_str(), path) != 0) {
+                return false;
+            }
+            break;
+        }
+    }
+    seg.path = path;
+    return true;
+}
+
+void Log_file::release(Segment &seg) {
+    // 去掉预分配而未写入的部分
+    if (ftruncate(seg.fd, seg.used) != 0) {
+        perror("ftruncate log segment");
+    }
+    munmap(seg.base, seg.size);
+    ::close(seg.fd);
+}
+
+void Log_file::repair() {
+    // 与 activate 相同的编号顺序，找到最后一个未压缩的段
+    std::string last;
+    char path[512];
+    for (int i = 0;; ++i) {
+        if (i == 0) {
+            snprintf(path, sizeof(path), "%s%s%s", m_dir.c_str(), m_date, m_name.c_str());
+        }
+        else {
+            snprintf(path, sizeof(path), "%s%s%s.%d", m_dir.c_str(), m_date, m_name.c_str(), i);
+        }
+        std::string gz = std::string(path) + ".gz";
+        if (access(path, F_OK) == 0) {
+            last = path;
+        }
+        else if (access(gz.c_str(), F_OK) != 0) {
+            break;
+        }
+    }
+    if (last.empty()) {
+        return;
+    }
+    int fd = ::open(last.c_str(), O_RDWR | O_CLOEXEC);
+    if (fd < 0) {
+        return;
+    }
+    // 另一个进程（热重启时的旧进程）正在写该段
+    struct stat st;
+    if (flock(fd, LOCK_EX | LOCK_NB) != 0 || fstat(fd, &st) != 0 || st.st_size == 0) {
+        ::close(fd);
+        return;
+    }
+    size_t size = st.st_size;
+    void *base = mmap(NULL, size, PROT_READ, MAP_SHARED, fd, 0);
+    if (base == MAP_FAILED) {
+        ::close(fd);
+        return;
+    }
+    const char *data = (const char *)base;
+    size_t used;
+    if (size >= LOG_BINARY_MAGIC_LEN && memcmp(data, LOG_BINARY_MAGIC, LOG_BINARY_MAGIC_LEN) == 0) {
+        // 二进制日志的记录中含有 '\0'，按记录长度走到第一条不完整的记录
+        used = LOG_BINARY_MAGIC_LEN;
+        while (size - used >= sizeof(Log_record_header)) {
+            uint32_t len;
+            memcpy(&len, data + used, sizeof(len));
+            if (len < sizeof(Log_record_header) || len > size - used) {
+                break;
+            }
+            used += len;
+        }
+    }
+    else {
+        const char *nul = (const char *)memchr(data, '\0', size);
+        used = nul != nullptr ? nul - data : size;
+    }
+    munmap(base, size);
+    if (used < size && ftruncate(fd, used) != 0) {
+        perror("ftruncate log segment");
+    }
+    ::close(fd);
+}
@@ -0,0 +1,97 @@
+/*
+预分配的日志段文件
+    * 每个段是固定大小的文件，创建时 fallocate 预分配并 mmap（MAP_POPULATE 预先建立页表），写入只是 memcpy
+    * 后台线程提前创建好下一个段（先用隐藏的临时文件名），当前段写满时只需交换指针并重命名；
+      写满的段由后台线程截断到实际长度、munmap 并关闭，切换不会阻塞写日志的线程
+    * 段文件名：路径 + 日期_日志名，同一天的后续段加后缀 .1、.2 ...，按日期切换时重新编号
+    * 不是线程安全的，调用方（Log）在持有 m_mutex 时使用
+    * 可以设置回调：切换到新段时调用 on_open，后台线程关闭写满的段后调用 on_close（用于压缩归档）
+    * 进程崩溃时段没有截断，末尾留下预分配的 '\0'；open 时把当天最新的段截断到实际写入的长度。
+      写入中的段持有 flock，热重启时不会截断旧进程正在写的段
+*/
+
+#ifndef LOG_FILE_H
+#define LOG_FILE_H
+
+#include <pthread.h>
+#include <stddef.h>
+#include <time.h>
+#include <string>
+#include <vector>
+#include "lock.h"
+
+class Log_file {
+public:
+    typedef void (*segment_cb)(const char *path, void *arg);
+
+    Log_file();
+    ~Log_file();
+
+    // 打开 dir + 日期_name 的第一个未使用的段，并启动后台线程
+    bool open(const char *dir, const char *name, const struct tm &day, size_t segment_size);
+    // 按日期切换到新的一组段
+    bool reopen(const struct tm &day);
+    // 切换到下一个段，后台线程尚未创建好时同步创建
+    bool next_segment();
+    // 当前段剩余的空间
+    size_t remaining() const {
+        return m_cur.base == nullptr ? 0 : m_cur.size - m_cur.used;
+    }
+    // 写入数据，当前段写满时切换到下一个段继续写
+    void write(const char *data, size_t n);
+    // 关闭当前段（截断到实际长度），删除预先创建的段，停止后台线程
+    void close();
+    // 设置段切换的回调，需在 open 之前调用
+    void set_callback(segment_cb on_open, segment_cb on_close, void *arg) {
+        m_on_open = on_open;
+        m_on_close = on_close;
+        m_cb_arg = arg;
+    }
+    // 正在写入的段的文件名
+    const std::string &path() const {
+        return m_cur.path;
+    }
+
+private:
+    struct Segment {
+        int fd;
+        char *base;
+        size_t size;
+        size_t used;
+        std::string path;
+    };
+
+    static void *worker(void *arg);
+    void run();
+    // 创建并映射一个临时段文件
+    bool create(Segment &seg);
+    // 将临时段重命名为当前日期的下一个段文件名
+    bool activate(Segment &seg);
+    // 截断到实际长度、解除映射并关闭
+    static void release(Segment &seg);
+    // 将当天最新的段截断到崩溃前实际写入的长度
+    void repair();
+
+private:
+    std::string m_dir;
+    std::string m_name;
+    std::string m_tmp_path; // 预先创建的段的临时文件名
+    char m_date[16]; // 当前的日期部分 YYYY_MM_DD_
+    int m_index; // 当天下一个段的编号
+    size_t m_segment_size;
+    Segment m_cur; // 正在写入的段
+    segment_cb m_on_open;
+    segment_cb m_on_close;
+    void *m_cb_arg;
+
+    Locker m_mutex; // 保护以下由后台线程访问的成员
+    Cond m_cond;
+    Segment m_next; // 预先创建好的段，base 为 nullptr 时尚未创建
+    bool m_want_next; // 需要后台线程创建下一个段
+    std::vector<Segment> m_retired; // 待后台线程关闭的段
+    bool m_stop;
+    bool m_running;
+    pthread_t m_tid;
+};
+
+#endif
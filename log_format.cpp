@@ -0,0 +1,242 @@
+#include <stdio.h>
+#include <time.h>
+#include <string>
+#include "log_format.h"
+
+// 从参数区读出下一个参数的类型标记，参数已用完或数据不完整时 type 为 0
+static const char *next_arg(const char *p, const char *end, char &type) {
+    type = 0;
+    if (p >= end) {
+        return p;
+    }
+    char t = *p;
+    if (t == LOG_ARG_STR ? p + 3 > end : p + 9 > end) {
+        return end;
+    }
+    type = t;
+    return p + 1;
+}
+
+// 跳过参数的数据部分
+static const char *skip_arg(char type, const char *p, const char *end) {
+    if (type == 0) {
+        return p;
+    }
+    if (type != LOG_ARG_STR) {
+        return p + 8;
+    }
+    uint16_t len;
+    memcpy(&len, p, sizeof(len));
+    p += sizeof(len);
+    return (size_t)(end - p) < len ? end : p + len;
+}
+
+// 读取 8 字节的数值参数，按目标类型转换
+static long long arg_int(char type, const char *p) {
+    if (type == LOG_ARG_DOUBLE) {
+        double d;
+        memcpy(&d, p, sizeof(d));
+        return (long long)d;
+    }
+    long long v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static double arg_double(char type, const char *p) {
+    if (type == LOG_ARG_DOUBLE) {
+        double d;
+        memcpy(&d, p, sizeof(d));
+        return d;
+    }
+    long long v;
+    memcpy(&v, p, sizeof(v));
+    return type == LOG_ARG_UINT ? (double)(unsigned long long)v : (double)v;
+}
+
+int log_format_args(char *out, int size, const char *format, const char *args, size_t args_len) {
+    if (size <= 0) {
+        return 0;
+    }
+    const char *arg = args;
+    const char *end = args + args_len;
+    int n = 0;
+    const char *f = format;
+    while (*f != '\0' && n < size - 1) {
+        if (*f != '%') {
+            out[n++] = *f++;
+            continue;
+        }
+        if (f[1] == '%') {
+            out[n++] = '%';
+            f += 2;
+            continue;
+        }
+
+        // 解析一个转换说明：标志、宽度、精度、长度修饰符、转换字符
+        char spec[48];
+        int s = 0;
+        spec[s++] = *f++;
+        while (*f != '\0' && strchr("-+ #0", *f) != nullptr && s < 8) {
+            spec[s++] = *f++;
+        }
+        for (int part = 0; part < 2; ++part) {
+            if (part == 1) {
+                if (*f != '.') {
+                    break;
+                }
+                spec[s++] = *f++;
+            }
+            if (*f == '*') {
+                // 宽度、精度由参数给出，替换为数字
+                char type;
+                arg = next_arg(arg, end, type);
+                long long v = 0;
+                if (type == LOG_ARG_INT || type == LOG_ARG_UINT) {
+                    v = arg_int(type, arg);
+                }
+                arg = skip_arg(type, arg, end);
+                s += snprintf(spec + s, 8, "%d", (int)v);
+                ++f;
+            }
+            else {
+                while (*f >= '0' && *f <= '9' && s < 20) {
+                    spec[s++] = *f++;
+                }
+            }
+        }
+        // 长度修饰符按参数的实际存储类型重新生成
+        while (*f != '\0' && strchr("hlLqjzt", *f) != nullptr) {
+            ++f;
+        }
+        char conv = *f;
+        if (conv == '\0') {
+            break;
+        }
+        ++f;
+
+        char type;
+        arg = next_arg(arg, end, type);
+        // 类型不匹配时也要跳过该参数，后面的参数才能对齐
+        const char *next = skip_arg(type, arg, end);
+        int room = size - n;
+        int m = 0;
+        switch (conv) {
+        case 'd': case 'i': case 'u': case 'o': case 'x': case 'X':
+            if (type != LOG_ARG_INT && type != LOG_ARG_UINT && type != LOG_ARG_DOUBLE) {
+                m = snprintf(out + n, room, "(?)");
+                break;
+            }
+            spec[s++] = 'l';
+            spec[s++] = 'l';
+            spec[s++] = conv;
+            spec[s] = '\0';
+            m = snprintf(out + n, room, spec, arg_int(type, arg));
+            break;
+        case 'c':
+            if (type != LOG_ARG_INT && type != LOG_ARG_UINT) {
+                m = snprintf(out + n, room, "(?)");
+                break;
+            }
+            spec[s++] = conv;
+            spec[s] = '\0';
+            m = snprintf(out + n, room, spec, (int)arg_int(type, arg));
+            break;
+        case 'e': case 'E': case 'f': case 'F': case 'g': case 'G': case 'a': case 'A':
+            if (type != LOG_ARG_INT && type != LOG_ARG_UINT && type != LOG_ARG_DOUBLE) {
+                m = snprintf(out + n, room, "(?)");
+                break;
+            }
+            spec[s++] = conv;
+            spec[s] = '\0';
+            m = snprintf(out + n, room, spec, arg_double(type, arg));
+            break;
+        case 's':
+            if (type != LOG_ARG_STR) {
+                m = snprintf(out + n, room, "(?)");
+                break;
+            }
+            {
+                uint16_t len;
+                memcpy(&len, arg, sizeof(len));
+                // 参数区中的字符串不以 '\0' 结尾，复制后再格式化
+                std::string str(arg + sizeof(len), next - arg - sizeof(len));
+                spec[s++] = conv;
+                spec[s] = '\0';
+                m = snprintf(out + n, room, spec, str.c_str());
+            }
+            break;
+        case 'p':
+            if (type != LOG_ARG_PTR) {
+                m = snprintf(out + n, room, "(?)");
+                break;
+            }
+            spec[s++] = conv;
+            spec[s] = '\0';
+            m = snprintf(out + n, room, spec, (void *)(uintptr_t)arg_int(type, arg));
+            break;
+        default:
+            // 不支持的转换（如 %n），原样输出
+            m = snprintf(out + n, room, "%%%c", conv);
+            break;
+        }
+        if (m < 0) {
+            m = 0;
+        }
+        n += m < room ? m : room - 1;
+        arg = next;
+    }
+    out[n] = '\0';
+    return n;
+}
+
+const Log_time &log_localtime(time_t sec) {
+    // sec 为 -1 保证第一次调用时格式化
+    static thread_local Log_time t_time = {-1, {}, {}, 0};
+    if (t_time.sec != sec) {
+        t_time.sec = sec;
+        localtime_r(&sec, &t_time.tm);
+        t_time.len = snprintf(t_time.text, sizeof(t_time.text), "%d-%02d-%02d %02d:%02d:%02d",
+                              t_time.tm.tm_year + 1900, t_time.tm.tm_mon + 1, t_time.tm.tm_mday,
+                              t_time.tm.tm_hour, t_time.tm.tm_min, t_time.tm.tm_sec);
+    }
+    return t_time;
+}
+
+int log_format_prefix(char *out, int size, int64_t usec, int level) {
+    static const char *const levels[] = {"[debug]:", "[info]:", "[warn]:", "[erro]:"};
+    // 日志分级
+    const char *s = level >= 0 && level <= 3 ? levels[level] : levels[1];
+    size_t slen = strlen(s);
+
+    const Log_time &t = log_localtime(usec / 1000000);
+    if ((size_t)size < t.len + 8 + slen + 2) {
+        return 0;
+    }
+    // 每行只追加微秒部分："YYYY-MM-DD HH:MM:SS.uuuuuu [info]: "
+    char *p = out;
+    memcpy(p, t.text, t.len);
+    p += t.len;
+    *p++ = '.';
+    int us = usec % 1000000;
+    for (int i = 5; i >= 0; --i) {
+        p[i] = '0' + us % 10;
+        us /= 10;
+    }
+    p += 6;
+    *p++ = ' ';
+    memcpy(p, s, slen);
+    p += slen;
+    *p++ = ' ';
+    return p - out;
+}
+
+int log_format_record(char *out, int size, int level, const char *format, const char *rec) {
+    Log_record_header h;
+    memcpy(&h, rec, sizeof(h));
+    int n = log_format_prefix(out, size, h.usec, level);
+    // 过长的日志被截断，保留换行符的位置
+    n += log_format_args(out + n, size - n - 1, format, rec + sizeof(h), h.len - sizeof(h));
+    out[n++] = '\n';
+    return n;
+}
@@ -0,0 +1,144 @@
+/*
+延迟格式化日志的记录格式，日志类和离线解码工具 log_decode 共用
+    * 调用线程只记录格式串编号、时间戳和参数的原始字节，格式化由后台线程或 log_decode 完成
+    * 一条记录：Log_record_header | 参数区
+      参数区中每个参数为 1 字节类型标记 + 数据：
+          LOG_ARG_INT / LOG_ARG_UINT / LOG_ARG_PTR：8 字节整数
+          LOG_ARG_DOUBLE：8 字节 double
+          LOG_ARG_STR：2 字节长度 + 字符串内容（不含 '\0'）
+    * 二进制日志文件：文件头 LOG_BINARY_MAGIC，之后为格式串定义记录和日志记录，
+      格式串定义记录的 id 为 LOG_DEF_ID，参数区为 4 字节格式串编号 + 1 字节日志级别 + 格式串
+*/
+
+#ifndef LOG_FORMAT_H
+#define LOG_FORMAT_H
+
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <type_traits>
+
+#define LOG_BINARY_MAGIC "THSBLOG1"
+#define LOG_BINARY_MAGIC_LEN 8
+// 格式串定义记录的编号
+#define LOG_DEF_ID 0xffffffffu
+// 单条记录的最大长度，过长的字符串参数会被截断
+#define LOG_RECORD_MAX 1024
+
+struct Log_record_header {
+    uint32_t len; // 整条记录的长度
+    uint32_t id; // 格式串编号
+    int64_t usec; // 时间戳（微秒）
+};
+
+enum LOG_ARG_TYPE {
+    LOG_ARG_INT = 'i',
+    LOG_ARG_UINT = 'u',
+    LOG_ARG_DOUBLE = 'd',
+    LOG_ARG_STR = 's',
+    LOG_ARG_PTR = 'p'
+};
+
+// 将参数按类型写入记录，空间不足时截断字符串或丢弃参数
+class Log_encoder {
+public:
+    Log_encoder(char *buf, size_t len, size_t cap) : m_buf(buf), m_len(len), m_cap(cap) {}
+
+    void put_int(long long v) {
+        put(LOG_ARG_INT, &v, sizeof(v));
+    }
+    void put_uint(unsigned long long v) {
+        put(LOG_ARG_UINT, &v, sizeof(v));
+    }
+    void put_double(double v) {
+        put(LOG_ARG_DOUBLE, &v, sizeof(v));
+    }
+    void put_ptr(const void *p) {
+        uint64_t v = (uintptr_t)p;
+        put(LOG_ARG_PTR, &v, sizeof(v));
+    }
+    void put_str(const char *s) {
+        if (s == nullptr) {
+            s = "(null)";
+        }
+        if (m_len + 3 > m_cap) {
+            return;
+        }
+        size_t n = strnlen(s, m_cap - m_len - 3);
+        uint16_t n16 = n;
+        m_buf[m_len++] = LOG_ARG_STR;
+        memcpy(m_buf + m_len, &n16, sizeof(n16));
+        memcpy(m_buf + m_len + sizeof(n16), s, n);
+        m_len += sizeof(n16) + n;
+    }
+    size_t len() const {
+        return m_len;
+    }
+
+private:
+    void put(char type, const void *v, size_t n) {
+        if (m_len + 1 + n > m_cap) {
+            return;
+        }
+        m_buf[m_len++] = type;
+        memcpy(m_buf + m_len, v, n);
+        m_len += n;
+    }
+
+private:
+    char *m_buf;
+    size_t m_len;
+    size_t m_cap;
+};
+
+// 按参数的静态类型选择编码方式
+template <typename T>
+inline typename std::enable_if<std::is_integral<T>::value || std::is_enum<T>::value>::type
+log_encode_arg(Log_encoder &e, T v) {
+    if (std::is_enum<T>::value || std::is_signed<T>::value) {
+        e.put_int((long long)v);
+    }
+    else {
+        e.put_uint((unsigned long long)v);
+    }
+}
+template <typename T>
+inline typename std::enable_if<std::is_floating_point<T>::value>::type
+log_encode_arg(Log_encoder &e, T v) {
+    e.put_double(v);
+}
+template <typename T>
+inline void log_encode_arg(Log_encoder &e, T *p) {
+    e.put_ptr(p);
+}
+inline void log_encode_arg(Log_encoder &e, const char *s) {
+    e.put_str(s);
+}
+inline void log_encode_arg(Log_encoder &e, char *s) {
+    e.put_str(s);
+}
+
+inline void log_encode_args(Log_encoder & /*e*/) {}
+template <typename T, typename... Args>
+inline void log_encode_args(Log_encoder &e, T v, Args... args) {
+    log_encode_arg(e, v);
+    log_encode_args(e, args...);
+}
+
+// 按 format 格式化参数区中的参数，返回写入的长度（不含结尾的 '\0'，超出 size 时截断）
+int log_format_args(char *out, int size, const char *format, const char *args, size_t args_len);
+// 按秒缓存的本地时间，每个线程一份：秒数变化时才调用 localtime_r 并重新格式化 "YYYY-MM-DD HH:MM:SS"
+struct Log_time {
+    time_t sec;
+    struct tm tm;
+    char text[32];
+    int len;
+};
+const Log_time &log_localtime(time_t sec);
+
+// 格式化日志的时间和级别前缀，返回写入的长度
+int log_format_prefix(char *out, int size, int64_t usec, int level);
+// 将一条记录格式化为一行文本（以换行结尾），返回写入的长度
+int log_format_record(char *out, int size, int level, const char *format, const char *rec);
+
+#endif
@@ -5,19 +5,8 @@
 #include <arpa/inet.h>
 
 #include "log.h"
-
-#define BUFFER_SIZE 64
-class util_timer;
-// 连接资源
-struct client_data {
-    // 客户端地址
-    struct sockaddr_in address;
-    // 与客户的连接的文件描述符
-    int sockfd;
-    char buf[BUFFER_SIZE];
-    // 相应定时器
-    util_timer *timer;
-};
+#include "slab_allocator.h"
+#include "conn_table.h"
 
 // 定时器类
 class util_timer {
@@ -26,14 +15,14 @@ public:
     // 超时时间
     time_t expire;
     // 回调函数：执行定时事件，这里是关闭非活跃连接
-    void (*cb_func) (client_data *);
-    // 连接资源
-    client_data *user_data;
+    void (*cb_func) (Conn_handle);
+    // 定时器所属的连接，连接关闭后句柄失效
+    Conn_handle handle;
     util_timer *prev, *next;
 };
 
 
-// 带头尾指针的升序双向链表
+// 带头尾指针的升序双向链表，定时器由链表自己的 slab 分配器分配（每个 reactor 一个链表）
 class sort_timer_lst {
 public:
     sort_timer_lst () : head(nullptr), tail(nullptr) {}
@@ -41,11 +30,20 @@ public:
         util_timer *tmp = head;
         while (tmp) {
             head = tmp->next;
-            delete tmp;
+            timer_slab.release(tmp);
             tmp = head;
         }
     }
 
+    // 分配一个定时器，由 del_timer 或 tick 回收
+    util_timer *create_timer() {
+        return timer_slab.alloc();
+    }
+    // 定时器分配器的占用统计
+    Slab_allocator<util_timer>::Stats stats() const {
+        return timer_slab.stats();
+    }
+
     // 添加计时器
     void add_timer(util_timer *timer) {
         if (timer == nullptr) {
@@ -103,7 +101,7 @@ public:
         }
         // 当链表中只有一个定时器时
         if (head != nullptr && head == tail) {
-            delete timer;
+            timer_slab.release(timer);
             head = tail = nullptr;
             return;
         }
@@ -111,20 +109,20 @@ public:
         if (timer == head) {
             head = head->next;
             head->prev = nullptr;
-            delete timer;
+            timer_slab.release(timer);
             return;
         }
         // 当链表中至少有两个定时器，且待删除节点为链表尾结点时
         if (timer == tail) {
             tail = tail->prev;
             tail->next = nullptr;
-            delete timer;
+            timer_slab.release(timer);
             return; 
         }
         // 如果目标定时器位于链表内部时
         timer->prev->next = timer->next;
         timer->next->prev = timer->prev;
-        delete timer;
+        timer_slab.release(timer);
     }
     
     /*
@@ -135,8 +133,7 @@ public:
             return;
         }
         // printf("timer tick\n");
-        LOG_INFO("%s", "timer tick");
-        Log::get_instance()->flush();
+        LOG_INFO_M(LOG_MODULE_TIMER, "%s", "timer tick");
         // 获取当前时间
         time_t cur = time(nullptr);
         util_timer *tmp = head;
@@ -148,15 +145,19 @@ public:
             }
 
             // 当前定时器到期，调用回调函数，执行定时事件
-            tmp->cb_func(tmp->user_data);
+            tmp->cb_func(tmp->handle);
             // 执行完定时器任务后，将该定时器从链表中删除，并重新设置头结点
             head = tmp->next;
             if (head) {
                 head->prev = nullptr;
             }
-            delete tmp;
+            timer_slab.release(tmp);
             tmp = head;
         }
+        Slab_allocator<util_timer>::Stats s = timer_slab.stats();
+        LOG_DEBUG_M(LOG_MODULE_TIMER, "timer slab: %lu in use, %lu capacity, peak %lu, %lu blocks",
+                    (unsigned long)s.in_use, (unsigned long)s.capacity, (unsigned long)s.peak,
+                    (unsigned long)s.blocks);
     }
 
 private:
@@ -184,6 +185,7 @@ private:
     }
 
     util_timer *head, *tail; // 指向链表头节点和尾节点；
+    Slab_allocator<util_timer> timer_slab;
 
 };
 
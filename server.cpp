@@ -10,19 +10,111 @@
 #include <signal.h>
 #include <errno.h>
 #include <time.h>
+#include <dirent.h>
+#include <limits.h>
+#include <sys/wait.h>
+#include <sys/stat.h>
+#include <string>
+#include <vector>
+#include <algorithm>
 #include "wrap.h"
 #include "lst_timer.h"
 #include "http_conn.h"
 #include "threadpool.h"
 #include "log.h"
+#include "user_store.h"
+#include "user_cache.h"
+#include "user_snapshot.h"
+#include "user_bloom.h"
+#include "session.h"
+#include "ip_limiter.h"
+#include "upstream.h"
+#include "sock_policy.h"
 
 #define SERVER_PORT 9999 
+// 额外监听的 Unix 域 socket 及其文件权限：同机的反向代理通过它转发请求，不经过 TCP 协议栈；注释掉则不监听
+// #define UNIX_SOCKET_PATH "/tmp/tinyhttp.sock"
+#define UNIX_SOCKET_MODE 0660
+// socket 选项（sock_policy.h）：监听队列长度（开启 TCP_DEFER_ACCEPT 时，还没有发送请求的连接也占用队列），
+// 监听 socket 的 TCP_DEFER_ACCEPT 秒数、TCP_FASTOPEN 队列长度（为 0 时不设置），
+// 客户连接的 TCP_NODELAY、写响应期间的 TCP_CORK，以及发送、接收缓冲区大小（为 0 时使用内核的自动调整）
+#define SOCK_BACKLOG 1024
+#define SOCK_DEFER_ACCEPT 5
+#define SOCK_FASTOPEN 256
+#define SOCK_NODELAY true
+#define SOCK_CORK false
+#define SOCK_SNDBUF 0
+#define SOCK_RCVBUF 0
 #define OPEN_FILES 10000 // 最大事件数
 #define FD_LIMIT 65536 // 最大文件描述符
 #define TIMESLOT 5
 
 #define SYNLOG // 同步写日志
 // #define ASYNLOG // 异步写日志
+// #define DEFERLOG // 异步写日志，由后台线程格式化
+// #define BINLOG // 异步写二进制日志，用 log_decode 解码
+// 日志写入预分配并 mmap 的固定大小段文件，写满后切换到后台提前创建的下一个段；为 0 时直接追加写文件
+#define LOG_SEGMENT_SIZE (16 * 1024 * 1024)
+// 写完的日志文件在后台压缩为 .gz，最多保留的文件数、天数，以及压缩时每秒读取的字节数；
+// 只处理清单（ServerLog.manifest）中服务器自己写过的文件
+#define LOG_KEEP_FILES 100
+#define LOG_KEEP_DAYS 30
+#define LOG_ARCHIVE_RATE (4 * 1024 * 1024)
+// 运行期的最低日志级别（LOG_LEVEL_DEBUG ~ LOG_LEVEL_OFF），以及按模块单独设置的级别
+#define LOG_MIN_LEVEL LOG_LEVEL_DEBUG
+#define HTTP_LOG_LEVEL LOG_LEVEL_DEBUG // 每个请求都会输出的连接、请求日志
+#define TIMER_LOG_LEVEL LOG_LEVEL_DEBUG
+#define POOL_LOG_LEVEL LOG_LEVEL_DEBUG
+#define ACCESS_LOG_LEVEL LOG_LEVEL_DEBUG
+// 访问日志：每个响应一条记录（ACCESS_OFF、ACCESS_CLF、ACCESS_JSON），成功的响应每 ACCESS_LOG_SAMPLE 条记录一条
+// 只需要访问日志时，可以把 HTTP_LOG_LEVEL 调高到 LOG_LEVEL_WARN
+#define ACCESS_LOG Http_conn::ACCESS_CLF
+#define ACCESS_LOG_SAMPLE 1
+// 每个事件都会执行的日志：读写事件的日志每秒最多输出的条数，调整定时器的日志每 N 次输出一次
+// 被丢弃的条数在定时任务中汇总输出
+#define EVENT_LOG_RATE 100
+#define TIMER_LOG_SAMPLE 100
+
+// 未启用 MySQL 时使用进程内用户表，注册的用户追加保存到该文件
+#define USER_FILE "users.txt"
+// 用户凭据缓存的最大用户数，以及启动时在后台预热的最近注册用户数
+#define USER_CACHE_SIZE 100000
+#define USER_PREWARM 10000
+// 需要全量用户表时，映射该快照文件并只从数据库载入增量，代替按需查询
+// #define USER_SNAPSHOT "user.snapshot"
+// 用户名布隆过滤器按该用户数设计容量，误判率约 1%；为 0 时不使用过滤器
+#define USER_BLOOM_CAPACITY 1000000
+// 登录会话的有效期（秒）
+#define SESSION_TTL 1800
+// 准入控制：工作线程数、请求队列的最大长度；请求的排队时间持续 ADMISSION_INTERVAL_US 以上
+// 超过 ADMISSION_TARGET_US 时判定为过载（为 0 时只按队列长度），主线程直接回复 503，
+// 并在 Retry-After 中建议客户端 RETRY_AFTER 秒后重试
+#define THREAD_NUM 8
+#define MAX_REQUESTS 10000
+#define ADMISSION_TARGET_US 5000
+#define ADMISSION_INTERVAL_US 100000
+#define RETRY_AFTER 1
+// 按客户端 IP 限制：最大并发连接数，每秒请求数及允许的突发请求数（为 0 时不限制），
+// 超出时回复 429；IP 表的槽数，记录数达到 3/4 后新的 IP 不受限制
+// 从同一台机器压测时需要调大或设为 0
+#define IP_MAX_CONNS 1000
+#define IP_RATE 1000
+#define IP_BURST 2000
+#define IP_TABLE_SIZE 65536
+// 反向代理：路径以 UPSTREAM_PREFIX 开头的请求由主线程转发到 UPSTREAM_BACKENDS（逗号分隔的 ip:port），
+// 按 UPSTREAM_POLICY（Upstream::ROUND_ROBIN 或 Upstream::LEAST_CONN）选择后端；注释掉则不转发
+// #define UPSTREAM_PREFIX "/api/"
+#define UPSTREAM_BACKENDS "127.0.0.1:8081,127.0.0.1:8082"
+#define UPSTREAM_POLICY Upstream::LEAST_CONN
+// 到所有后端的最大连接数，以及每个后端保留的空闲长连接数
+#define UPSTREAM_MAX_CONNS 1024
+#define UPSTREAM_KEEPALIVE 32
+// 热重启：收到 SIGUSR2（或 SIGHUP）时启动新的可执行文件，监听 socket 通过 fd 继承传给新进程（fd 号放在环境变量中），
+// 新进程就绪后旧进程停止 accept，处理完正在进行的请求、关闭空闲的长连接后退出，最多排空 DRAIN_TIMEOUT 秒
+#define LISTEN_FD_ENV "TINYHTTP_LISTEN_FD" // 逗号分隔的监听 socket 列表，新进程按地址与配置匹配
+#define READY_FD_ENV "TINYHTTP_READY_FD" // 新进程就绪时向该管道写一个字节
+#define LOG_KEEP_ENV "TINYHTTP_LOG_KEEP" // 旧进程正在写的日志文件，新进程不压缩、不删除
+#define DRAIN_TIMEOUT 30
 
 static int pipefd[2];
 static int epollfd = 0;
@@ -30,8 +122,32 @@ static bool stop_server = false;
 // 设置定时器相关参数
 // 基于升序链表的定时器容器
 static sort_timer_lst timer_lst;
+// 客户连接槽表：定时器、请求队列和 epoll 事件以 (槽号, 代数) 句柄引用连接
+static Conn_table<Http_conn> *conns = nullptr;
+// 按客户端 IP 的连接数限制和请求限速，只在主线程中使用
+static Ip_limiter *limiter = nullptr;
+// 反向代理，未配置时为 nullptr
+static Upstream *upstream = nullptr;
+// 监听 socket 和客户连接的 socket 选项
+static Sock_policy sock_policy;
 // 超时标志
 bool timeout = false;
+// 监听 socket：TCP 端口，以及可选的 Unix 域 socket，接受的连接由同一套 Http_conn 处理
+struct Listener {
+    int fd; // 排空时关闭，置为 -1
+    int family;
+    const char *path; // Unix 域 socket 的文件路径
+};
+#define MAX_LISTENERS 4
+static Listener listeners[MAX_LISTENERS];
+static int listener_num = 0;
+// 热重启状态
+static char exe_path[PATH_MAX]; // 启动时的可执行文件路径，热重启时执行该路径上的（新）文件
+static char **saved_argv;
+static pid_t child_pid = -1; // 正在启动的新进程
+static int ready_fd = -1; // 新进程就绪通知管道的读端
+static bool draining = false; // 已把监听 socket 交给新进程，正在排空连接
+static time_t drain_deadline = 0;
 
 
 extern void setnonblocking(int fd); 
@@ -42,6 +158,25 @@ extern void addfd(int epollfd, int fd, bool one_shot);
 // 定时处理任务
 void timer_handler() {
     timer_lst.tick();
+    // 清除过期的登录会话
+    Session_store::get_instance()->expire(time(nullptr));
+    // 清除不再有连接、令牌已补满的 IP 记录
+    int reaped = limiter->reap();
+    Ip_limiter::Stats ls = limiter->stats();
+    LOG_DEBUG_M(LOG_MODULE_HTTP, "ip limiter: %lu ips (%d reaped), %lld conn rejects, %lld rate rejects, %lld untracked",
+                (unsigned long)ls.size, reaped, ls.conn_rejects, ls.rate_rejects, ls.untracked);
+    if (upstream != nullptr) {
+        Upstream::Stats us = upstream->stats();
+        LOG_DEBUG_M(LOG_MODULE_HTTP, "upstream: %lld requests (%lld reused, %lld retries, %lld failures), "
+                    "%d active, %d idle connections", us.requests, us.reused, us.retries, us.failures,
+                    us.active, us.idle);
+    }
+    Slab_allocator<Http_buffer>::Stats s = Http_conn::buffer_stats();
+    LOG_DEBUG_M(LOG_MODULE_POOL, "http buffers: %lu in use, %lu capacity, peak %lu, %lu blocks",
+                (unsigned long)s.in_use, (unsigned long)s.capacity, (unsigned long)s.peak,
+                (unsigned long)s.blocks);
+    // 汇总被限流、采样丢弃的日志
+    Log::get_instance()->report_suppressed();
     // 因为一次alarm调用只会引起一次SIGALRM信号，索引要重新定时，以不断触发SIGALRM信号
     alarm(TIMESLOT);
 }
@@ -69,17 +204,82 @@ void add_sig(int sig_num, void (handler)(int), bool restart = true) {
 
 }
 
-// 定时器回调函数, 删除非活动连接
-void cb_func(client_data *user_data) {
+void cb_func(Conn_handle handle);
+
+/*
+    连接还在工作线程中（排队或正在处理）时不能回收：工作线程还会使用缓冲区、重新注册 fd 的事件。
+    先关闭 socket 的读写，工作线程的响应不再发出、重新注册后主线程收到 EPOLLHUP；
+    定时器改为下一个周期到期，到期时再次尝试关闭，直到工作线程交还连接
+*/
+void defer_close(Conn_handle handle) {
+    shutdown(conns->fd(handle), SHUT_RDWR);
+    util_timer *timer = conns->timer(handle);
+    if (timer) {
+        timer_lst.del_timer(timer);
+    }
+    // 定时器回调中调用时，新定时器的到期时间晚于当前时间，插在正在处理的定时器之后
+    timer = timer_lst.create_timer();
+    timer->handle = handle;
+    timer->cb_func = cb_func;
+    timer->expire = time(nullptr) + TIMESLOT;
+    conns->set_timer(handle, timer);
+    timer_lst.add_timer(timer);
+    LOG_DEBUG_M(LOG_MODULE_TIMER, "defer close fd: %d (in worker)", conns->fd(handle));
+}
+
+// 关闭连接：删除定时器，回收 fd、缓冲区和槽，之后该连接的句柄全部失效
+void close_conn(Conn_handle handle) {
+    Http_conn *conn = conns->get(handle);
+    if (conn == nullptr) {
+        return;
+    }
+    if (conn->in_worker()) {
+        defer_close(handle);
+        return;
+    }
+    int fd = conns->fd(handle);
     // 从内核事件表删除事件
-    epoll_ctl(epollfd, EPOLL_CTL_DEL, user_data->sockfd, 0);
+    epoll_ctl(epollfd, EPOLL_CTL_DEL, fd, 0);
     // 关闭文件描述符
-    close(user_data->sockfd);
+    close(fd);
+    // 正在转发的请求：关闭对应的上游连接
+    if (upstream != nullptr && conn->proxying()) {
+        upstream->abort(conn->upstream());
+    }
     // 减少连接数
     Http_conn::m_user_count--;
-    // printf("close fd: %d\n", user_data->sockfd);
-    LOG_INFO("close fd: %d", user_data->sockfd);
-    Log::get_instance()->flush();
+    if (conn->get_address()->sin_family == AF_INET) {
+        limiter->release(conn->get_address()->sin_addr.s_addr);
+    }
+    // 归还连接借用的读写缓冲区（读写出错时已经归还）
+    conn->release_buffer();
+    util_timer *timer = conns->timer(handle);
+    if (timer) {
+        timer_lst.del_timer(timer);
+    }
+    conns->close(handle);
+    LOG_INFO_M(LOG_MODULE_TIMER, "close fd: %d", fd);
+}
+
+// 连接上有数据传输，将定时器往后延迟3个单位，并调整新的定时器在链表上的位置
+void extend_timer(Conn_handle handle) {
+    util_timer *timer = conns->timer(handle);
+    if (timer) {
+        time_t cur = time(nullptr);
+        timer->expire = cur + 3 * TIMESLOT;
+        LOG_INFO_EVERY_N_M(LOG_MODULE_TIMER, TIMER_LOG_SAMPLE, "%s", "adjust timer once");
+        timer_lst.adjust_timer(timer);
+    }
+}
+
+// 定时器回调函数, 删除非活动连接
+void cb_func(Conn_handle handle) {
+    if (!conns->valid(handle)) {
+        return;
+    }
+    // 到期的定时器由 tick 回收，不再从链表中删除
+    conns->set_timer(handle, nullptr);
+    close_conn(handle);
 }
 
 // 向客户端发送错误信息
@@ -89,62 +289,411 @@ void show_error(int clientfd, const char *info) {
     close(clientfd);
 }
 
+// 接受一个新连接，为其分配槽和定时器；没有等待中的连接（或 accept 出错）时返回 false
+bool accept_conn(int listenfd) {
+    struct sockaddr_storage peer;
+    socklen_t peer_len = sizeof(peer);
+    int clientfd = accept(listenfd, (struct sockaddr *)&peer, &peer_len);
+    if (clientfd < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            LOG_ERROR("%s: errno is %d", "accept error", errno);
+        }
+        return false;
+    }
+    // Unix 域 socket 的连接没有 IP 地址，只记录地址族；它们来自同机的反向代理，不按 IP 限制
+    struct sockaddr_in client_addr;
+    if (peer.ss_family == AF_INET) {
+        memcpy(&client_addr, &peer, sizeof(client_addr));
+    }
+    else {
+        memset(&client_addr, 0, sizeof(client_addr));
+        client_addr.sin_family = peer.ss_family;
+    }
+    bool limited = client_addr.sin_family == AF_INET;
+    // 该 IP 的连接数已达上限：回复 429 后直接关闭，不分配槽
+    if (limited && !limiter->acquire(client_addr.sin_addr.s_addr)) {
+        char ip[INET_ADDRSTRLEN];
+        LOG_WARN_RATE_M(LOG_MODULE_HTTP, EVENT_LOG_RATE, "reject connection: too many connections from %s",
+                        inet_ntop(AF_INET, &client_addr.sin_addr, ip, sizeof(ip)));
+        Http_conn::send_reject(clientfd, 429);
+        close(clientfd);
+        return true;
+    }
+    Conn_handle handle;
+    if (!conns->open(clientfd, handle)) { // 服务器无法接收新的连接
+        if (limited) {
+            limiter->release(client_addr.sin_addr.s_addr);
+        }
+        // 向客户端发送错误信息
+        show_error(clientfd, "Internal server busy");
+        // 服务端
+        LOG_ERROR("%s", "Internal server busy");
+        return true;
+    }
+
+    Http_conn *conn = conns->get(handle);
+    conn->init(clientfd, client_addr, handle);
+    char ip[INET_ADDRSTRLEN];
+    LOG_INFO_M(LOG_MODULE_HTTP, "accept fd: %d (%s)", clientfd, conn->peer_name(ip, sizeof(ip)));
+
+    /* 
+    创建定时器，设置回调函数与超时时间，然后绑定定时器与用户数据，
+    最后将定时器添加到链表中
+    */
+    util_timer *timer = timer_lst.create_timer();
+    // 定时器以句柄引用连接
+    timer->handle = handle;
+    timer->cb_func = cb_func;
+    time_t cur = time(nullptr);
+    timer->expire = cur + 3 * TIMESLOT;
+    conns->set_timer(handle, timer);
+    // 将该定时器添加到链表上
+    timer_lst.add_timer(timer);
+    return true;
+}
+
+// 在热重启继承的 fd 中查找地址与配置相同的监听 socket，找到时从 inherited 中取出
+int take_inherited(std::vector<int> &inherited, int family, int port, const char *path) {
+    for (size_t i = 0; i < inherited.size(); ++i) {
+        struct sockaddr_storage addr;
+        socklen_t len = sizeof(addr);
+        if (getsockname(inherited[i], (struct sockaddr *)&addr, &len) != 0 || addr.ss_family != family) {
+            continue;
+        }
+        bool match = family == AF_INET ? ((struct sockaddr_in *)&addr)->sin_port == htons(port)
+                                       : strcmp(((struct sockaddr_un *)&addr)->sun_path, path) == 0;
+        if (match) {
+            int fd = inherited[i];
+            inherited.erase(inherited.begin() + i);
+            return fd;
+        }
+    }
+    return -1;
+}
+
+// 监听 TCP 端口，热重启时使用继承的 socket
+void add_tcp_listener(std::vector<int> &inherited, int port) {
+    int fd = take_inherited(inherited, AF_INET, port, nullptr);
+    if (fd >= 0) {
+        LOG_INFO("inherited listen fd %d (port %d)", fd, port);
+        // 新的配置对继承的 socket 同样生效，再次 listen 只更新队列长度
+        sock_policy.apply_listen(fd, AF_INET);
+        Listen(fd, sock_policy.backlog);
+    }
+    else {
+        struct sockaddr_in server_addr;
+        memset(&server_addr, 0, sizeof(server_addr));
+        server_addr.sin_family = AF_INET;
+        server_addr.sin_port = htons(port);
+        server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
+
+        fd = Socket(AF_INET, SOCK_STREAM, 0);
+        // 允许端口复用
+        int opt = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, (void*)&opt, sizeof(opt));
+        // 缓冲区大小要在 listen 之前设置，accept 的连接才能按它协商接收窗口
+        sock_policy.apply_listen(fd, AF_INET);
+
+        Bind(fd, (struct sockaddr*)&server_addr, sizeof(server_addr));
+        Listen(fd, sock_policy.backlog);
+    }
+    listeners[listener_num].fd = fd;
+    listeners[listener_num].family = AF_INET;
+    listeners[listener_num].path = nullptr;
+    ++listener_num;
+}
+
+// 监听 Unix 域 socket，文件权限为 mode；热重启时使用继承的 socket
+void add_unix_listener(std::vector<int> &inherited, const char *path, mode_t mode) {
+    int fd = take_inherited(inherited, AF_UNIX, 0, path);
+    if (fd >= 0) {
+        LOG_INFO("inherited listen fd %d (%s)", fd, path);
+        sock_policy.apply_listen(fd, AF_UNIX);
+        Listen(fd, sock_policy.backlog);
+    }
+    else {
+        struct sockaddr_un server_addr;
+        memset(&server_addr, 0, sizeof(server_addr));
+        server_addr.sun_family = AF_UNIX;
+        if (strlen(path) >= sizeof(server_addr.sun_path)) {
+            fprintf(stderr, "unix socket path too long: %s\n", path);
+            exit(1);
+        }
+        strcpy(server_addr.sun_path, path);
+
+        fd = Socket(AF_UNIX, SOCK_STREAM, 0);
+        sock_policy.apply_listen(fd, AF_UNIX);
+        // 删除上次运行遗留的 socket 文件，不删除其他类型的文件
+        struct stat st;
+        if (lstat(path, &st) == 0 && S_ISSOCK(st.st_mode)) {
+            unlink(path);
+        }
+        Bind(fd, (struct sockaddr*)&server_addr, sizeof(server_addr));
+        // 在 listen 之前修改权限，此前客户端无法连接
+        if (chmod(path, mode) != 0) {
+            perr_exit("chmod unix socket error");
+        }
+        Listen(fd, sock_policy.backlog);
+    }
+    listeners[listener_num].fd = fd;
+    listeners[listener_num].family = AF_UNIX;
+    listeners[listener_num].path = path;
+    ++listener_num;
+}
+
+// 事件的数据是否为某个监听 socket
+bool is_listener(uint64_t key) {
+    for (int i = 0; i < listener_num; ++i) {
+        if (listeners[i].fd >= 0 && key == (uint64_t)listeners[i].fd) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 热重启的新进程启动时调用：关闭从旧进程继承的 fd（客户连接、epoll 等），只保留监听 socket 和就绪通知管道
+void close_inherited_fds(const std::vector<int> &keep, int notify_fd) {
+    DIR *d = opendir("/proc/self/fd");
+    if (d == nullptr) {
+        return;
+    }
+    std::vector<int> fds;
+    struct dirent *ent;
+    while ((ent = readdir(d)) != nullptr) {
+        int fd = atoi(ent->d_name);
+        if (fd > 2 && fd != dirfd(d) && fd != notify_fd && std::find(keep.begin(), keep.end(), fd) == keep.end()) {
+            fds.push_back(fd);
+        }
+    }
+    closedir(d);
+    for (size_t i = 0; i < fds.size(); ++i) {
+        close(fds[i]);
+    }
+}
+
+/*
+    热重启：fork 并执行启动时的可执行文件路径（部署时已替换为新版本），
+    子进程继承监听 socket 和就绪通知管道的写端，旧进程继续 accept，直到子进程通知就绪
+*/
+void start_restart() {
+    if (draining || child_pid > 0) {
+        LOG_WARN("%s", "restart already in progress");
+        return;
+    }
+    int ready[2];
+    if (pipe2(ready, O_CLOEXEC) != 0) {
+        LOG_ERROR("%s: errno is %d", "restart pipe error", errno);
+        return;
+    }
+    // fork 之后、exec 之前只能调用异步信号安全的函数，环境变量在 fork 之前准备好
+    std::vector<std::string> vars;
+    for (char **e = environ; *e != nullptr; ++e) {
+        if (strncmp(*e, "TINYHTTP_", 9) != 0) {
+            vars.push_back(*e);
+        }
+    }
+    std::string fds;
+    for (int i = 0; i < listener_num; ++i) {
+        fds += (i > 0 ? "," : "") + std::to_string(listeners[i].fd);
+    }
+    vars.push_back(std::string(LISTEN_FD_ENV "=") + fds);
+    vars.push_back(std::string(READY_FD_ENV "=") + std::to_string(ready[1]));
+    vars.push_back(std::string(LOG_KEEP_ENV "=") + Log::get_instance()->path());
+    std::vector<char *> envp;
+    for (size_t i = 0; i < vars.size(); ++i) {
+        envp.push_back(&vars[i][0]);
+    }
+    envp.push_back(nullptr);
+
+    pid_t pid = fork();
+    if (pid < 0) {
+        LOG_ERROR("%s: errno is %d", "restart fork error", errno);
+        close(ready[0]);
+        close(ready[1]);
+        return;
+    }
+    if (pid == 0) {
+        // 监听 socket 没有设置 FD_CLOEXEC，管道写端需要清除
+        fcntl(ready[1], F_SETFD, 0);
+        execve(exe_path, saved_argv, &envp[0]);
+        _exit(127);
+    }
+    close(ready[1]);
+    child_pid = pid;
+    ready_fd = ready[0];
+    addfd(epollfd, ready_fd, false);
+    LOG_INFO("restart: started new process %d (%s)", pid, exe_path);
+}
+
+void close_if_idle(Conn_handle handle) {
+    if (conns->get(handle)->idle()) {
+        close_conn(handle);
+    }
+}
+
+/*
+    新进程已就绪：停止 accept 并排空连接。空闲的长连接立即关闭；
+    正在处理请求的连接在响应（带 Connection: close）发送完后关闭，连接全部关闭或超时后退出
+*/
+void begin_drain() {
+    draining = true;
+    drain_deadline = time(nullptr) + DRAIN_TIMEOUT;
+    // Unix 域 socket 的文件已由新进程使用，不删除
+    for (int i = 0; i < listener_num; ++i) {
+        epoll_ctl(epollfd, EPOLL_CTL_DEL, listeners[i].fd, 0);
+        close(listeners[i].fd);
+        listeners[i].fd = -1;
+    }
+    Http_conn::set_draining();
+    int busy = Http_conn::m_user_count;
+    conns->for_each(close_if_idle);
+    LOG_INFO("restart: new process %d is ready, draining %d connections (%d idle closed)", child_pid,
+             Http_conn::m_user_count, busy - Http_conn::m_user_count);
+}
+
+// 回收退出的子进程，启动中的新进程异常退出时旧进程继续服务
+void reap_children() {
+    int status;
+    pid_t pid;
+    while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+        if (pid == child_pid) {
+            LOG_ERROR("restart: new process %d exited with status %d", pid, status);
+            child_pid = -1;
+        }
+    }
+}
+
 int main(int argc, char *argv[]) {
+    // 热重启启动的新进程：继承监听 socket，先关闭其余继承的 fd
+    const char *inherited_fd = getenv(LISTEN_FD_ENV);
+    const char *notify_fd = getenv(READY_FD_ENV);
+    std::vector<int> inherited;
+    if (inherited_fd != nullptr) {
+        for (const char *p = inherited_fd; *p != '\0'; ) {
+            char *end;
+            long fd = strtol(p, &end, 10);
+            if (end == p) {
+                break;
+            }
+            inherited.push_back(fd);
+            p = *end == ',' ? end + 1 : end;
+        }
+        close_inherited_fds(inherited, notify_fd != nullptr ? atoi(notify_fd) : -1);
+    }
+    saved_argv = argv;
+    ssize_t len = readlink("/proc/self/exe", exe_path, sizeof(exe_path) - 1);
+    exe_path[len > 0 ? len : 0] = '\0';
+
+    Log::get_instance()->set_archive(LOG_KEEP_FILES, LOG_KEEP_DAYS, LOG_ARCHIVE_RATE, getenv(LOG_KEEP_ENV));
 #ifdef ASYNLOG
-    Log::get_instance()->init("ServerLog", 2000, 800000, 8); // 异步日志模型
+    Log::get_instance()->init("ServerLog", 2000, 800000, 512, 100, Log::TEXT, LOG_SEGMENT_SIZE); // 异步日志模型：每个线程缓冲 512 条日志
+#endif
+
+#ifdef DEFERLOG
+    Log::get_instance()->init("ServerLog", 2000, 800000, 512, 100, Log::DEFERRED, LOG_SEGMENT_SIZE);
+#endif
+
+#ifdef BINLOG
+    Log::get_instance()->init("ServerLog", 2000, 800000, 512, 100, Log::BINARY, LOG_SEGMENT_SIZE);
 #endif
 
 #ifdef SYNLOG
-    Log::get_instance()->init("ServerLog", 2000, 800000, 0); // 同步日志模型
+    Log::get_instance()->init("ServerLog", 2000, 800000, 0, 100, Log::TEXT, LOG_SEGMENT_SIZE); // 同步日志模型
 #endif
+    Log::get_instance()->set_level(LOG_MIN_LEVEL);
+    Log::get_instance()->set_level(HTTP_LOG_LEVEL, LOG_MODULE_HTTP);
+    Log::get_instance()->set_level(TIMER_LOG_LEVEL, LOG_MODULE_TIMER);
+    Log::get_instance()->set_level(POOL_LOG_LEVEL, LOG_MODULE_POOL);
+    Log::get_instance()->set_level(ACCESS_LOG_LEVEL, LOG_MODULE_ACCESS);
+    Http_conn::set_access_log(ACCESS_LOG, ACCESS_LOG_SAMPLE);
 
     if (argc != 1) {
         fprintf(stderr, "Usage: %s\n", argv[0]);
         exit(1);
     }
 
+    // 用户存储：用于登录和注册校验
+#ifdef USE_MYSQL
     // 创建数据库连接池
     Connection_pool *conn_pool = Connection_pool::get_instance();
     conn_pool->init("localhost", "root", "c51e1cdf9f068345", "learn", 3306, 8);
+#ifdef USER_SNAPSHOT
+    User_store *user_store = new Snapshot_user_store(new Mysql_user_store(conn_pool), USER_SNAPSHOT);
+#else
+    // 按需查询数据库，不在启动时全表扫描
+    User_store *user_store = new Cached_user_store(new Mysql_user_store(conn_pool), USER_CACHE_SIZE, USER_PREWARM);
+#endif
+#else
+    User_store *user_store = new Memory_user_store(USER_FILE);
+#endif
+#if USER_BLOOM_CAPACITY > 0
+    // 不存在的用户名由布隆过滤器直接拒绝
+    user_store = new Bloom_user_store(user_store, USER_BLOOM_CAPACITY);
+#endif
+
+    Session_store::get_instance()->init(SESSION_TTL);
+
+    // 存储客户链接数据
+   conns = new Conn_table<Http_conn>(FD_LIMIT);
 
     // 线程池
    Threadpool<Http_conn> *pool = NULL;
-   pool = new Threadpool<Http_conn>(conn_pool);
+   pool = new Threadpool<Http_conn>(conns, THREAD_NUM, MAX_REQUESTS);
    if (pool == nullptr) {
        fprintf(stderr, "[%d: %s] create threading pool failed\n", __LINE__, __FILE__);
        return 1;
    }
-
-    // 存储客户链接数据
-   Http_conn* users = new Http_conn[FD_LIMIT];
-   if (users == nullptr) {
-       fprintf(stderr, "[%d: %s] create users buffer failed", __LINE__, __FILE__);
+   pool->set_admission(ADMISSION_TARGET_US, ADMISSION_INTERVAL_US);
+   Http_conn::set_retry_after(RETRY_AFTER);
+   limiter = new Ip_limiter(IP_TABLE_SIZE, IP_MAX_CONNS, IP_RATE, IP_BURST);
+   // 载入用户数据
+   if (!Http_conn::init_user_store(user_store)) {
+       fprintf(stderr, "[%d: %s] init user store failed\n", __LINE__, __FILE__);
+       return 1;
    }
-   // 初始化数据库读取表
-   users->init_mysql_result(conn_pool);
 
-    int listenfd, clientfd, epollfd, ret;
+    int ret;
     struct epoll_event tmp_ep;
     struct epoll_event events[OPEN_FILES]; // 用于存储epoll文件描述符中就绪事件的数组
-    struct sockaddr_in server_addr;
-    server_addr.sin_family = AF_INET;
-    server_addr.sin_port = htons(SERVER_PORT);
-    server_addr.sin_addr.s_addr = htonl(INADDR_ANY);
-
-    listenfd = Socket(AF_INET, SOCK_STREAM, 0);
-    // 允许端口复用
-    int opt = 1;
-    setsockopt(listenfd, SOL_SOCKET, SO_REUSEADDR, (void*)&opt, sizeof(opt));
-    
-    Bind(listenfd, (struct sockaddr*)&server_addr, sizeof(server_addr));
-    Listen(listenfd, 128);
+
+    sock_policy.backlog = SOCK_BACKLOG;
+    sock_policy.defer_accept = SOCK_DEFER_ACCEPT;
+    sock_policy.fastopen = SOCK_FASTOPEN;
+    sock_policy.nodelay = SOCK_NODELAY;
+    sock_policy.cork = SOCK_CORK;
+    sock_policy.sndbuf = SOCK_SNDBUF;
+    sock_policy.rcvbuf = SOCK_RCVBUF;
+    Http_conn::set_sock_policy(sock_policy);
+    // 热重启时直接使用旧进程的监听 socket，端口始终在监听，没有拒绝连接的间隙
+    add_tcp_listener(inherited, SERVER_PORT);
+#ifdef UNIX_SOCKET_PATH
+    add_unix_listener(inherited, UNIX_SOCKET_PATH, UNIX_SOCKET_MODE);
+#endif
+    // 新的配置中不再使用的监听 socket
+    for (size_t i = 0; i < inherited.size(); ++i) {
+        LOG_INFO("close unused inherited listen fd %d", inherited[i]);
+        close(inherited[i]);
+    }
 
     epollfd = epoll_create(OPEN_FILES);
     if (epollfd < 0) {
         perr_exit("epoll_create");
     }
-    addfd(epollfd, listenfd, false);
+    for (int i = 0; i < listener_num; ++i) {
+        addfd(epollfd, listeners[i].fd, false);
+    }
     Http_conn::m_epollfd = epollfd;
+#ifdef UPSTREAM_PREFIX
+    Upstream::Client_ops ops;
+    ops.conns = conns;
+    ops.close = close_conn;
+    ops.touch = extend_timer;
+    upstream = new Upstream(epollfd, ops, UPSTREAM_MAX_CONNS, UPSTREAM_KEEPALIVE);
+    if (!upstream->add_route(UPSTREAM_PREFIX, UPSTREAM_BACKENDS, UPSTREAM_POLICY)) {
+        fprintf(stderr, "invalid upstream backends: %s\n", UPSTREAM_BACKENDS);
+        return 1;
+    }
+#endif
 
     // 统一事件源：处理信号的事件
     // 创建管道套接字
@@ -164,13 +713,24 @@ int main(int argc, char *argv[]) {
     add_sig(SIGTERM, sig_handler);
     add_sig(SIGINT, sig_handler);
     add_sig(SIGALRM, sig_handler);
+    add_sig(SIGUSR2, sig_handler);
     add_sig(SIGPIPE, SIG_IGN);
 
-    // 创建连接资源数组：存储每个用户与定时器有关的数据
-    client_data *users_timer = new client_data[FD_LIMIT];
     // 每隔TIMESLOT时间触发SIGALARM信号
     alarm(TIMESLOT);
 
+    // 初始化完成，通知旧进程停止 accept
+    if (notify_fd != nullptr) {
+        int fd = atoi(notify_fd);
+        if (write(fd, "1", 1) != 1) {
+            LOG_ERROR("%s: errno is %d", "restart notify error", errno);
+        }
+        close(fd);
+        unsetenv(LISTEN_FD_ENV);
+        unsetenv(READY_FD_ENV);
+        unsetenv(LOG_KEEP_ENV);
+    }
+
     while (!stop_server) {
         // 等待一组文件描述符上的事件，将就绪事件复制到events数组中
         ret = epoll_wait(epollfd, events, OPEN_FILES, -1);
@@ -182,49 +742,35 @@ int main(int argc, char *argv[]) {
         // et(events, ret, epollfd, listenfd);
         for (int i = 0; i < ret; ++i) // 遍历就绪事件
         {
-            int clientfd = events[i].data.fd;
-            if (clientfd == listenfd) {// 处理新的客户链接
-                struct sockaddr_in client_addr;
-                socklen_t client_addr_len = sizeof(client_addr);
-                clientfd = accept(listenfd, (struct sockaddr *)&client_addr, &client_addr_len);
-                if (clientfd < 0) {
-                    LOG_ERROR("%s: errno is %d", "accept error", errno);
-                }
-                if (Http_conn::m_user_count >= FD_LIMIT) { // 服务器无法接收新的连接
-                    // 向客户端发送错误信息
-                    show_error(clientfd, "Internal server busy");
-                    // 服务端
-                    LOG_ERROR("%s", "Internal server busy");
-                    continue;
+            // 客户连接的事件数据是槽表句柄，监听 socket 和管道的是 fd 本身
+            // 句柄已失效（连接已关闭）时 conn 为 nullptr，该事件被丢弃
+            uint64_t key = events[i].data.u64;
+            Conn_handle handle = Conn_handle::from_u64(key);
+            Http_conn *conn = Conn_handle::is_handle(key) ? conns->get(handle) : nullptr;
+            if (upstream != nullptr && Upstream::is_upstream_key(key)) { // 反向代理到后端的连接
+                upstream->on_event(key);
+            }
+            else if (is_listener(key)) {// 处理新的客户链接：监听 socket 为 ET 模式，一次接受所有等待中的连接
+                while (accept_conn((int)key)) {
                 }
-
-                users[clientfd].init(clientfd, client_addr);
-                
-                /* 
-                创建定时器，设置回调函数与超时时间，然后绑定定时器与用户数据，
-                最后将定时器添加到链表中
-               */
-                // 初始化该连接对应的连接资源
-                users_timer[clientfd].address = client_addr;
-                users_timer[clientfd].sockfd = clientfd;
-                util_timer *timer = new util_timer;
-                // 设置与定时器有关的连接资源
-                timer->user_data = &users_timer[clientfd];
-                timer->cb_func = cb_func;
-                time_t cur = time(nullptr);
-                timer->expire = cur + 3 * TIMESLOT;
-                users_timer[clientfd].timer = timer;
-                // 将该定时器添加到链表上
-                timer_lst.add_timer(timer);
             }
-            else if (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR)) { // 处理异常事件：服务器关闭连接，移除对应的定时器
-                util_timer *timer = users_timer[clientfd].timer;
-                timer->cb_func(&users_timer[clientfd]);
-                if (timer) {
-                    timer_lst.del_timer(timer);
+            else if (key == (uint64_t)ready_fd) { // 热重启的新进程就绪，或者在就绪前退出（管道关闭）
+                char c;
+                int n = read(ready_fd, &c, 1);
+                epoll_ctl(epollfd, EPOLL_CTL_DEL, ready_fd, 0);
+                close(ready_fd);
+                ready_fd = -1;
+                if (n == 1) {
+                    begin_drain();
+                }
+                else {
+                    LOG_ERROR("%s", "restart: new process exited before it was ready, keep serving");
                 }
             }
-            else if (clientfd == pipefd[0] && (events[i].events & EPOLLIN)) { // 处理信号：管道读端文件描述符发生读事件
+            else if (conn != nullptr && (events[i].events & (EPOLLRDHUP | EPOLLHUP | EPOLLERR))) { // 处理异常事件：服务器关闭连接，移除对应的定时器
+                close_conn(handle);
+            }
+            else if (key == (uint64_t)pipefd[0] && (events[i].events & EPOLLIN)) { // 处理信号：管道读端文件描述符发生读事件
                 char signals[1024];
                 int ret = read(pipefd[0], signals, sizeof(signals));
                 if (ret == -1)
@@ -239,11 +785,15 @@ int main(int argc, char *argv[]) {
                 {
                     for (int j = 0; j < ret; ++j)
                     {
-                        switch (signals[i])
+                        switch (signals[j])
                         {
                         case SIGCHLD:
+                            reap_children();
+                            break;
                         case SIGHUP:
-                            continue;
+                        case SIGUSR2:
+                            start_restart();
+                            break;
                         case SIGALRM:
                             timeout = true;
                             break;
@@ -254,52 +804,57 @@ int main(int argc, char *argv[]) {
                     }
                 }
             }
-            else if (events[i].events & EPOLLIN) { // 读事件：处理客户连接上接收到的数据
-                util_timer *timer = users_timer[clientfd].timer;
-                if (users[clientfd].read()) {
-                    LOG_INFO("deal with the client (%s)", inet_ntoa(users[clientfd].get_address()->sin_addr));
-                    Log::get_instance()->flush();
-                    // 检测到读事件，将事件放入请求队列
-                    pool->append(users+clientfd);
-                    /* 
-                        从客户端中可以读取数据，调整相应连接的定时器，从而延迟该连接
-                    */
-                    if (timer) {
-                        time_t cur = time(nullptr);
-                        timer->expire = cur + 3 * TIMESLOT;
-                        LOG_INFO("%s", "adjust timer once");
-                        Log::get_instance()->flush();
-                        timer_lst.adjust_timer(timer);
+            else if (upstream != nullptr && conn != nullptr && conn->proxying()) { // 正在转发请求的客户连接：由反向代理处理
+                upstream->on_client_event(handle);
+            }
+            else if (conn != nullptr && (events[i].events & EPOLLIN)) { // 读事件：处理客户连接上接收到的数据
+                // 每个请求只在收到第一批数据时计入速率，请求分多次到达时不重复计入
+                bool new_request = !conn->request_started();
+                if (conn->read()) {
+                    // peer_name 只在日志实际输出时调用
+                    char ip[INET_ADDRSTRLEN];
+                    LOG_INFO_RATE_M(LOG_MODULE_HTTP, EVENT_LOG_RATE, "deal with the client (%s)",
+                                    conn->peer_name(ip, sizeof(ip)));
+                    // 该 IP 超出请求速率：直接回复 429 并关闭连接
+                    if (new_request && conn->get_address()->sin_family == AF_INET
+                        && !limiter->allow_request(conn->get_address()->sin_addr.s_addr)) {
+                        LOG_WARN_RATE_M(LOG_MODULE_HTTP, EVENT_LOG_RATE, "reject request: rate limit exceeded by %s",
+                                        conn->peer_name(ip, sizeof(ip)));
+                        conn->reject(429);
+                        close_conn(handle);
+                        continue;
+                    }
+                    // 路径匹配反向代理的路由：由主线程转发，不进入请求队列
+                    if (upstream != nullptr && upstream->dispatch(handle)) {
+                        continue;
                     }
+                    // 检测到读事件，将事件放入请求队列；队列已满或过载时直接回复 503 并关闭连接
+                    Threadpool<Http_conn>::APPEND_CODE code = pool->append(handle);
+                    if (code != Threadpool<Http_conn>::APPEND_OK) {
+                        LOG_WARN_RATE_M(LOG_MODULE_POOL, EVENT_LOG_RATE, "reject request: %s",
+                                        code == Threadpool<Http_conn>::QUEUE_FULL ? "queue full" : "queue overloaded");
+                        conn->reject(503);
+                        close_conn(handle);
+                        continue;
+                    }
+                    // 从客户端中可以读取数据，调整相应连接的定时器，从而延迟该连接
+                    extend_timer(handle);
                 }
                 else { // 对方关闭连接或者读取数据时出错，关闭连接
-                    timer->cb_func(&users_timer[clientfd]);
-                    if (timer) {
-                        timer_lst.del_timer(timer);
-                    }
+                    close_conn(handle);
                 }
             }
-            else if (events[i].events & EPOLLOUT) { // EPOLLOUT：数据可写
-                util_timer *timer = users_timer[clientfd].timer;
-                if (users[clientfd].write()) {
-                    LOG_INFO("send data to the client(%s)", inet_ntoa(users[clientfd].get_address()->sin_addr));
-                    Log::get_instance()->flush();
-                   // 若有数据传输，将定时器往后延迟3个单位
-                   // 并对新的定时器在链表上的位置进行调整
-                   if (timer) {
-                       time_t cur = time(NULL);
-                       timer->expire = cur + 3 * TIMESLOT;
-                       LOG_INFO("%s", "adjust timer once");
-                       Log::get_instance()->flush();
-                       timer_lst.adjust_timer(timer);
-                   } 
+            else if (conn != nullptr && (events[i].events & EPOLLOUT)) { // EPOLLOUT：数据可写
+                if (conn->write()) {
+                    char ip[INET_ADDRSTRLEN];
+                    LOG_INFO_RATE_M(LOG_MODULE_HTTP, EVENT_LOG_RATE, "send data to the client(%s)",
+                                    conn->peer_name(ip, sizeof(ip)));
+                    // 若有数据传输，延迟该连接的定时器
+                    extend_timer(handle);
                 }
                 else {
                     // 服务器关闭连接：移除对应的定时器
-                    timer->cb_func(&users_timer[clientfd]);
-                    if (timer) {
-                        timer_lst.del_timer(timer);
-                    }
+                    close_conn(handle);
                 }
             }
         }
@@ -309,15 +864,31 @@ int main(int argc, char *argv[]) {
             timer_handler();
             timeout = false;
         }
+        // 排空：连接全部关闭或超时后退出
+        if (draining && (Http_conn::m_user_count == 0 || time(nullptr) >= drain_deadline)) {
+            LOG_INFO("restart: drained, %d connections left, exit", Http_conn::m_user_count);
+            stop_server = true;
+        }
     }
 
     close(epollfd);
-    close(listenfd);
+    for (int i = 0; i < listener_num; ++i) {
+        if (listeners[i].fd < 0) {
+            continue;
+        }
+        close(listeners[i].fd);
+        // 正常退出时删除 Unix 域 socket 文件（热重启排空时监听 socket 已关闭，文件由新进程使用）
+        if (listeners[i].family == AF_UNIX) {
+            unlink(listeners[i].path);
+        }
+    }
     close(pipefd[0]);
     close(pipefd[1]);
-    delete [] users;
-    delete[] users_timer;
+    delete upstream;
+    delete conns;
+    delete limiter;
     delete pool;
+    delete user_store;
 
     return 0;
 }
\ No newline at end of file
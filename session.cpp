@@ -0,0 +1,76 @@
+#include <string.h>
+#include <sys/random.h>
+#include "session.h"
+
+Session_store::Shard &Session_store::shard(const char *token) {
+    // token 本身是随机数，直接取第一个十六进制字符
+    char c = token[0];
+    int h = (c <= '9') ? c - '0' : (c | 0x20) - 'a' + 10;
+    return m_shards[h & (SHARD_NUM - 1)];
+}
+
+bool Session_store::create(const char *name, char *token) {
+    unsigned char bytes[TOKEN_LEN / 2];
+    if (getrandom(bytes, sizeof(bytes), 0) != sizeof(bytes)) {
+        return false;
+    }
+    static const char hex[] = "0123456789abcdef";
+    for (int i = 0; i < TOKEN_LEN / 2; ++i) {
+        token[2 * i] = hex[bytes[i] >> 4];
+        token[2 * i + 1] = hex[bytes[i] & 0xf];
+    }
+    token[TOKEN_LEN] = '\0';
+
+    Session session;
+    session.name = name;
+    session.expire = time(nullptr) + m_ttl;
+
+    Shard &s = shard(token);
+    s.mutex.lock();
+    s.sessions[token] = session;
+    s.order.push_back(token);
+    s.mutex.unlock();
+    return true;
+}
+
+bool Session_store::validate(const char *token) {
+    if (token == nullptr || strlen(token) != TOKEN_LEN) {
+        return false;
+    }
+    Shard &s = shard(token);
+    s.mutex.lock();
+    s.key.assign(token, TOKEN_LEN);
+    std::unordered_map<std::string, Session>::iterator it = s.sessions.find(s.key);
+    bool valid = it != s.sessions.end() && it->second.expire > time(nullptr);
+    s.mutex.unlock();
+    return valid;
+}
+
+void Session_store::expire(time_t now) {
+    for (int i = 0; i < SHARD_NUM; ++i) {
+        Shard &s = m_shards[i];
+        s.mutex.lock();
+        // 有效期固定，队头的会话最早过期
+        while (!s.order.empty()) {
+            std::unordered_map<std::string, Session>::iterator it = s.sessions.find(s.order.front());
+            if (it != s.sessions.end() && it->second.expire > now) {
+                break;
+            }
+            if (it != s.sessions.end()) {
+                s.sessions.erase(it);
+            }
+            s.order.pop_front();
+        }
+        s.mutex.unlock();
+    }
+}
+
+int Session_store::size() {
+    int n = 0;
+    for (int i = 0; i < SHARD_NUM; ++i) {
+        m_shards[i].mutex.lock();
+        n += m_shards[i].sessions.size();
+        m_shards[i].mutex.unlock();
+    }
+    return n;
+}
@@ -0,0 +1,64 @@
+/*
+会话存储：登录成功后发放随机 token（通过 Cookie 返回给浏览器），之后的请求凭 token 免去用户名密码校验
+    * 单例模式：静态局部变量懒汉模式创建
+    * 按 token 分片，每个分片一把锁，减少工作线程之间的锁竞争
+    * 会话有效期固定，每个分片中的会话按创建时间先后排列，
+      主线程的定时器（SIGALRM）周期性调用 expire 从队头清除过期会话
+*/
+
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <time.h>
+#include <string>
+#include <deque>
+#include <unordered_map>
+#include "lock.h"
+
+class Session_store {
+public:
+    // token 的十六进制长度
+    static const int TOKEN_LEN = 32;
+    // 分片数量，2 的幂
+    static const int SHARD_NUM = 16;
+
+    static Session_store *get_instance() {
+        static Session_store instance;
+        return &instance;
+    }
+
+    // 设置会话有效期（秒）
+    void init(int ttl) {
+        m_ttl = ttl;
+    }
+    // 为用户创建会话，token 写入 token（至少 TOKEN_LEN + 1 字节），失败返回 false
+    bool create(const char *name, char *token);
+    // 检查 token 是否对应一个未过期的会话
+    bool validate(const char *token);
+    // 清除所有过期的会话，由定时器调用
+    void expire(time_t now);
+    // 当前会话数量
+    int size();
+
+private:
+    Session_store() : m_ttl(1800) {}
+
+    struct Session {
+        std::string name;
+        time_t expire;
+    };
+    struct Shard {
+        Locker mutex;
+        std::unordered_map<std::string, Session> sessions;
+        std::deque<std::string> order; // 按创建时间排列的 token，用于过期清除
+        std::string key; // 查找时复用的 key，避免每次构造临时 string，由 mutex 保护
+    };
+
+    Shard &shard(const char *token);
+
+private:
+    int m_ttl;
+    Shard m_shards[SHARD_NUM];
+};
+
+#endif
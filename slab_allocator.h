@@ -0,0 +1,143 @@
+/*
+定长对象的 slab 分配器，用于定时器、连接读写缓冲区等频繁申请释放的对象
+    * 每次向系统申请一块可容纳 block_size 个对象的内存，块的起始地址按缓存行（64 字节）对齐，
+      块内的对象槽紧密排列（只按对象本身的对齐要求取整），同一块中的对象在内存中连续；
+      不把每个槽补齐到整条缓存行：定时器链表是顺序遍历的，补齐后同样多的节点占用更多缓存行，
+      1024 个定时器（40 字节）补齐到 64 字节后放不进 L1，抖动时慢了约 2 倍（make bench_timer）
+    * 空闲槽组成单链表（链表指针复用槽本身的空间），分配、释放都是 O(1) 的链表操作，
+      后进先出，刚释放的对象（仍在缓存中）最先被重新使用
+    * 申请的内存块在分配器析构前不归还系统
+    * persistent 模式：对象在所在的块申请时构造、在分配器析构时析构，alloc、release 不构造也不析构，
+      对象的状态在多次借用之间保留（如 Http_buffer 的 arena 保留的溢出块）；空闲对象放在单独的栈中，
+      不与对象本身的空间重叠
+    * 不是线程安全的：每个 reactor（主线程）一个分配器，只在该线程中使用
+*/
+
+#ifndef SLAB_ALLOCATOR_H
+#define SLAB_ALLOCATOR_H
+
+#include <stdlib.h>
+#include <stddef.h>
+#include <new>
+#include <vector>
+
+#define SLAB_CACHE_LINE 64
+
+template <typename T>
+class Slab_allocator {
+public:
+    // 占用统计
+    struct Stats {
+        size_t in_use; // 正在使用的对象数
+        size_t capacity; // 已申请的对象槽数
+        size_t peak; // in_use 的最大值
+        size_t blocks; // 已申请的内存块数
+    };
+
+    explicit Slab_allocator(size_t block_size = 1024, bool persistent = false) :
+        m_block_size(block_size > 0 ? block_size : 1), m_persistent(persistent), m_free(nullptr),
+        m_in_use(0), m_peak(0) {}
+    // 未释放的对象不调用析构函数，由调用者保证已全部释放；persistent 模式析构全部对象
+    ~Slab_allocator() {
+        for (size_t i = 0; i < m_blocks.size(); ++i) {
+            if (m_persistent) {
+                Slot *slots = static_cast<Slot *>(m_blocks[i]);
+                for (size_t j = 0; j < m_block_size; ++j) {
+                    reinterpret_cast<T *>(&slots[j])->~T();
+                }
+            }
+            free(m_blocks[i]);
+        }
+    }
+
+    // 分配一个对象并默认初始化（没有构造函数的类型不清零），内存不足时抛出 std::bad_alloc
+    // persistent 模式返回上次释放时的对象，不重新构造
+    T *alloc() {
+        if (m_persistent) {
+            if (m_idle.empty()) {
+                grow();
+            }
+            T *p = m_idle.back();
+            m_idle.pop_back();
+            if (++m_in_use > m_peak) {
+                m_peak = m_in_use;
+            }
+            return p;
+        }
+        if (m_free == nullptr) {
+            grow();
+        }
+        Slot *slot = m_free;
+        m_free = slot->next;
+        if (++m_in_use > m_peak) {
+            m_peak = m_in_use;
+        }
+        return new (slot) T;
+    }
+
+    // 析构并回收对象，p 必须由本分配器分配；persistent 模式不析构
+    void release(T *p) {
+        if (p == nullptr) {
+            return;
+        }
+        --m_in_use;
+        if (m_persistent) {
+            // 容量在 grow 中预留，不会分配
+            m_idle.push_back(p);
+            return;
+        }
+        p->~T();
+        Slot *slot = reinterpret_cast<Slot *>(p);
+        slot->next = m_free;
+        m_free = slot;
+    }
+
+    Stats stats() const {
+        Stats s;
+        s.in_use = m_in_use;
+        s.capacity = m_blocks.size() * m_block_size;
+        s.peak = m_peak;
+        s.blocks = m_blocks.size();
+        return s;
+    }
+
+private:
+    // 对象槽：空闲时保存下一个空闲槽
+    union Slot {
+        Slot *next;
+        unsigned char data[sizeof(T)];
+    };
+
+    // 申请一块新内存，所有槽按地址顺序加入空闲链表
+    void grow() {
+        m_blocks.reserve(m_blocks.size() + 1);
+        void *mem = nullptr;
+        if (posix_memalign(&mem, SLAB_CACHE_LINE, m_block_size * sizeof(Slot)) != 0) {
+            throw std::bad_alloc();
+        }
+        m_blocks.push_back(mem);
+        Slot *slots = static_cast<Slot *>(mem);
+        if (m_persistent) {
+            m_idle.reserve(m_blocks.size() * m_block_size);
+            for (size_t i = m_block_size; i > 0; --i) {
+                m_idle.push_back(new (&slots[i - 1]) T);
+            }
+            return;
+        }
+        for (size_t i = m_block_size; i > 0; --i) {
+            slots[i - 1].next = m_free;
+            m_free = &slots[i - 1];
+        }
+    }
+
+private:
+    size_t m_block_size; // 每块的对象数
+    bool m_persistent;
+    Slot *m_free; // 空闲链表
+    std::vector<T *> m_idle; // persistent 模式的空闲对象
+    size_t m_in_use;
+    size_t m_peak;
+    std::vector<void *> m_blocks;
+};
+
+#endif
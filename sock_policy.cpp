@@ -0,0 +1,57 @@
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <errno.h>
+#include "sock_policy.h"
+#include "log.h"
+
+// 设置一个整数选项，失败时输出日志并返回 false
+static bool set_int(int fd, int level, int name, int value, const char *what) {
+    if (setsockopt(fd, level, name, &value, sizeof(value)) != 0) {
+        LOG_WARN("setsockopt %s on fd %d failed: errno is %d", what, fd, errno);
+        return false;
+    }
+    return true;
+}
+
+int Sock_policy::apply_listen(int fd, int family) const {
+    int failed = 0;
+    if (sndbuf > 0 && !set_int(fd, SOL_SOCKET, SO_SNDBUF, sndbuf, "SO_SNDBUF")) {
+        ++failed;
+    }
+    if (rcvbuf > 0 && !set_int(fd, SOL_SOCKET, SO_RCVBUF, rcvbuf, "SO_RCVBUF")) {
+        ++failed;
+    }
+    if (family != AF_INET) {
+        return failed;
+    }
+    if (defer_accept > 0 && !set_int(fd, IPPROTO_TCP, TCP_DEFER_ACCEPT, defer_accept, "TCP_DEFER_ACCEPT")) {
+        ++failed;
+    }
+    if (fastopen > 0 && !set_int(fd, IPPROTO_TCP, TCP_FASTOPEN, fastopen, "TCP_FASTOPEN")) {
+        ++failed;
+    }
+    return failed;
+}
+
+// 缓冲区大小已从监听 socket 继承，这里只设置 TCP_NODELAY
+void Sock_policy::apply_accept(int fd, int family) const {
+    if (family == AF_INET && nodelay) {
+        set_int(fd, IPPROTO_TCP, TCP_NODELAY, 1, "TCP_NODELAY");
+    }
+}
+
+void Sock_policy::begin_write(int fd, int family) const {
+    if (family == AF_INET && cork) {
+        int on = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_CORK, &on, sizeof(on));
+    }
+}
+
+// 取消 TCP_CORK 时立即发出剩余的数据
+void Sock_policy::end_write(int fd, int family) const {
+    if (family == AF_INET && cork) {
+        int off = 0;
+        setsockopt(fd, IPPROTO_TCP, TCP_CORK, &off, sizeof(off));
+    }
+}
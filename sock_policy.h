@@ -0,0 +1,42 @@
+/*
+socket 选项策略：监听 socket 在 listen 之前（热重启继承的监听 socket 在启动时）、客户连接在 accept 之后
+按同一份配置设置，服务器中不再零散地调用 setsockopt
+    * TCP_DEFER_ACCEPT：连接收到第一段数据后才进入 accept 队列，主线程不会为还没有发送请求的连接醒来；
+      超过设置的秒数仍没有数据时，内核照常完成连接。等待数据的连接留在半连接队列中，
+      队列长度受 listen 的 backlog 限制，backlog 太小时突发的连接被丢弃、靠重传才能建立
+    * TCP_FASTOPEN：允许客户端在 SYN 中携带请求，省去一次往返；还需要内核开启服务端 TFO
+      （net.ipv4.tcp_fastopen 包含 2），否则该选项不起作用
+    * TCP_NODELAY：关闭 Nagle 算法，响应的最后一个不满的报文段不等待之前报文的确认
+    * TCP_CORK：写一个响应期间设置，响应写完后取消：响应头和文件内容合并成满的报文段，
+      写缓冲区满而分多次写出时也不会发出零碎的小报文段
+    * SO_SNDBUF、SO_RCVBUF：设置在监听 socket 上，由 accept 的连接继承（接收窗口的扩大因子在握手时确定，
+      连接建立后再调大接收缓冲区无效）；为 0 时使用内核的自动调整。固定的缓冲区会关闭自动调整，
+      发送缓冲区太小时大的响应要等客户端延迟发送的确认才能继续写，每个响应可能停顿几十毫秒
+    * Unix 域 socket 只设置缓冲区大小，其余是 TCP 的选项
+*/
+
+#ifndef SOCK_POLICY_H
+#define SOCK_POLICY_H
+
+struct Sock_policy {
+    Sock_policy() :
+        backlog(128), defer_accept(0), fastopen(0), nodelay(false), cork(false), sndbuf(0), rcvbuf(0) {}
+
+    // 设置监听 socket，在 listen 之前调用，也可以对已经在监听的 socket 调用；返回设置失败的选项数
+    int apply_listen(int fd, int family) const;
+    // 设置 accept 返回的客户连接
+    void apply_accept(int fd, int family) const;
+    // 开始、结束写一个响应：cork 开启时设置、取消 TCP_CORK，否则不做任何事
+    void begin_write(int fd, int family) const;
+    void end_write(int fd, int family) const;
+
+    int backlog; // listen 的队列长度，由调用者传给 listen
+    int defer_accept; // TCP_DEFER_ACCEPT 的秒数，0 表示不设置
+    int fastopen; // TCP_FASTOPEN 的队列长度，0 表示不开启
+    bool nodelay;
+    bool cork;
+    int sndbuf; // 字节数，0 表示不设置
+    int rcvbuf;
+};
+
+#endif
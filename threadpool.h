@@ -1,49 +1,93 @@
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
-#include <list>
+#include <time.h>
 #include "lock.h"
-#include "sql_connection_pool.h"
+#include "conn_table.h"
 
 template <typename T>
 class Threadpool {
 public:
     /*
-        conn_pool：数据库连接池指针
+        table：连接槽表，任务以句柄引用其中的连接
         thread_num：线程池中线程数量
         max_requests：请求队列中最多运行的、等待处理的请求的数量
     */
-    Threadpool(Connection_pool *conn_pool, int thread_num = 8, int max_requests = 10000);
+    Threadpool(Conn_table<T> *table, int thread_num = 8, int max_requests = 10000);
     ~Threadpool();
-    // 往请求队列中添加任务
-    bool append(T *request);
+
+    // append 的结果
+    enum APPEND_CODE {
+        APPEND_OK = 0,
+        QUEUE_FULL, // 队列长度达到 max_requests
+        QUEUE_OVERLOADED // 排队时间持续超过目标值
+    };
+    /*
+        准入控制（CoDel 方式）：工作线程取出请求时计算其排队时间，排队时间连续 interval_us 以上
+        都不低于 target_us 时判定为过载，append 拒绝新的请求，直到取出的请求排队时间回落到
+        target_us 以下或队列被取空；被拒绝的请求由调用者直接回复 503，排队时间因此保持在
+        target_us 附近，而不是随队列长度增长。target_us 为 0 时只按队列长度拒绝
+    */
+    void set_admission(long long target_us, long long interval_us);
+    /*
+        往请求队列中添加任务，队列已满或过载时不添加；添加成功时调用连接的 enter_worker，
+        工作线程处理完后调用 leave_worker，在此期间主线程不回收该连接
+    */
+    APPEND_CODE append(Conn_handle request);
 private:
     // 工作线程运行的函数，它不断从工作队列中取出任务并执行
     static void *worker(void *arg);
     void run();
+    static long long now_us() {
+        struct timespec ts;
+        clock_gettime(CLOCK_MONOTONIC, &ts);
+        return ts.tv_sec * 1000000LL + ts.tv_nsec / 1000;
+    }
 
 private:
     int m_thread_num; // 线程池中的线程数
     int m_max_requests; // 请求队列中运行的最大请求数量
     pthread_t *m_threads; // 线程池数组，大小为 thread_num
-    std::list<T*> m_workqueue; // 请求队列
+    Conn_table<T> *m_table;
+    // 队列中的请求：连接句柄和入队时间（单调时钟，微秒）
+    struct Task {
+        Conn_handle handle;
+        long long enqueue_us;
+    };
+    // 请求队列：容量为 max_requests 的环形数组，入队、出队不分配内存
+    Task *m_workqueue;
+    int m_queue_head; // 队头下标
+    int m_queue_size; // 队列中的请求数
     Locker m_queuelocker; // 保护请求队列的互斥锁
     Sem m_queuestat; // 是否有任务需要处理
     bool m_stop; // 是否结束线程
-    Connection_pool *m_conn_pool; // 数据库连接池指针
+    // 准入控制状态，由 m_queuelocker 保护
+    long long m_target_us;
+    long long m_interval_us;
+    long long m_above_since; // 排队时间开始持续超过目标值的时间，0 表示当前未超过
+    bool m_overloaded;
 };
 
 template <typename T>
-Threadpool<T>::Threadpool(Connection_pool *conn_pool, int thread_num, int max_requests) : 
-    m_conn_pool(conn_pool),
+Threadpool<T>::Threadpool(Conn_table<T> *table, int thread_num, int max_requests) : 
     m_thread_num(thread_num), 
     m_max_requests(max_requests), 
     m_stop(false), 
-    m_threads(nullptr) {
+    m_threads(nullptr),
+    m_table(table),
+    m_workqueue(nullptr),
+    m_queue_head(0),
+    m_queue_size(0),
+    m_target_us(0),
+    m_interval_us(0),
+    m_above_since(0),
+    m_overloaded(false) {
 
     if ( (m_thread_num <= 0) || (m_max_requests <= 0)) {
         throw std::exception();
     }
 
+    m_workqueue = new Task[m_max_requests];
+
     m_threads = new pthread_t[m_thread_num];
     if (m_threads == nullptr) {
         throw std::exception();
@@ -54,11 +98,13 @@ Threadpool<T>::Threadpool(Connection_pool *conn_pool, int thread_num, int max_re
         printf("create the %dth thread\n", i);
         if (pthread_create(m_threads+i, NULL, worker, this) != 0) {
             delete [] m_threads;
+            delete [] m_workqueue;
             throw std::exception();
         }
         // 线程分离
         if (pthread_detach(m_threads[i])) {
             delete [] m_threads;
+            delete [] m_workqueue;
             throw std::exception();
         }
     }
@@ -68,21 +114,41 @@ Threadpool<T>::Threadpool(Connection_pool *conn_pool, int thread_num, int max_re
 template <typename T>
 Threadpool<T>::~Threadpool() {
     delete [] m_threads;
+    delete [] m_workqueue;
     m_stop = true;
 }
 
 template <typename T>
-bool Threadpool<T>::append(T *request) {
+void Threadpool<T>::set_admission(long long target_us, long long interval_us) {
+    m_queuelocker.lock();
+    m_target_us = target_us > 0 ? target_us : 0;
+    m_interval_us = interval_us > 0 ? interval_us : 0;
+    m_above_since = 0;
+    m_overloaded = false;
+    m_queuelocker.unlock();
+}
+
+template <typename T>
+typename Threadpool<T>::APPEND_CODE Threadpool<T>::append(Conn_handle request) {
     // 操作工作队列时要加锁
     m_queuelocker.lock();
-    if (m_workqueue.size() > m_max_requests) {
+    if (m_queue_size >= m_max_requests) {
         m_queuelocker.unlock();
-        return false;
+        return QUEUE_FULL;
     }
-    m_workqueue.push_back(request);
+    if (m_overloaded) {
+        m_queuelocker.unlock();
+        return QUEUE_OVERLOADED;
+    }
+    // 在工作线程能取出任务之前标记
+    m_table->get(request)->enter_worker();
+    Task &task = m_workqueue[(m_queue_head + m_queue_size) % m_max_requests];
+    task.handle = request;
+    task.enqueue_us = m_target_us > 0 ? now_us() : 0;
+    ++m_queue_size;
     m_queuelocker.unlock();
     m_queuestat.post();
-    return true;
+    return APPEND_OK;
 }
 
 template <typename T>
@@ -97,18 +163,37 @@ void Threadpool<T>::run() {
     while (!m_stop) {
         m_queuestat.wait();
         m_queuelocker.lock();
-        if (m_workqueue.empty()) {
+        if (m_queue_size == 0) {
             m_queuelocker.unlock();
             continue;
         }
-        T *request = m_workqueue.front();
-        m_workqueue.pop_front();
+        Task task = m_workqueue[m_queue_head];
+        m_queue_head = (m_queue_head + 1) % m_max_requests;
+        --m_queue_size;
+        if (m_target_us > 0) {
+            long long now = now_us();
+            if (now - task.enqueue_us < m_target_us || m_queue_size == 0) {
+                // 排队时间回落或队列已取空，解除过载
+                m_above_since = 0;
+                m_overloaded = false;
+            }
+            else if (m_above_since == 0) {
+                m_above_since = now;
+            }
+            else if (now - m_above_since >= m_interval_us) {
+                m_overloaded = true;
+            }
+        }
         m_queuelocker.unlock();
+        Conn_handle handle = task.handle;
+        // 主线程在任务交还前不回收连接，句柄不会过期；仍然检查，防止作用到复用了槽的新连接
+        T *request = m_table->get(handle);
         if (!request) {
             continue;
         }
-        ConnectionRAII mysql_conn(&request->mysql, m_conn_pool);
         request->process();
+        // 交还之后不能再访问连接对象：主线程随时可能回收它
+        request->leave_worker();
     }
 }
 
@@ -0,0 +1,848 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <sys/epoll.h>
+#include <sys/uio.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include "upstream.h"
+#include "http_conn.h"
+#include "log.h"
+
+extern void addfd(int epollfd, int fd, bool one_shot, uint64_t key);
+extern void modfd(int epollfd, int fd, int ev, uint64_t key);
+
+// 每次 splice 的最大字节数，与管道的默认容量相同
+#define PIPE_CHUNK 65536
+
+// 请求、响应中不转发的逐跳头部，Connection 由代理按两端各自的情况重新生成
+static const char *const hop_headers[] = {"Connection", "Keep-Alive", "Proxy-Connection", "TE", "Trailer", "Upgrade"};
+
+// 在 [p, end) 中查找字符串 s，找不到时返回 nullptr
+static const char *find(const char *p, const char *end, const char *s) {
+    if (p >= end) {
+        return nullptr;
+    }
+    return static_cast<const char *>(memmem(p, end - p, s, strlen(s)));
+}
+
+// 头部行 [line, eol) 的名称是否为 name，是时 value 指向去掉前导空白的值
+static bool header_is(const char *line, const char *eol, const char *name, const char **value) {
+    int len = strlen(name);
+    if (eol - line <= len || line[len] != ':' || strncasecmp(line, name, len) != 0) {
+        return false;
+    }
+    const char *v = line + len + 1;
+    while (v < eol && (*v == ' ' || *v == '\t')) {
+        ++v;
+    }
+    *value = v;
+    return true;
+}
+
+static bool is_hop_header(const char *line, const char *eol) {
+    const char *value;
+    for (size_t i = 0; i < sizeof(hop_headers) / sizeof(hop_headers[0]); ++i) {
+        if (header_is(line, eol, hop_headers[i], &value)) {
+            return true;
+        }
+    }
+    return false;
+}
+
+// 逗号分隔的头部值 [value, eol) 中是否有 token（不区分大小写），按逗号切分、去掉空白后整个比较
+static bool has_token(const char *value, const char *eol, const char *token) {
+    int len = strlen(token);
+    const char *p = value;
+    while (p < eol) {
+        const char *end = static_cast<const char *>(memchr(p, ',', eol - p));
+        if (end == nullptr) {
+            end = eol;
+        }
+        const char *b = p, *e = end;
+        while (b < e && (*b == ' ' || *b == '\t')) {
+            ++b;
+        }
+        while (e > b && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r')) {
+            --e;
+        }
+        if (e - b == len && strncasecmp(b, token, len) == 0) {
+            return true;
+        }
+        p = end + 1;
+    }
+    return false;
+}
+
+// 解析 Content-Length 的值，格式错误时返回 -1
+static long long parse_length(const char *value, const char *eol) {
+    long long n = 0;
+    const char *p = value;
+    for (; p < eol && *p >= '0' && *p <= '9'; ++p) {
+        if (n > (LLONG_MAX - 9) / 10) {
+            return -1;
+        }
+        n = n * 10 + (*p - '0');
+    }
+    return p == value ? -1 : n;
+}
+
+// 向 buf[*n, size) 追加 [p, p + len)，空间不足时返回 false
+static bool append(char *buf, int size, int *n, const char *p, int len) {
+    if (*n + len >= size) {
+        return false;
+    }
+    memcpy(buf + *n, p, len);
+    *n += len;
+    return true;
+}
+
+Upstream::Upstream(int epollfd, const Client_ops &ops, int max_conns, int keepalive) :
+    m_epollfd(epollfd),
+    m_ops(ops),
+    m_keepalive(keepalive > 0 ? keepalive : 0),
+    m_conns(max_conns),
+    m_requests(0),
+    m_reused(0),
+    m_retries(0),
+    m_failures(0),
+    m_active(0),
+    m_idle(0) {
+}
+
+Upstream::~Upstream() {
+    m_conns.for_each([this](Conn_handle h) { close_conn(h); });
+}
+
+bool Upstream::add_route(const char *prefix, const char *backends, POLICY policy) {
+    Route route;
+    route.prefix = prefix;
+    route.policy = policy;
+    route.next = 0;
+    std::string list(backends);
+    size_t pos = 0;
+    while (pos < list.size()) {
+        size_t comma = list.find(',', pos);
+        if (comma == std::string::npos) {
+            comma = list.size();
+        }
+        std::string item = list.substr(pos, comma - pos);
+        pos = comma + 1;
+        size_t colon = item.rfind(':');
+        if (colon == std::string::npos) {
+            return false;
+        }
+        Backend be;
+        memset(&be.addr, 0, sizeof(be.addr));
+        be.addr.sin_family = AF_INET;
+        int port = atoi(item.c_str() + colon + 1);
+        if (port <= 0 || port > 65535 || inet_pton(AF_INET, item.substr(0, colon).c_str(), &be.addr.sin_addr) != 1) {
+            return false;
+        }
+        be.addr.sin_port = htons(port);
+        snprintf(be.name, sizeof(be.name), "%s", item.c_str());
+        be.active = 0;
+        be.down_until = 0;
+        route.backends.push_back(m_backends.size());
+        m_backends.push_back(be);
+    }
+    if (route.backends.empty()) {
+        return false;
+    }
+    m_routes.push_back(route);
+    return true;
+}
+
+uint64_t Upstream::tag(Conn_handle h) {
+    h.slot |= UPSTREAM_TAG;
+    return h.to_u64();
+}
+
+bool Upstream::is_upstream_key(uint64_t key) {
+    return Conn_handle::is_handle(key) && (Conn_handle::from_u64(key).slot & UPSTREAM_TAG) != 0;
+}
+
+void Upstream::arm(int fd, int ev, uint64_t key) {
+    modfd(m_epollfd, fd, ev, key);
+}
+
+// 跳过暂停选择的后端；全部暂停时仍按轮询选择，连接失败由调用者回复 502
+int Upstream::select_backend(Route &route) {
+    time_t now = time(nullptr);
+    int n = route.backends.size();
+    int best = -1;
+    for (int i = 0; i < n; ++i) {
+        int b = route.backends[(route.next + i) % n];
+        if (m_backends[b].down_until > now) {
+            continue;
+        }
+        if (route.policy == ROUND_ROBIN) {
+            best = b;
+            break;
+        }
+        // 最少连接数：连接数相同时从轮询位置开始的第一个
+        if (best < 0 || m_backends[b].active < m_backends[best].active) {
+            best = b;
+        }
+    }
+    if (best < 0) {
+        best = route.backends[route.next % n];
+    }
+    route.next = (std::find(route.backends.begin(), route.backends.end(), best) - route.backends.begin() + 1) % n;
+    return best;
+}
+
+
+Conn_handle Upstream::acquire(int backend, bool fresh) {
+    Backend &be = m_backends[backend];
+    Conn_handle h;
+    bool reused = !fresh && !be.idle.empty();
+    if (reused) {
+        h = be.idle.back();
+        be.idle.pop_back();
+        --m_idle;
+        ++m_reused;
+        m_conns.get(h)->state = SEND_HEAD;
+    }
+    else {
+        h.slot = 0;
+        h.gen = 0;
+        int fd = socket(AF_INET, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+        if (fd < 0) {
+            LOG_ERROR("%s: errno is %d", "upstream socket error", errno);
+            return h;
+        }
+        int ret = connect(fd, (struct sockaddr *)&be.addr, sizeof(be.addr));
+        if (ret < 0 && errno != EINPROGRESS) {
+            LOG_WARN_RATE_M(LOG_MODULE_HTTP, UPSTREAM_LOG_RATE, "upstream %s: connect failed, errno is %d",
+                            be.name, errno);
+            be.down_until = time(nullptr) + UPSTREAM_FAIL_TIMEOUT;
+            close(fd);
+            return h;
+        }
+        if (!m_conns.open(fd, h)) {
+            LOG_WARN_RATE_M(LOG_MODULE_HTTP, UPSTREAM_LOG_RATE, "upstream %s: too many upstream connections",
+                            be.name);
+            close(fd);
+            h.gen = 0;
+            return h;
+        }
+        // 请求头和响应头都很短，不等待合并
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        addfd(m_epollfd, fd, true, tag(h));
+        Conn &u = *m_conns.get(h);
+        u.backend = backend;
+        u.pipe[0] = u.pipe[1] = -1;
+        u.piped = 0;
+        u.state = ret == 0 ? SEND_HEAD : CONNECTING;
+    }
+    // 清除上一个请求的状态
+    Conn &u = *m_conns.get(h);
+    u.reused = reused;
+    u.client.slot = 0;
+    u.client.gen = 0;
+    u.route = 0;
+    u.retried = false;
+    u.out_len = 0;
+    u.out_sent = 0;
+    u.body = nullptr;
+    u.body_len = 0;
+    u.remaining = 0;
+    u.body_started = false;
+    u.head_only = false;
+    u.idempotent = false;
+    u.client_keep = false;
+    u.in_len = 0;
+    u.until_eof = false;
+    u.reusable = false;
+    u.status = 0;
+    u.sent = 0;
+    ++be.active;
+    ++m_active;
+    return h;
+}
+
+void Upstream::close_conn(Conn_handle h) {
+    if (!m_conns.valid(h)) {
+        return;
+    }
+    Conn &u = *m_conns.get(h);
+    Backend &be = m_backends[u.backend];
+    if (u.state == IDLE) {
+        for (size_t i = 0; i < be.idle.size(); ++i) {
+            if (be.idle[i].slot == h.slot && be.idle[i].gen == h.gen) {
+                be.idle.erase(be.idle.begin() + i);
+                break;
+            }
+        }
+        --m_idle;
+    }
+    else {
+        --be.active;
+        --m_active;
+    }
+    int fd = m_conns.fd(h);
+    epoll_ctl(m_epollfd, EPOLL_CTL_DEL, fd, 0);
+    close(fd);
+    if (u.pipe[0] >= 0) {
+        close(u.pipe[0]);
+        close(u.pipe[1]);
+    }
+    m_conns.close(h);
+}
+
+void Upstream::release(Conn_handle h) {
+    Conn &u = *m_conns.get(h);
+    Backend &be = m_backends[u.backend];
+    if (!u.reusable || u.piped != 0 || (int)be.idle.size() >= m_keepalive) {
+        close_conn(h);
+        return;
+    }
+    --be.active;
+    --m_active;
+    u.state = IDLE;
+    u.client.slot = 0;
+    u.client.gen = 0;
+    be.idle.push_back(h);
+    ++m_idle;
+    // 空闲期间只等待后端关闭连接（或发来多余的数据），收到事件即关闭
+    arm(m_conns.fd(h), EPOLLIN, tag(h));
+}
+
+void Upstream::abort(Conn_handle upstream) {
+    close_conn(upstream);
+}
+
+bool Upstream::dispatch(Conn_handle client) {
+    Http_conn *conn = m_ops.conns->get(client);
+    int len;
+    const char *req = conn->raw_request(len);
+    const char *end = req + len;
+    // 请求行：方法 路径 版本，不完整时交给工作线程（它会继续等待数据）
+    const char *line_end = find(req, end, "\r\n");
+    if (line_end == nullptr) {
+        return false;
+    }
+    const char *sp = static_cast<const char *>(memchr(req, ' ', line_end - req));
+    if (sp == nullptr) {
+        return false;
+    }
+    const char *path = sp + 1;
+    const char *path_end = static_cast<const char *>(memchr(path, ' ', line_end - path));
+    if (path_end == nullptr) {
+        return false;
+    }
+    // 绝对形式的 URI 只取路径部分
+    if (path_end - path > 7 && strncasecmp(path, "http://", 7) == 0) {
+        const char *slash = static_cast<const char *>(memchr(path + 7, '/', path_end - path - 7));
+        if (slash == nullptr) {
+            return false;
+        }
+        path = slash;
+    }
+    int path_len = path_end - path;
+    Route *route = nullptr;
+    for (size_t i = 0; i < m_routes.size(); ++i) {
+        const std::string &prefix = m_routes[i].prefix;
+        if (path_len >= (int)prefix.size() && memcmp(path, prefix.data(), prefix.size()) == 0) {
+            route = &m_routes[i];
+            break;
+        }
+    }
+    Http_conn::METHOD method;
+    if (route == nullptr || !Http_conn::parse_method(req, sp - req, method)) {
+        return false;
+    }
+    // 请求头不完整：继续等待数据；超过读缓冲区时关闭连接
+    if (find(req, end, "\r\n\r\n") == nullptr) {
+        if (len >= Http_conn::READ_BUFFER_SIZE) {
+            LOG_WARN_RATE_M(LOG_MODULE_HTTP, UPSTREAM_LOG_RATE, "%s", "proxy: request head too large");
+            m_ops.close(client);
+        }
+        else {
+            arm(m_ops.conns->fd(client), EPOLLIN, client.to_u64());
+        }
+        return true;
+    }
+
+    ++m_requests;
+    conn->begin_proxy(method, path, path_len);
+    m_ops.touch(client);
+    Conn_handle h = acquire(select_backend(*route), false);
+    if (h.gen == 0) {
+        // 连接失败的后端已暂停选择，重新选择一次
+        h = acquire(select_backend(*route), false);
+    }
+    if (h.gen == 0) {
+        ++m_failures;
+        conn->reject(502);
+        m_ops.close(client);
+        return true;
+    }
+    Conn &u = *m_conns.get(h);
+    u.client = client;
+    u.route = route - &m_routes[0];
+    u.idempotent = method != Http_conn::POST && method != Http_conn::PATCH && method != Http_conn::CONNECT;
+    if (!build_request(u, conn, req, len, method == Http_conn::HEAD, path, path_len)) {
+        LOG_WARN_RATE_M(LOG_MODULE_HTTP, UPSTREAM_LOG_RATE, "%s", "proxy: unsupported request");
+        ++m_failures;
+        // 已建立的连接还没有使用，可以放回空闲池
+        u.reusable = u.state == SEND_HEAD;
+        release(h);
+        conn->reject(502);
+        m_ops.close(client);
+        return true;
+    }
+    conn->set_upstream(h);
+    start(h);
+    return true;
+}
+
+/*
+    改写请求头：请求行改为 HTTP/1.0，去掉逐跳头部，补上 Connection: keep-alive 和 X-Forwarded-For；
+    其余头部（Host、Content-Length 等）原样转发
+*/
+bool Upstream::build_request(Conn &u, Http_conn *conn, const char *req, int len, bool head_only,
+                             const char *path, int path_len) {
+    const char *end = req + len;
+    const char *line_end = find(req, end, "\r\n");
+    const char *head_end = find(req, end, "\r\n\r\n") + 4;
+    const char *method_end = static_cast<const char *>(memchr(req, ' ', line_end - req));
+    const char *version = line_end - 8;
+    if (version < path + path_len || strncmp(version, "HTTP/1.", 7) != 0) {
+        return false;
+    }
+    int n = snprintf(u.out, sizeof(u.out), "%.*s %.*s HTTP/1.0\r\n", (int)(method_end - req), req,
+                     path_len, path);
+    if (n >= (int)sizeof(u.out)) {
+        return false;
+    }
+    long long content_length = 0;
+    bool keep = false;
+    for (const char *line = line_end + 2; line < head_end - 2; ) {
+        const char *eol = find(line, head_end, "\r\n");
+        const char *value;
+        if (header_is(line, eol, "Connection", &value)) {
+            keep = has_token(value, eol, "keep-alive");
+        }
+        else if (header_is(line, eol, "Content-Length", &value)) {
+            content_length = parse_length(value, eol);
+            if (content_length < 0) {
+                return false;
+            }
+        }
+        else if (header_is(line, eol, "Transfer-Encoding", &value)) {
+            // 不支持分块编码的请求体
+            return false;
+        }
+        if (!is_hop_header(line, eol) && !append(u.out, sizeof(u.out), &n, line, eol + 2 - line)) {
+            return false;
+        }
+        line = eol + 2;
+    }
+    static const char keep_alive[] = "Connection: keep-alive\r\n";
+    if (!append(u.out, sizeof(u.out), &n, keep_alive, sizeof(keep_alive) - 1)) {
+        return false;
+    }
+    // Unix 域 socket 的连接没有客户端 IP
+    if (conn->get_address()->sin_family == AF_INET) {
+        char ip[INET_ADDRSTRLEN];
+        char xff[64];
+        int xff_len = snprintf(xff, sizeof(xff), "X-Forwarded-For: %s\r\n", conn->peer_name(ip, sizeof(ip)));
+        if (!append(u.out, sizeof(u.out), &n, xff, xff_len)) {
+            return false;
+        }
+    }
+    if (!append(u.out, sizeof(u.out), &n, "\r\n", 2)) {
+        return false;
+    }
+    u.out_len = n;
+
+    // 已读入读缓冲区的请求体从缓冲区发送，其余留在 socket 中 splice；
+    // 请求体之后还有数据（流水线发送的下一个请求）时不保持客户连接
+    long long available = end - head_end;
+    u.body = head_end;
+    u.body_len = available < content_length ? available : content_length;
+    u.remaining = content_length - u.body_len;
+    u.head_only = head_only;
+    u.client_keep = keep && available <= content_length;
+    return true;
+}
+
+/*
+    改写响应头：状态行和其余头部原样转发，去掉逐跳头部，按能否保持客户连接补上 Connection；
+    确定响应体的长度，以及上游连接能否放回空闲池
+*/
+bool Upstream::build_response(Conn &u) {
+    const char *end = u.in + u.in_len;
+    const char *line_end = find(u.in, end, "\r\n");
+    // 状态行：HTTP/1.x 状态码 原因；HTTP/1.0 的请求不会收到 1xx 响应
+    if (line_end - u.in < 12 || strncmp(u.in, "HTTP/1.", 7) != 0 || u.in[8] != ' ') {
+        return false;
+    }
+    bool http11 = u.in[7] == '1';
+    u.status = atoi(u.in + 9);
+    if (u.status < 200 || u.status > 999) {
+        return false;
+    }
+    int n = 0;
+    append(u.out, sizeof(u.out), &n, u.in, line_end + 2 - u.in);
+    long long length = -1;
+    bool chunked = false;
+    bool backend_close = false;
+    bool backend_keep = false;
+    for (const char *line = line_end + 2; line < end - 2; ) {
+        const char *eol = find(line, end, "\r\n");
+        const char *value;
+        if (header_is(line, eol, "Connection", &value)) {
+            backend_close = has_token(value, eol, "close");
+            backend_keep = has_token(value, eol, "keep-alive");
+        }
+        else if (header_is(line, eol, "Content-Length", &value)) {
+            length = parse_length(value, eol);
+            if (length < 0) {
+                return false;
+            }
+        }
+        else if (header_is(line, eol, "Transfer-Encoding", &value)) {
+            chunked = true;
+        }
+        if (!is_hop_header(line, eol) && !append(u.out, sizeof(u.out), &n, line, eol + 2 - line)) {
+            return false;
+        }
+        line = eol + 2;
+    }
+
+    // 没有消息体的响应；长度未知时（不应出现的分块编码也按此处理）读到后端关闭为止
+    if (u.head_only || u.status == 204 || u.status == 304) {
+        u.remaining = 0;
+    }
+    else if (length >= 0 && !chunked) {
+        u.remaining = length;
+    }
+    else {
+        u.until_eof = true;
+        u.remaining = LLONG_MAX;
+    }
+    u.reusable = !u.until_eof && (http11 ? !backend_close : backend_keep);
+    // 热重启排空时不再保持连接
+    u.client_keep = u.client_keep && !u.until_eof && !Http_conn::m_draining.load(std::memory_order_relaxed);
+    const char *connection = u.client_keep ? "Connection: keep-alive\r\n\r\n" : "Connection: close\r\n\r\n";
+    if (!append(u.out, sizeof(u.out), &n, connection, strlen(connection))) {
+        return false;
+    }
+    u.out_len = n;
+    u.out_sent = 0;
+    return true;
+}
+
+void Upstream::start(Conn_handle h) {
+    Conn &u = *m_conns.get(h);
+    if (u.state == CONNECTING) {
+        arm(m_conns.fd(h), EPOLLOUT, tag(h));
+        return;
+    }
+    advance(h);
+}
+
+/*
+    经管道 splice 消息体：先把管道中的数据写出，管道为空时再从源 socket 读入，
+    所以读入时的 EAGAIN 一定是源 socket 没有数据；response 为 true 时统计发给客户端的字节数
+*/
+Upstream::PUMP_CODE Upstream::pump(Conn &u, int from, int to, bool response) {
+    if (u.pipe[0] < 0 && pipe2(u.pipe, O_NONBLOCK | O_CLOEXEC) != 0) {
+        u.pipe[0] = u.pipe[1] = -1;
+        LOG_ERROR("%s: errno is %d", "upstream pipe error", errno);
+        return PUMP_ERROR;
+    }
+    for (;;) {
+        if (u.piped > 0) {
+            ssize_t n = splice(u.pipe[0], nullptr, to, nullptr, u.piped, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+            if (n < 0) {
+                return errno == EAGAIN ? PUMP_WAIT_OUT : PUMP_ERROR;
+            }
+            u.piped -= n;
+            if (response) {
+                u.sent += n;
+            }
+            continue;
+        }
+        if (u.remaining == 0) {
+            return PUMP_DONE;
+        }
+        size_t want = u.remaining < PIPE_CHUNK ? u.remaining : PIPE_CHUNK;
+        ssize_t n = splice(from, nullptr, u.pipe[1], nullptr, want, SPLICE_F_MOVE | SPLICE_F_NONBLOCK);
+        if (n < 0) {
+            return errno == EAGAIN ? PUMP_WAIT_IN : PUMP_ERROR;
+        }
+        if (n == 0) {
+            return PUMP_EOF;
+        }
+        u.piped += n;
+        u.remaining -= n;
+        if (!response) {
+            u.body_started = true;
+        }
+    }
+}
+
+void Upstream::advance(Conn_handle h) {
+    Conn &u = *m_conns.get(h);
+    int fd = m_conns.fd(h);
+    Http_conn *conn = m_ops.conns->get(u.client);
+    if (conn == nullptr) {
+        close_conn(h);
+        return;
+    }
+    int cfd = m_ops.conns->fd(u.client);
+    uint64_t ckey = u.client.to_u64();
+    for (;;) {
+        switch (u.state) {
+        case CONNECTING: {
+            int err = 0;
+            socklen_t len = sizeof(err);
+            if (getsockopt(fd, SOL_SOCKET, SO_ERROR, &err, &len) < 0 || err != 0) {
+                m_backends[u.backend].down_until = time(nullptr) + UPSTREAM_FAIL_TIMEOUT;
+                fail(h, "connect failed");
+                return;
+            }
+            u.state = SEND_HEAD;
+            break;
+        }
+        case SEND_HEAD: {
+            // 请求头和读缓冲区中的请求体一起发送，out_sent 计两者的总数
+            while (u.out_sent < u.out_len + u.body_len) {
+                iovec iv[2];
+                int cnt = 0;
+                if (u.out_sent < u.out_len) {
+                    iv[cnt].iov_base = u.out + u.out_sent;
+                    iv[cnt++].iov_len = u.out_len - u.out_sent;
+                }
+                int body_sent = u.out_sent > u.out_len ? u.out_sent - u.out_len : 0;
+                if (u.body_len > body_sent) {
+                    iv[cnt].iov_base = const_cast<char *>(u.body) + body_sent;
+                    iv[cnt++].iov_len = u.body_len - body_sent;
+                }
+                ssize_t n = writev(fd, iv, cnt);
+                if (n < 0) {
+                    if (errno == EAGAIN) {
+                        arm(fd, EPOLLOUT, tag(h));
+                        return;
+                    }
+                    fail(h, "send request failed");
+                    return;
+                }
+                u.out_sent += n;
+            }
+            u.state = u.remaining > 0 ? SEND_BODY : READ_HEAD;
+            break;
+        }
+        case SEND_BODY: {
+            PUMP_CODE ret = pump(u, cfd, fd, false);
+            if (ret == PUMP_DONE) {
+                u.state = READ_HEAD;
+                break;
+            }
+            if (ret == PUMP_WAIT_IN) {
+                arm(cfd, EPOLLIN, ckey);
+                return;
+            }
+            if (ret == PUMP_WAIT_OUT) {
+                arm(fd, EPOLLOUT, tag(h));
+                return;
+            }
+            if (ret == PUMP_EOF) {
+                // 客户端在请求体发完之前关闭
+                m_ops.close(u.client);
+                return;
+            }
+            fail(h, "send request body failed");
+            return;
+        }
+        case READ_HEAD: {
+            // 先 MSG_PEEK 查找响应头的结尾，只取走响应头，响应体留在 socket 中由 splice 转发
+            for (;;) {
+                int room = (int)sizeof(u.in) - u.in_len;
+                if (room <= 0) {
+                    fail(h, "response head too large");
+                    return;
+                }
+                ssize_t n = recv(fd, u.in + u.in_len, room, MSG_PEEK);
+                if (n < 0 && errno == EAGAIN) {
+                    arm(fd, EPOLLIN, tag(h));
+                    return;
+                }
+                if (n <= 0) {
+                    fail(h, n == 0 ? "closed before response" : "recv response failed");
+                    return;
+                }
+                int from = u.in_len > 3 ? u.in_len - 3 : 0;
+                const char *e = find(u.in + from, u.in + u.in_len + n, "\r\n\r\n");
+                int take = e != nullptr ? (int)(e + 4 - u.in) - u.in_len : (int)n;
+                if (recv(fd, u.in + u.in_len, take, 0) != take) {
+                    fail(h, "recv response failed");
+                    return;
+                }
+                u.in_len += take;
+                if (e != nullptr) {
+                    break;
+                }
+            }
+            // 后端常把响应头和响应体分两次写，立即确认响应头，避免后端的 Nagle 算法等待延迟确认
+            int one = 1;
+            setsockopt(fd, IPPROTO_TCP, TCP_QUICKACK, &one, sizeof(one));
+            if (!build_response(u)) {
+                fail(h, "invalid response head");
+                return;
+            }
+            conn->proxy_response(u.status);
+            u.state = WRITE_HEAD;
+            break;
+        }
+        case WRITE_HEAD: {
+            // 后面还有响应体时用 MSG_MORE 暂缓发送，与 splice 的第一段响应体合并，
+            // 避免小的响应头单独成段后，响应体被 Nagle 算法留到客户端的延迟确认之后
+            int flags = MSG_NOSIGNAL | (u.remaining > 0 ? MSG_MORE : 0);
+            while (u.out_sent < u.out_len) {
+                ssize_t n = send(cfd, u.out + u.out_sent, u.out_len - u.out_sent, flags);
+                if (n < 0) {
+                    if (errno == EAGAIN) {
+                        arm(cfd, EPOLLOUT, ckey);
+                        return;
+                    }
+                    m_ops.close(u.client);
+                    return;
+                }
+                u.out_sent += n;
+                u.sent += n;
+            }
+            u.state = SEND_RESPONSE;
+            break;
+        }
+        case SEND_RESPONSE: {
+            PUMP_CODE ret = pump(u, fd, cfd, true);
+            if (ret == PUMP_DONE || (ret == PUMP_EOF && u.until_eof)) {
+                finish(h);
+                return;
+            }
+            if (ret == PUMP_WAIT_IN) {
+                arm(fd, EPOLLIN, tag(h));
+                return;
+            }
+            if (ret == PUMP_WAIT_OUT) {
+                arm(cfd, EPOLLOUT, ckey);
+                return;
+            }
+            // 后端在响应体发完之前关闭，或者某一端出错：响应已经开始发送，只能关闭客户连接
+            fail(h, ret == PUMP_EOF ? "closed before end of response" : "send response failed");
+            return;
+        }
+        case IDLE:
+            return;
+        }
+    }
+}
+
+void Upstream::fail(Conn_handle h, const char *reason) {
+    Conn &u = *m_conns.get(h);
+    LOG_WARN_RATE_M(LOG_MODULE_HTTP, UPSTREAM_LOG_RATE, "upstream %s: %s", m_backends[u.backend].name, reason);
+    Conn_handle client = u.client;
+    Http_conn *conn = m_ops.conns->get(client);
+    /*
+        请求还能完整重发时重试一次：复用的空闲连接可能在取出前已被后端关闭，换一个新连接；
+        连接失败的后端已暂停选择，重新选择后端；
+        请求已经完整发出时后端可能处理过它，只重试幂等的方法
+    */
+    if ((u.reused || u.state == CONNECTING) && !u.retried && !u.body_started && u.in_len == 0
+        && (u.state < READ_HEAD || (u.state == READ_HEAD && u.idempotent))) {
+        int backend = u.reused ? u.backend : select_backend(m_routes[u.route]);
+        Conn_handle nh = acquire(backend, true);
+        if (nh.gen != 0) {
+            ++m_retries;
+            Conn &nu = *m_conns.get(nh);
+            nu.client = client;
+            nu.route = u.route;
+            nu.retried = true;
+            memcpy(nu.out, u.out, u.out_len);
+            nu.out_len = u.out_len;
+            nu.body = u.body;
+            nu.body_len = u.body_len;
+            nu.remaining = u.remaining;
+            nu.head_only = u.head_only;
+            nu.idempotent = u.idempotent;
+            nu.client_keep = u.client_keep;
+            close_conn(h);
+            conn->set_upstream(nh);
+            start(nh);
+            return;
+        }
+    }
+    ++m_failures;
+    bool responded = u.state > READ_HEAD;
+    close_conn(h);
+    conn->set_upstream(Conn_handle());
+    if (!responded) {
+        conn->reject(502);
+    }
+    m_ops.close(client);
+}
+
+void Upstream::finish(Conn_handle h) {
+    Conn &u = *m_conns.get(h);
+    Conn_handle client = u.client;
+    bool keep = u.client_keep && !Http_conn::m_draining.load(std::memory_order_relaxed);
+    long long sent = u.sent;
+    release(h);
+    m_ops.conns->get(client)->end_proxy(sent, keep);
+    if (keep) {
+        m_ops.touch(client);
+    }
+    else {
+        m_ops.close(client);
+    }
+}
+
+void Upstream::on_client_event(Conn_handle client) {
+    Conn_handle h = m_ops.conns->get(client)->upstream();
+    if (!m_conns.valid(h)) {
+        m_ops.close(client);
+        return;
+    }
+    m_ops.touch(client);
+    advance(h);
+}
+
+void Upstream::on_event(uint64_t key) {
+    Conn_handle h = Conn_handle::from_u64(key);
+    h.slot &= ~UPSTREAM_TAG;
+    if (!m_conns.valid(h)) {
+        return;
+    }
+    Conn &u = *m_conns.get(h);
+    if (u.state == IDLE) {
+        // 后端关闭了空闲连接
+        close_conn(h);
+        return;
+    }
+    m_ops.touch(u.client);
+    advance(h);
+}
+
+Upstream::Stats Upstream::stats() const {
+    Stats s;
+    s.requests = m_requests;
+    s.reused = m_reused;
+    s.retries = m_retries;
+    s.failures = m_failures;
+    s.active = m_active;
+    s.idle = m_idle;
+    return s;
+}
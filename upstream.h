@@ -0,0 +1,196 @@
+/*
+反向代理：请求路径匹配某个路由前缀时，主线程把请求转发到该路由的一组后端，不进入线程池
+    * 后端按轮询或最少连接数选择；连接失败的后端在 UPSTREAM_FAIL_TIMEOUT 秒内不再选择（全部失败时照常选择）
+    * 到后端的连接是非阻塞的，与客户连接在同一个 epoll 中处理；响应长度确定、后端没有要求关闭的连接
+      放回该后端的空闲连接池，下一个请求直接复用，空闲期间后端关闭的连接从池中删除
+    * 上游连接放在单独的槽表中，epoll 事件数据是槽号带 UPSTREAM_TAG 标记的句柄，
+      与客户连接的句柄区分，连接关闭后旧的事件同样因代数不符而丢弃
+    * 请求头、响应头在用户态改写（去掉逐跳头部，补上 Connection、X-Forwarded-For）；
+      请求体、响应体经管道用 splice 在两个 socket 之间搬运，不复制到用户态
+      （只有与请求头一起读入读缓冲区的那部分请求体从缓冲区发出）
+    * 向后端发送 HTTP/1.0 请求并带 Connection: keep-alive，后端不会使用分块编码：
+      响应体长度由 Content-Length 给出，没有时读到后端关闭连接为止，此时客户连接也在响应后关闭
+    * 连接后端失败时换一个后端重试一次，复用的空闲连接已被后端关闭时换一个新连接重试一次，
+      都只在还没有开始 splice 请求体、还没有收到响应时；请求已经完整发出后（等待响应头时）失败，
+      后端可能已经处理了请求，只有幂等的方法（GET、HEAD、PUT、DELETE、OPTIONS、TRACE）重试，
+      避免 POST 等请求执行两次；不能重试时，还没有向客户端发送响应则回复 502，否则直接关闭客户连接
+    * 不支持分块编码的请求体，以及同一连接上流水线发送的多个请求（响应后关闭连接）
+    * 客户连接的定时器同时限制转发的时间：后端长时间没有响应时，定时器关闭客户连接和上游连接
+    * 不是线程安全的：只在主线程（reactor）中使用
+*/
+
+#ifndef UPSTREAM_H
+#define UPSTREAM_H
+
+#include <stdint.h>
+#include <time.h>
+#include <netinet/in.h>
+#include <string>
+#include <vector>
+#include "conn_table.h"
+
+class Http_conn;
+
+// 改写后的请求头、后端的响应头的最大长度
+#define UPSTREAM_HEAD_SIZE 4096
+// 连接失败的后端暂停选择的秒数
+#define UPSTREAM_FAIL_TIMEOUT 10
+// 转发失败的日志每秒最多输出的条数
+#define UPSTREAM_LOG_RATE 100
+
+class Upstream {
+public:
+    // 后端选择策略
+    enum POLICY {
+        ROUND_ROBIN = 0,
+        LEAST_CONN
+    };
+    // 主线程提供的客户连接操作
+    struct Client_ops {
+        Conn_table<Http_conn> *conns;
+        void (*close)(Conn_handle client); // 关闭客户连接（会调用 abort 关闭正在转发的上游连接）
+        void (*touch)(Conn_handle client); // 转发有进展，延长客户连接的定时器
+    };
+    // 统计
+    struct Stats {
+        long long requests; // 开始转发的请求数
+        long long reused; // 使用空闲连接的请求数
+        long long retries; // 连接后端失败、复用的连接已被后端关闭而重试的次数
+        long long failures; // 回复 502 或中途关闭的请求数
+        int active; // 正在转发请求的上游连接数
+        int idle; // 空闲连接数
+    };
+
+    /*
+        epollfd：与客户连接共用的 epoll
+        max_conns：到所有后端的最大连接数（上游槽表的容量）
+        keepalive：每个后端最多保留的空闲连接数，为 0 时每个请求新建连接
+    */
+    Upstream(int epollfd, const Client_ops &ops, int max_conns, int keepalive);
+    ~Upstream();
+
+    // 添加路由：请求路径以 prefix 开头时转发到 backends（逗号分隔的 ip:port）；按添加的顺序匹配
+    // 地址格式错误时返回 false
+    bool add_route(const char *prefix, const char *backends, POLICY policy);
+
+    /*
+        客户连接读到数据后调用：请求路径匹配某个路由时开始转发（或回复 502 并关闭连接）并返回 true，
+        此后该连接的读写事件交给 on_client_event；匹配但请求头还不完整时重新注册读事件，同样返回 true；
+        不匹配时返回 false，请求照常放入请求队列
+    */
+    bool dispatch(Conn_handle client);
+    // 正在转发的客户连接上的读写事件
+    void on_client_event(Conn_handle client);
+    // 上游连接的事件，key 为 epoll 事件数据
+    void on_event(uint64_t key);
+    // 客户连接在转发中被关闭（超时、对端断开）时调用：关闭对应的上游连接
+    void abort(Conn_handle upstream);
+    // 事件数据是否为上游连接的句柄
+    static bool is_upstream_key(uint64_t key);
+
+    Stats stats() const;
+
+private:
+    // 上游连接句柄的槽号带该标记，客户连接的槽号不会达到
+    static const uint32_t UPSTREAM_TAG = 0x80000000u;
+
+    struct Backend {
+        sockaddr_in addr;
+        char name[32]; // ip:port，用于日志
+        int active; // 正在转发请求的连接数
+        std::vector<Conn_handle> idle; // 空闲连接，后进先出
+        time_t down_until; // 连接失败后暂停选择到该时间
+    };
+    struct Route {
+        std::string prefix;
+        std::vector<int> backends;
+        POLICY policy;
+        size_t next; // 轮询位置
+    };
+    // 转发一个请求的各个阶段
+    enum STATE {
+        CONNECTING = 0, // 等待非阻塞 connect 完成
+        SEND_HEAD, // 发送请求头和读缓冲区中的请求体
+        SEND_BODY, // splice 剩余的请求体：客户端 -> 后端
+        READ_HEAD, // 读取响应头
+        WRITE_HEAD, // 向客户端发送改写后的响应头
+        SEND_RESPONSE, // splice 响应体：后端 -> 客户端
+        IDLE // 在空闲连接池中
+    };
+    // 一个上游连接，以及它正在转发的请求
+    struct Conn {
+        int backend;
+        STATE state;
+        int pipe[2]; // splice 使用的管道，第一次转发消息体时创建，随连接复用
+        int piped; // 管道中还没有写出的字节数
+        bool reused; // 这个请求使用的是空闲池中的连接
+        // 请求
+        Conn_handle client;
+        int route;
+        bool retried; // 已经重试过一次
+        char out[UPSTREAM_HEAD_SIZE]; // 改写后的请求头，收到响应头后改为改写后的响应头
+        int out_len;
+        int out_sent;
+        const char *body; // 读缓冲区中已收到的请求体
+        int body_len;
+        long long remaining; // 还需要 splice 的消息体长度
+        bool body_started; // 已经开始 splice 请求体，不能再重试
+        bool head_only; // HEAD 请求，响应没有消息体
+        bool idempotent; // 幂等的方法，请求发出后失败也可以重试
+        bool client_keep; // 客户端要求保持连接
+        // 响应
+        char in[UPSTREAM_HEAD_SIZE]; // 后端的响应头
+        int in_len;
+        bool until_eof; // 响应没有 Content-Length，读到后端关闭为止
+        bool reusable; // 响应结束后连接可以放回空闲池
+        int status;
+        long long sent; // 发送给客户端的字节数
+    };
+    // splice 的结果
+    enum PUMP_CODE {
+        PUMP_DONE = 0, // 消息体已全部转发
+        PUMP_WAIT_IN, // 源 socket 暂时没有数据
+        PUMP_WAIT_OUT, // 目的 socket 暂时不可写
+        PUMP_EOF, // 源 socket 已关闭
+        PUMP_ERROR
+    };
+
+    static uint64_t tag(Conn_handle h);
+    int select_backend(Route &route);
+    // 从空闲池取一个连接，fresh 或没有空闲连接时新建；失败时返回无效句柄
+    Conn_handle acquire(int backend, bool fresh);
+    // 解析客户端的请求并生成转发给后端的请求头，请求不支持时返回 false
+    bool build_request(Conn &u, Http_conn *conn, const char *req, int len, bool head_only,
+                       const char *path, int path_len);
+    // 解析后端的响应头并生成发给客户端的响应头，响应格式错误时返回 false
+    bool build_response(Conn &u);
+    // 开始在上游连接 h 上转发客户连接的请求
+    void start(Conn_handle h);
+    // 执行转发的状态机，直到需要等待某个 socket 的事件
+    void advance(Conn_handle h);
+    PUMP_CODE pump(Conn &u, int from, int to, bool response);
+    void arm(int fd, int ev, uint64_t key);
+    // 转发失败：能重试时换一个连接重试，否则回复 502 或关闭客户连接
+    void fail(Conn_handle h, const char *reason);
+    // 响应转发完成
+    void finish(Conn_handle h);
+    // 放回空闲池或关闭
+    void release(Conn_handle h);
+    void close_conn(Conn_handle h);
+
+private:
+    int m_epollfd;
+    Client_ops m_ops;
+    int m_keepalive;
+    Conn_table<Conn> m_conns;
+    std::vector<Backend> m_backends;
+    std::vector<Route> m_routes;
+    long long m_requests;
+    long long m_reused;
+    long long m_retries;
+    long long m_failures;
+    int m_active;
+    int m_idle;
+};
+
+#endif
@@ -0,0 +1,117 @@
+#include "user_bloom.h"
+#include "log.h"
+
+Bloom_user_store::Bloom_user_store(User_store *store, long long capacity, double fp_rate) :
+    m_store(store),
+    m_filter(capacity, fp_rate),
+    m_ready(false),
+    m_building(false),
+    m_definite_misses(0),
+    m_false_positives(0),
+    m_negative_inserts(0) {
+
+    if (m_store == nullptr) {
+        throw std::exception();
+    }
+}
+
+Bloom_user_store::~Bloom_user_store() {
+    if (m_building) {
+        pthread_join(m_build_tid, NULL);
+    }
+    LOG_INFO_M(LOG_MODULE_POOL, "user bloom filter: %lld definite misses, %lld false positives, false positive rate %.4f, "
+               "%lld filter-negative registrations",
+               definite_misses(), false_positives(), false_positive_rate(), negative_inserts());
+    delete m_store;
+}
+
+bool Bloom_user_store::init() {
+    if (!m_store->init()) {
+        return false;
+    }
+    // 在后台遍历全部用户名构建过滤器，构建完成前所有查找都交给后端
+    if (pthread_create(&m_build_tid, NULL, build_thread, this) != 0) {
+        return false;
+    }
+    m_building = true;
+    return true;
+}
+
+void *Bloom_user_store::build_thread(void *arg) {
+    Bloom_user_store *bloom = (Bloom_user_store *)arg;
+    long long ret = bloom->m_store->load_since(0, build_cb, bloom);
+    if (ret < 0) {
+        // 无法遍历全部用户时不能判定用户一定不存在，不启用过滤器
+        LOG_ERROR_M(LOG_MODULE_POOL, "%s", "build user bloom filter failed, prefilter disabled");
+        return NULL;
+    }
+    bloom->m_ready.store(true, std::memory_order_release);
+    LOG_INFO_M(LOG_MODULE_POOL, "user bloom filter ready: %llu counters, %d hashes",
+               (unsigned long long)bloom->m_filter.size(), bloom->m_filter.hash_num());
+    return NULL;
+}
+
+void Bloom_user_store::build_cb(const char *name, const char * /*passwd*/, void *arg) {
+    Bloom_user_store *bloom = (Bloom_user_store *)arg;
+    bloom->m_mutex.lock();
+    bloom->m_filter.add(name);
+    bloom->m_mutex.unlock();
+}
+
+User_store::LOOKUP_CODE Bloom_user_store::lookup(const char *name, std::string &passwd) {
+    bool ready = m_ready.load(std::memory_order_acquire);
+    if (ready && !m_filter.maybe_contains(name)) {
+        m_definite_misses.fetch_add(1, std::memory_order_relaxed);
+        return USER_NOT_FOUND;
+    }
+    LOOKUP_CODE ret = m_store->lookup(name, passwd);
+    if (ready && ret == USER_NOT_FOUND) {
+        m_false_positives.fetch_add(1, std::memory_order_relaxed);
+    }
+    return ret;
+}
+
+bool Bloom_user_store::insert(const char *name, const char *passwd) {
+    bool ok;
+    /*
+        过滤器判定一定不存在时交给后端的 insert_new，由后端决定能否跳过重名检查：
+        MySQL 和进程内用户表使用默认实现，仍然检查（两个并发注册同名用户的请求都会被判定为不存在）
+    */
+    if (m_ready.load(std::memory_order_acquire) && !m_filter.maybe_contains(name)) {
+        m_negative_inserts.fetch_add(1, std::memory_order_relaxed);
+        ok = m_store->insert_new(name, passwd);
+    }
+    else {
+        ok = m_store->insert(name, passwd);
+    }
+    if (ok) {
+        m_mutex.lock();
+        m_filter.add(name);
+        m_mutex.unlock();
+    }
+    return ok;
+}
+
+bool Bloom_user_store::insert_new(const char *name, const char *passwd) {
+    if (!m_store->insert_new(name, passwd)) {
+        return false;
+    }
+    m_mutex.lock();
+    m_filter.add(name);
+    m_mutex.unlock();
+    return true;
+}
+
+int Bloom_user_store::load_recent(int limit, load_cb cb, void *arg) {
+    return m_store->load_recent(limit, cb, arg);
+}
+
+long long Bloom_user_store::load_since(long long since, load_cb cb, void *arg) {
+    return m_store->load_since(since, cb, arg);
+}
+
+double Bloom_user_store::false_positive_rate() const {
+    long long fp = false_positives();
+    long long negatives = fp + definite_misses();
+    return negatives == 0 ? 0.0 : (double)fp / negatives;
+}
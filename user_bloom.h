@@ -0,0 +1,69 @@
+/*
+用户名存在性预过滤
+    * 包装另一个 User_store，在查找前先查询计数布隆过滤器
+    * 布隆过滤器判定一定不存在的用户名直接返回，不访问缓存或数据库，
+      应对随机用户名、撞库等请求
+    * 启动时在后台线程遍历后端的全部用户名构建过滤器，构建完成前不过滤；注册成功时加入过滤器
+    * 统计误判率：过滤器判定可能存在，而后端查找不存在的比例，只统计 lookup；
+      注册时过滤器判定一定不存在的次数单独统计
+*/
+
+#ifndef USER_BLOOM_H
+#define USER_BLOOM_H
+
+#include <pthread.h>
+#include <atomic>
+#include "user_store.h"
+#include "bloom_filter.h"
+#include "lock.h"
+
+class Bloom_user_store : public User_store {
+public:
+    /*
+        store：被包装的用户存储
+        capacity：预计用户数量
+        fp_rate：期望的误判率
+    */
+    Bloom_user_store(User_store *store, long long capacity, double fp_rate = 0.01);
+    ~Bloom_user_store();
+
+    bool init();
+    LOOKUP_CODE lookup(const char *name, std::string &passwd);
+    bool insert(const char *name, const char *passwd);
+    bool insert_new(const char *name, const char *passwd);
+    int load_recent(int limit, load_cb cb, void *arg);
+    long long load_since(long long since, load_cb cb, void *arg);
+
+    // 被过滤器直接拒绝的查找次数
+    long long definite_misses() const {
+        return m_definite_misses.load(std::memory_order_relaxed);
+    }
+    // 过滤器误判的次数
+    long long false_positives() const {
+        return m_false_positives.load(std::memory_order_relaxed);
+    }
+    // 误判率：误判次数 / 不存在的用户名的查找次数
+    double false_positive_rate() const;
+    // 注册时过滤器判定一定不存在的次数（这些注册交给后端的 insert_new）
+    long long negative_inserts() const {
+        return m_negative_inserts.load(std::memory_order_relaxed);
+    }
+
+private:
+    static void *build_thread(void *arg);
+    static void build_cb(const char *name, const char *passwd, void *arg);
+
+private:
+    User_store *m_store;
+    Counting_bloom_filter m_filter;
+    Locker m_mutex; // 增加过滤器计数时互斥
+    std::atomic<bool> m_ready; // 过滤器是否构建完成
+    pthread_t m_build_tid;
+    bool m_building;
+
+    std::atomic<long long> m_definite_misses;
+    std::atomic<long long> m_false_positives;
+    std::atomic<long long> m_negative_inserts;
+};
+
+#endif
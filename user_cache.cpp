@@ -0,0 +1,162 @@
+#include <pthread.h>
+#include "user_cache.h"
+#include "log.h"
+
+Cached_user_store::Cached_user_store(User_store *store, int capacity, int prewarm, int negative_ttl) :
+    m_store(store),
+    m_capacity(capacity),
+    m_prewarm(prewarm),
+    m_negative_ttl(negative_ttl),
+    m_prewarming(false),
+    m_hits(0),
+    m_misses(0) {
+
+    if (m_store == nullptr || m_capacity <= 0) {
+        throw std::exception();
+    }
+}
+
+Cached_user_store::~Cached_user_store() {
+    // 预热线程使用 m_store 和缓存，先等待它结束
+    if (m_prewarming) {
+        pthread_join(m_prewarm_tid, NULL);
+    }
+    long long h = hits(), m = misses();
+    LOG_INFO_M(LOG_MODULE_POOL, "user cache: %lld hits, %lld misses, hit rate %.4f",
+               h, m, h + m == 0 ? 0.0 : (double)h / (h + m));
+    delete m_store;
+}
+
+bool Cached_user_store::init() {
+    if (!m_store->init()) {
+        return false;
+    }
+    // 后台预热，不阻塞服务器启动
+    if (m_prewarm > 0) {
+        if (pthread_create(&m_prewarm_tid, NULL, prewarm_thread, this) != 0) {
+            return false;
+        }
+        m_prewarming = true;
+    }
+    return true;
+}
+
+void *Cached_user_store::prewarm_thread(void *arg) {
+    Cached_user_store *cache = (Cached_user_store *)arg;
+    int n = cache->m_store->load_recent(cache->m_prewarm, prewarm_cb, cache);
+    LOG_INFO_M(LOG_MODULE_POOL, "user cache prewarmed with %d users", n);
+    return NULL;
+}
+
+void Cached_user_store::prewarm_cb(const char *name, const char *passwd, void *arg) {
+    Cached_user_store *cache = (Cached_user_store *)arg;
+    cache->m_mutex.lock();
+    // 预热数据可能比请求路径上查到的旧，不覆盖已有的缓存
+    cache->put(name, passwd, true, true);
+    cache->m_mutex.unlock();
+}
+
+User_store::LOOKUP_CODE Cached_user_store::lookup(const char *name, std::string &passwd) {
+    m_mutex.lock();
+    m_key.assign(name);
+    Entry_map::iterator it = m_map.find(m_key);
+    if (it != m_map.end()) {
+        Entry_list::iterator entry = it->second;
+        if (entry->exist || entry->expire > time(nullptr)) {
+            // 命中，移到表头
+            m_lru.splice(m_lru.begin(), m_lru, entry);
+            ++m_hits;
+            LOOKUP_CODE ret = USER_NOT_FOUND;
+            if (entry->exist) {
+                passwd = entry->passwd;
+                ret = USER_FOUND;
+            }
+            m_mutex.unlock();
+            return ret;
+        }
+        // 负缓存过期
+        m_lru.erase(entry);
+        m_map.erase(it);
+    }
+    ++m_misses;
+    m_mutex.unlock();
+
+    // 查询后端时不持有锁
+    LOOKUP_CODE ret = m_store->lookup(name, passwd);
+    if (ret != LOOKUP_ERROR) {
+        m_mutex.lock();
+        put(name, passwd.c_str(), ret == USER_FOUND, false);
+        m_mutex.unlock();
+    }
+    return ret;
+}
+
+bool Cached_user_store::insert(const char *name, const char *passwd) {
+    if (!m_store->insert(name, passwd)) {
+        return false;
+    }
+    // 注册成功，覆盖可能存在的负缓存
+    m_mutex.lock();
+    put(name, passwd, true, false);
+    m_mutex.unlock();
+    return true;
+}
+
+bool Cached_user_store::insert_new(const char *name, const char *passwd) {
+    if (!m_store->insert_new(name, passwd)) {
+        return false;
+    }
+    // 注册成功，覆盖可能存在的负缓存
+    m_mutex.lock();
+    put(name, passwd, true, false);
+    m_mutex.unlock();
+    return true;
+}
+
+void Cached_user_store::put(const char *name, const char *passwd, bool exist, bool only_new) {
+    Entry_map::iterator it = m_map.find(name);
+    if (it != m_map.end()) {
+        Entry_list::iterator entry = it->second;
+        // 查询期间并发注册的用户已写入正缓存，之前查到的"不存在"已经过时
+        if (only_new || (!exist && entry->exist)) {
+            return;
+        }
+        entry->passwd = exist ? passwd : "";
+        entry->exist = exist;
+        entry->expire = time(nullptr) + m_negative_ttl;
+        m_lru.splice(m_lru.begin(), m_lru, entry);
+        return;
+    }
+
+    // 缓存已满，淘汰表尾最久未访问的用户
+    if ((int)m_map.size() >= m_capacity) {
+        // 预热不淘汰请求路径上的数据
+        if (only_new) {
+            return;
+        }
+        m_map.erase(m_lru.back().name);
+        m_lru.pop_back();
+    }
+
+    Entry entry;
+    entry.name = name;
+    entry.passwd = exist ? passwd : "";
+    entry.exist = exist;
+    entry.expire = time(nullptr) + m_negative_ttl;
+    m_lru.push_front(entry);
+    m_map[m_lru.front().name] = m_lru.begin();
+}
+
+long long Cached_user_store::hits() {
+    m_mutex.lock();
+    long long tmp = m_hits;
+    m_mutex.unlock();
+    return tmp;
+}
+
+long long Cached_user_store::misses() {
+    m_mutex.lock();
+    long long tmp = m_misses;
+    m_mutex.unlock();
+    return tmp;
+}
@@ -0,0 +1,83 @@
+/*
+带容量上限的用户凭据缓存
+    * 包装另一个 User_store，按需查找，不在启动时全表扫描
+    * LRU 淘汰：list 按最近访问排序，unordered_map 存储用户名到 list 节点的映射
+    * 负缓存：不存在的用户也缓存一段时间，避免重复查询后端
+    * 可选后台预热：启动时创建线程载入最近注册的用户，服务器无需等待即可开始服务，析构时等待预热结束
+    * 查询后端时不持有锁：并发注册写入的正缓存不会被之前发出、之后返回的"不存在"结果覆盖
+    * 析构时在日志中输出命中、未命中次数
+*/
+
+#ifndef USER_CACHE_H
+#define USER_CACHE_H
+
+#include <time.h>
+#include <pthread.h>
+#include <string>
+#include <list>
+#include <unordered_map>
+#include "user_store.h"
+#include "lock.h"
+
+class Cached_user_store : public User_store {
+public:
+    /*
+        store：被包装的用户存储
+        capacity：缓存的最大用户数（包括负缓存）
+        prewarm：后台预热的用户数，为 0 时不预热
+        negative_ttl：负缓存的有效时间（秒）
+    */
+    Cached_user_store(User_store *store, int capacity = 10000, int prewarm = 0, int negative_ttl = 60);
+    ~Cached_user_store();
+
+    bool init();
+    LOOKUP_CODE lookup(const char *name, std::string &passwd);
+    bool insert(const char *name, const char *passwd);
+    bool insert_new(const char *name, const char *passwd);
+    int load_recent(int limit, load_cb cb, void *arg) {
+        return m_store->load_recent(limit, cb, arg);
+    }
+    long long load_since(long long since, load_cb cb, void *arg) {
+        return m_store->load_since(since, cb, arg);
+    }
+
+    // 缓存命中、未命中次数
+    long long hits();
+    long long misses();
+
+private:
+    struct Entry {
+        std::string name;
+        std::string passwd;
+        bool exist; // false 表示负缓存
+        time_t expire; // 负缓存的过期时间
+    };
+    typedef std::list<Entry> Entry_list;
+    typedef std::unordered_map<std::string, Entry_list::iterator> Entry_map;
+
+    // 预热线程运行的函数
+    static void *prewarm_thread(void *arg);
+    static void prewarm_cb(const char *name, const char *passwd, void *arg);
+    /*
+        加入或更新一条缓存，需持有 m_mutex；only_new 为 true 时不覆盖已有的缓存；
+        负缓存不覆盖正缓存（用户不会被删除，已存在的用户不会变为不存在）
+    */
+    void put(const char *name, const char *passwd, bool exist, bool only_new);
+
+private:
+    User_store *m_store;
+    int m_capacity;
+    int m_prewarm;
+    int m_negative_ttl;
+
+    Entry_list m_lru; // 表头为最近访问的用户
+    Entry_map m_map;
+    std::string m_key; // lookup 中复用的 key，避免每次构造临时 string，由 m_mutex 保护
+    Locker m_mutex;
+    pthread_t m_prewarm_tid;
+    bool m_prewarming; // 预热线程已创建，析构时 join
+    long long m_hits;
+    long long m_misses;
+};
+
+#endif
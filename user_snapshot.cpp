@@ -0,0 +1,305 @@
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <vector>
+#include "user_snapshot.h"
+#include "log.h"
+
+static const char SNAPSHOT_MAGIC[8] = {'T', 'H', 'S', 'U', 'S', 'N', 'A', 'P'};
+
+User_snapshot::User_snapshot() :
+    m_addr(nullptr), m_size(0), m_header(nullptr), m_buckets(nullptr), m_arena(nullptr) {}
+
+User_snapshot::~User_snapshot() {
+    if (m_addr != nullptr) {
+        munmap(m_addr, m_size);
+    }
+}
+
+// FNV-1a
+uint32_t User_snapshot::hash(const char *name, size_t len) {
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < len; ++i) {
+        h ^= (unsigned char)name[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+bool User_snapshot::open(const char *path) {
+    int fd = ::open(path, O_RDONLY);
+    if (fd < 0) {
+        return false;
+    }
+    struct stat st;
+    if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(Header)) {
+        close(fd);
+        return false;
+    }
+    void *addr = mmap(0, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (addr == MAP_FAILED) {
+        return false;
+    }
+
+    // 校验文件头和各部分大小，格式不对时放弃快照，从后端全量载入；装载因子超过 0.5 的文件不是 write 写出的
+    const Header *header = (const Header *)addr;
+    if (memcmp(header->magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC)) != 0
+        || header->version != VERSION
+        || header->bucket_count == 0
+        || (header->bucket_count & (header->bucket_count - 1)) != 0
+        || header->user_count > header->bucket_count / 2
+        || sizeof(Header) + (uint64_t)header->bucket_count * sizeof(Bucket) + header->arena_size != (uint64_t)st.st_size) {
+        munmap(addr, st.st_size);
+        return false;
+    }
+
+    m_addr = addr;
+    m_size = st.st_size;
+    m_header = header;
+    m_buckets = (const Bucket *)(header + 1);
+    m_arena = (const char *)(m_buckets + header->bucket_count);
+    // 查找时随机访问，不需要预读
+    madvise(m_addr, m_size, MADV_RANDOM);
+    return true;
+}
+
+bool User_snapshot::find(const char *name, std::string &passwd) const {
+    if (m_header == nullptr) {
+        return false;
+    }
+    size_t len = strlen(name);
+    uint32_t h = hash(name, len);
+    uint32_t mask = m_header->bucket_count - 1;
+    // 线性探测，遇到空桶说明不存在；最多探测 bucket_count 次，损坏的文件中没有空桶时也会结束
+    uint32_t i = h & mask;
+    for (uint32_t probes = 0; probes < m_header->bucket_count && m_buckets[i].name_len != 0;
+         ++probes, i = (i + 1) & mask) {
+        const Bucket &b = m_buckets[i];
+        if (b.hash == h && b.name_len == len && b.offset + b.name_len + b.passwd_len <= m_header->arena_size
+            && memcmp(m_arena + b.offset, name, len) == 0) {
+            passwd.assign(m_arena + b.offset + b.name_len, b.passwd_len);
+            return true;
+        }
+    }
+    return false;
+}
+
+void User_snapshot::for_each(User_store::load_cb cb, void *arg) const {
+    if (m_header == nullptr) {
+        return;
+    }
+    std::string name, passwd;
+    for (uint32_t i = 0; i < m_header->bucket_count; ++i) {
+        const Bucket &b = m_buckets[i];
+        if (b.name_len == 0 || b.offset + b.name_len + b.passwd_len > m_header->arena_size) {
+            continue;
+        }
+        name.assign(m_arena + b.offset, b.name_len);
+        passwd.assign(m_arena + b.offset + b.name_len, b.passwd_len);
+        cb(name.c_str(), passwd.c_str(), arg);
+    }
+}
+
+bool User_snapshot::write(const char *path, const User_map &users, int64_t high_water) {
+    // 装载因子不超过 0.5
+    uint32_t bucket_count = 16;
+    while (bucket_count < users.size() * 2) {
+        bucket_count <<= 1;
+    }
+
+    std::vector<Bucket> buckets(bucket_count);
+    memset(&buckets[0], 0, bucket_count * sizeof(Bucket));
+    std::string arena;
+    uint32_t mask = bucket_count - 1;
+    uint64_t user_count = 0;
+    for (User_map::const_iterator it = users.begin(); it != users.end(); ++it) {
+        if (it->first.empty() || it->first.size() > 0xffff || it->second.size() > 0xffff) {
+            continue;
+        }
+        uint32_t h = hash(it->first.data(), it->first.size());
+        uint32_t i = h & mask;
+        while (buckets[i].name_len != 0) {
+            i = (i + 1) & mask;
+        }
+        buckets[i].hash = h;
+        buckets[i].name_len = it->first.size();
+        buckets[i].passwd_len = it->second.size();
+        buckets[i].offset = arena.size();
+        arena += it->first;
+        arena += it->second;
+        ++user_count;
+    }
+
+    Header header;
+    memset(&header, 0, sizeof(header));
+    memcpy(header.magic, SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    header.version = VERSION;
+    header.bucket_count = bucket_count;
+    header.user_count = user_count;
+    header.high_water = high_water;
+    header.arena_size = arena.size();
+
+    std::string tmp_path = std::string(path) + ".tmp";
+    FILE *fp = fopen(tmp_path.c_str(), "w");
+    if (fp == nullptr) {
+        return false;
+    }
+    bool ok = fwrite(&header, sizeof(header), 1, fp) == 1
+              && fwrite(&buckets[0], sizeof(Bucket), bucket_count, fp) == bucket_count
+              && (arena.empty() || fwrite(arena.data(), arena.size(), 1, fp) == 1)
+              && fflush(fp) == 0
+              && fsync(fileno(fp)) == 0;
+    fclose(fp);
+    if (!ok || rename(tmp_path.c_str(), path) != 0) {
+        unlink(tmp_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+Snapshot_user_store::Snapshot_user_store(User_store *store, const char *path) :
+    m_store(store),
+    m_path(path),
+    m_high_water(0),
+    m_dirty(false),
+    m_saving(false) {
+
+    if (m_store == nullptr) {
+        throw std::exception();
+    }
+}
+
+Snapshot_user_store::~Snapshot_user_store() {
+    if (m_saving) {
+        pthread_join(m_save_tid, NULL);
+    }
+    if (m_dirty) {
+        save();
+    }
+    delete m_store;
+}
+
+bool Snapshot_user_store::init() {
+    if (!m_store->init()) {
+        return false;
+    }
+    // 快照不存在或损坏时 high_water 为 0，相当于全量载入
+    if (m_snapshot.open(m_path.c_str())) {
+        LOG_INFO_M(LOG_MODULE_POOL, "user snapshot %s mapped: %llu users, high water %lld", m_path.c_str(),
+                   (unsigned long long)m_snapshot.user_count(), (long long)m_snapshot.high_water());
+    }
+    long long high_water = m_store->load_since(m_snapshot.high_water(), delta_cb, this);
+    if (high_water < 0) {
+        LOG_ERROR_M(LOG_MODULE_POOL, "%s", "load user delta failed");
+        return false;
+    }
+    m_high_water = high_water;
+    LOG_INFO_M(LOG_MODULE_POOL, "user delta loaded: %d users, high water %lld", (int)m_delta.size(), high_water);
+
+    // 有增量时在后台重写快照，不阻塞服务器启动
+    if (m_dirty) {
+        if (pthread_create(&m_save_tid, NULL, save_thread, this) == 0) {
+            m_saving = true;
+        }
+    }
+    return true;
+}
+
+void Snapshot_user_store::delta_cb(const char *name, const char *passwd, void *arg) {
+    Snapshot_user_store *store = (Snapshot_user_store *)arg;
+    store->m_delta[name] = passwd;
+    store->m_dirty = true;
+}
+
+void Snapshot_user_store::merge_cb(const char *name, const char *passwd, void *arg) {
+    User_snapshot::User_map *users = (User_snapshot::User_map *)arg;
+    (*users)[name] = passwd;
+}
+
+void *Snapshot_user_store::save_thread(void *arg) {
+    Snapshot_user_store *store = (Snapshot_user_store *)arg;
+    store->save();
+    return NULL;
+}
+
+User_store::LOOKUP_CODE Snapshot_user_store::lookup(const char *name, std::string &passwd) {
+    m_mutex.lock();
+    User_snapshot::User_map::iterator it = m_delta.find(name);
+    if (it != m_delta.end()) {
+        passwd = it->second;
+        m_mutex.unlock();
+        return USER_FOUND;
+    }
+    m_mutex.unlock();
+    // 快照只读，查找不需要加锁
+    return m_snapshot.find(name, passwd) ? USER_FOUND : USER_NOT_FOUND;
+}
+
+bool Snapshot_user_store::insert(const char *name, const char *passwd) {
+    std::string old_passwd;
+    if (lookup(name, old_passwd) != USER_NOT_FOUND) {
+        return false;
+    }
+    return insert_new(name, passwd);
+}
+
+bool Snapshot_user_store::insert_new(const char *name, const char *passwd) {
+    if (!m_store->insert_new(name, passwd)) {
+        return false;
+    }
+    m_mutex.lock();
+    m_delta[name] = passwd;
+    m_dirty = true;
+    m_mutex.unlock();
+    return true;
+}
+
+// 遍历快照和增量表中的全部用户，编号未知，since 只能为 0
+long long Snapshot_user_store::load_since(long long since, load_cb cb, void *arg) {
+    if (since > 0) {
+        return -1;
+    }
+    m_snapshot.for_each(cb, arg);
+    std::string passwd;
+    m_mutex.lock();
+    for (User_snapshot::User_map::iterator it = m_delta.begin(); it != m_delta.end(); ++it) {
+        // 增量表中的用户可能已经在快照中
+        if (!m_snapshot.find(it->first.c_str(), passwd)) {
+            cb(it->first.c_str(), it->second.c_str(), arg);
+        }
+    }
+    long long high_water = m_high_water;
+    m_mutex.unlock();
+    return high_water;
+}
+
+bool Snapshot_user_store::save() {
+    m_save_mutex.lock();
+    User_snapshot::User_map users;
+    // 增量表可能被工作线程同时修改，这里只按快照预留，读取增量表需持有 m_mutex
+    users.reserve(m_snapshot.user_count());
+    m_snapshot.for_each(merge_cb, &users);
+
+    m_mutex.lock();
+    for (User_snapshot::User_map::iterator it = m_delta.begin(); it != m_delta.end(); ++it) {
+        users[it->first] = it->second;
+    }
+    // 运行期间注册的用户编号未知，高水位仍取增量载入时的值，下次重启会重复载入这些用户，不影响正确性
+    int64_t high_water = m_high_water;
+    m_dirty = false;
+    m_mutex.unlock();
+
+    bool ok = User_snapshot::write(m_path.c_str(), users, high_water);
+    if (!ok) {
+        m_mutex.lock();
+        m_dirty = true;
+        m_mutex.unlock();
+        LOG_ERROR_M(LOG_MODULE_POOL, "write user snapshot %s failed", m_path.c_str());
+    }
+    m_save_mutex.unlock();
+    return ok;
+}
@@ -0,0 +1,110 @@
+/*
+用户凭据快照：需要全量用户表时，避免每次重启都从数据库重建
+    * 快照文件可直接 mmap 使用，不需要反序列化
+    * 文件格式（主机字节序）：
+          Header | Bucket[bucket_count] | 字符串区
+      Bucket 为开放寻址（线性探测）哈希表，name_len 为 0 表示空桶，
+      字符串区中每个用户依次存放用户名和密码，不以 '\0' 结尾
+    * 重启时映射快照，再从后端载入编号大于快照高水位的新用户（增量）
+*/
+
+#ifndef USER_SNAPSHOT_H
+#define USER_SNAPSHOT_H
+
+#include <stdint.h>
+#include <pthread.h>
+#include <string>
+#include <unordered_map>
+#include "user_store.h"
+#include "lock.h"
+
+// 只读的快照文件
+class User_snapshot {
+public:
+    static const uint32_t VERSION = 1;
+
+    struct Header {
+        char magic[8]; // "THSUSNAP"
+        uint32_t version;
+        uint32_t bucket_count; // 2 的幂
+        uint64_t user_count;
+        int64_t high_water; // 快照包含的用户的最大编号
+        uint64_t arena_size; // 字符串区大小
+    };
+    struct Bucket {
+        uint32_t hash;
+        uint16_t name_len;
+        uint16_t passwd_len;
+        uint64_t offset; // 用户名在字符串区中的偏移，密码紧随其后
+    };
+    typedef std::unordered_map<std::string, std::string> User_map;
+
+    User_snapshot();
+    ~User_snapshot();
+
+    // 映射快照文件，文件不存在或格式不对时返回 false
+    bool open(const char *path);
+    // 查找用户，存在时将密码写入 passwd
+    bool find(const char *name, std::string &passwd) const;
+    // 遍历快照中的所有用户
+    void for_each(User_store::load_cb cb, void *arg) const;
+    int64_t high_water() const {
+        return m_header ? m_header->high_water : 0;
+    }
+    uint64_t user_count() const {
+        return m_header ? m_header->user_count : 0;
+    }
+
+    // 将 users 写入快照文件：先写临时文件再 rename，保证文件总是完整的
+    static bool write(const char *path, const User_map &users, int64_t high_water);
+
+private:
+    static uint32_t hash(const char *name, size_t len);
+
+private:
+    void *m_addr; // 映射的起始地址
+    size_t m_size; // 映射的大小
+    const Header *m_header;
+    const Bucket *m_buckets;
+    const char *m_arena;
+};
+
+/*
+基于快照的全量用户表
+    lookup 先查内存中的增量表，再查 mmap 的快照
+    insert 写入后端，并加入增量表
+    有新用户时在后台线程重写快照，下次重启直接映射
+*/
+class Snapshot_user_store : public User_store {
+public:
+    Snapshot_user_store(User_store *store, const char *path);
+    ~Snapshot_user_store();
+
+    bool init();
+    LOOKUP_CODE lookup(const char *name, std::string &passwd);
+    bool insert(const char *name, const char *passwd);
+    bool insert_new(const char *name, const char *passwd);
+    long long load_since(long long since, load_cb cb, void *arg);
+
+    // 合并快照和增量表，重写快照文件
+    bool save();
+
+private:
+    static void delta_cb(const char *name, const char *passwd, void *arg);
+    static void merge_cb(const char *name, const char *passwd, void *arg);
+    static void *save_thread(void *arg);
+
+private:
+    User_store *m_store;
+    std::string m_path;
+    User_snapshot m_snapshot;
+    User_snapshot::User_map m_delta; // 快照之后新增的用户
+    int64_t m_high_water;
+    bool m_dirty; // 增量表中有未写入快照的用户
+    Locker m_mutex; // 保护 m_delta
+    Locker m_save_mutex; // 同一时间只有一个线程写快照
+    pthread_t m_save_tid;
+    bool m_saving; // 是否创建了后台写快照线程
+};
+
+#endif
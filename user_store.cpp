@@ -0,0 +1,216 @@
+#include <cstring>
+#include <cstdlib>
+#include "user_store.h"
+#include "log.h"
+
+Memory_user_store::Memory_user_store(const char *path) : m_fp(nullptr) {
+    if (path != nullptr) {
+        m_path = path;
+    }
+}
+
+Memory_user_store::~Memory_user_store() {
+    if (m_fp != nullptr) {
+        fclose(m_fp);
+    }
+}
+
+bool Memory_user_store::init() {
+    if (m_path.empty()) {
+        return true;
+    }
+
+    // 载入已有的用户，文件不存在时从空表开始
+    FILE *fp = fopen(m_path.c_str(), "r");
+    if (fp != nullptr) {
+        char name[100], passwd[100];
+        while (fscanf(fp, "%99s %99s", name, passwd) == 2) {
+            std::pair<User_map::iterator, bool> ret = m_users.insert(User_map::value_type(name, passwd));
+            if (ret.second) {
+                m_order.push_back(ret.first);
+            }
+        }
+        fclose(fp);
+    }
+
+    // 新注册的用户追加写入文件
+    m_fp = fopen(m_path.c_str(), "a");
+    if (m_fp == nullptr) {
+        LOG_ERROR_M(LOG_MODULE_POOL, "open user file %s failed", m_path.c_str());
+        return false;
+    }
+    return true;
+}
+
+User_store::LOOKUP_CODE Memory_user_store::lookup(const char *name, std::string &passwd) {
+    m_mutex.lock();
+    User_map::iterator it = m_users.find(name);
+    bool found = it != m_users.end();
+    if (found) {
+        passwd = it->second;
+    }
+    m_mutex.unlock();
+    return found ? USER_FOUND : USER_NOT_FOUND;
+}
+
+bool Memory_user_store::insert(const char *name, const char *passwd) {
+    m_mutex.lock();
+    std::pair<User_map::iterator, bool> ret = m_users.insert(User_map::value_type(name, passwd));
+    if (!ret.second) {
+        m_mutex.unlock();
+        return false;
+    }
+    m_order.push_back(ret.first);
+    if (m_fp != nullptr) {
+        fprintf(m_fp, "%s %s\n", name, passwd);
+        fflush(m_fp);
+    }
+    m_mutex.unlock();
+    return true;
+}
+
+int Memory_user_store::load_recent(int limit, load_cb cb, void *arg) {
+    int n = 0;
+    m_mutex.lock();
+    for (int i = (int)m_order.size() - 1; i >= 0 && n < limit; --i, ++n) {
+        cb(m_order[i]->first.c_str(), m_order[i]->second.c_str(), arg);
+    }
+    m_mutex.unlock();
+    return n;
+}
+
+long long Memory_user_store::load_since(long long since, load_cb cb, void *arg) {
+    if (since < 0) {
+        since = 0;
+    }
+    m_mutex.lock();
+    long long size = m_order.size();
+    for (long long i = since; i < size; ++i) {
+        cb(m_order[i]->first.c_str(), m_order[i]->second.c_str(), arg);
+    }
+    m_mutex.unlock();
+    return since > size ? since : size;
+}
+
+#ifdef USE_MYSQL
+// 用户名和密码来自请求报文，转义后再拼接 SQL
+static void escape(MYSQL *mysql, char *to, const char *from) {
+    mysql_real_escape_string(mysql, to, from, strnlen(from, 100));
+}
+
+// 不再启动时全表扫描，只检查数据库是否可用
+bool Mysql_user_store::init() {
+    MYSQL *mysql = nullptr;
+    ConnectionRAII mysql_conn(&mysql, m_conn_pool);
+    return mysql != nullptr;
+}
+
+User_store::LOOKUP_CODE Mysql_user_store::lookup(const char *name, std::string &passwd) {
+    MYSQL *mysql = nullptr;
+    ConnectionRAII mysql_conn(&mysql, m_conn_pool);
+    if (mysql == nullptr) {
+        return LOOKUP_ERROR;
+    }
+
+    char esc_name[201];
+    escape(mysql, esc_name, name);
+    char sql_select[512];
+    snprintf(sql_select, sizeof(sql_select), "SELECT passwd FROM user WHERE username='%s' LIMIT 1", esc_name);
+    if (mysql_query(mysql, sql_select)) {
+        LOG_ERROR_M(LOG_MODULE_POOL, "select error:%s", mysql_error(mysql));
+        return LOOKUP_ERROR;
+    }
+    MYSQL_RES *result = mysql_store_result(mysql);
+    if (result == nullptr) {
+        return LOOKUP_ERROR;
+    }
+
+    LOOKUP_CODE ret = USER_NOT_FOUND;
+    if (MYSQL_ROW row = mysql_fetch_row(result)) {
+        passwd = row[0];
+        ret = USER_FOUND;
+    }
+    mysql_free_result(result);
+    return ret;
+}
+
+bool Mysql_user_store::insert(const char *name, const char *passwd) {
+    MYSQL *mysql = nullptr;
+    ConnectionRAII mysql_conn(&mysql, m_conn_pool);
+    if (mysql == nullptr) {
+        return false;
+    }
+
+    char esc_name[201], esc_passwd[201];
+    escape(mysql, esc_name, name);
+    escape(mysql, esc_passwd, passwd);
+    // 没有重名时才写入，影响的行数为 0 表示用户名已存在
+    char sql_insert[1024];
+    snprintf(sql_insert, sizeof(sql_insert),
+             "INSERT INTO user(username, passwd) SELECT '%s', '%s' FROM DUAL "
+             "WHERE NOT EXISTS (SELECT 1 FROM user WHERE username='%s')",
+             esc_name, esc_passwd, esc_name);
+    // 检查和写入之间不能插入另一个同名注册
+    m_mutex.lock();
+    bool ok = mysql_query(mysql, sql_insert) == 0;
+    my_ulonglong rows = ok ? mysql_affected_rows(mysql) : 0;
+    m_mutex.unlock();
+    if (!ok) {
+        LOG_ERROR_M(LOG_MODULE_POOL, "insert error:%s", mysql_error(mysql));
+        return false;
+    }
+    return rows == 1;
+}
+
+int Mysql_user_store::load_recent(int limit, load_cb cb, void *arg) {
+    MYSQL *mysql = nullptr;
+    ConnectionRAII mysql_conn(&mysql, m_conn_pool);
+    if (mysql == nullptr) {
+        return 0;
+    }
+
+    char sql_select[128];
+    snprintf(sql_select, sizeof(sql_select), "SELECT username, passwd FROM user ORDER BY id DESC LIMIT %d", limit);
+    if (mysql_query(mysql, sql_select)) {
+        LOG_ERROR_M(LOG_MODULE_POOL, "select error:%s", mysql_error(mysql));
+        return 0;
+    }
+    // 逐行读取结果，不把整个结果集缓存在客户端
+    MYSQL_RES *result = mysql_use_result(mysql);
+    if (result == nullptr) {
+        return 0;
+    }
+    int n = 0;
+    while (MYSQL_ROW row = mysql_fetch_row(result)) {
+        cb(row[0], row[1], arg);
+        ++n;
+    }
+    mysql_free_result(result);
+    return n;
+}
+long long Mysql_user_store::load_since(long long since, load_cb cb, void *arg) {
+    MYSQL *mysql = nullptr;
+    ConnectionRAII mysql_conn(&mysql, m_conn_pool);
+    if (mysql == nullptr) {
+        return -1;
+    }
+
+    char sql_select[128];
+    snprintf(sql_select, sizeof(sql_select), "SELECT id, username, passwd FROM user WHERE id > %lld ORDER BY id", since);
+    if (mysql_query(mysql, sql_select)) {
+        LOG_ERROR_M(LOG_MODULE_POOL, "select error:%s", mysql_error(mysql));
+        return -1;
+    }
+    MYSQL_RES *result = mysql_use_result(mysql);
+    if (result == nullptr) {
+        return -1;
+    }
+    long long high_water = since;
+    while (MYSQL_ROW row = mysql_fetch_row(result)) {
+        high_water = atoll(row[0]);
+        cb(row[1], row[2], arg);
+    }
+    mysql_free_result(result);
+    return high_water;
+}
+#endif
@@ -0,0 +1,105 @@
+/*
+用户存储接口：登录、注册校验只依赖该接口，与具体存储后端解耦
+    * Mysql_user_store：基于数据库连接池的 MySQL 实现（需定义 USE_MYSQL），按需查询，
+      一般外面再套一层 Cached_user_store（user_cache.h）
+    * Memory_user_store：进程内实现，可选从文件加载并把注册的用户追加写回文件，
+      不依赖外部服务，便于在普通 Linux 机器上压测登录、注册
+*/
+
+#ifndef USER_STORE_H
+#define USER_STORE_H
+
+#include <stdio.h>
+#include <string>
+#include <map>
+#include <vector>
+#include "lock.h"
+#ifdef USE_MYSQL
+#include "sql_connection_pool.h"
+#endif
+
+class User_store {
+public:
+    // 查找用户的结果
+    enum LOOKUP_CODE {
+        USER_FOUND = 0, // 用户存在
+        USER_NOT_FOUND, // 用户不存在
+        LOOKUP_ERROR // 存储后端出错，结果未知
+    };
+    // 遍历用户时的回调函数
+    typedef void (*load_cb)(const char *name, const char *passwd, void *arg);
+
+    virtual ~User_store() {}
+
+    // 初始化存储，服务器开始接收连接前调用一次
+    virtual bool init() = 0;
+    // 查找用户，存在时将密码写入 passwd
+    virtual LOOKUP_CODE lookup(const char *name, std::string &passwd) = 0;
+    // 注册新用户，用户名已存在或写入失败时返回 false
+    virtual bool insert(const char *name, const char *passwd) = 0;
+    // 注册调用者已确认不存在的用户，可以跳过重名检查
+    virtual bool insert_new(const char *name, const char *passwd) {
+        return insert(name, passwd);
+    }
+    // 按注册时间从新到旧遍历最多 limit 个用户，用于缓存预热，返回遍历的数量
+    virtual int load_recent(int /*limit*/, load_cb /*cb*/, void * /*arg*/) {
+        return 0;
+    }
+    /*
+        按注册顺序遍历编号大于 since 的用户，用于在快照上应用增量
+        返回遍历到的最大编号（高水位），没有新用户时返回 since，出错返回 -1
+    */
+    virtual long long load_since(long long /*since*/, load_cb /*cb*/, void * /*arg*/) {
+        return -1;
+    }
+};
+
+// 进程内用户表，path 为空时为纯内存模式
+class Memory_user_store : public User_store {
+public:
+    Memory_user_store(const char *path = nullptr);
+    ~Memory_user_store();
+
+    bool init();
+    LOOKUP_CODE lookup(const char *name, std::string &passwd);
+    bool insert(const char *name, const char *passwd);
+    int load_recent(int limit, load_cb cb, void *arg);
+    long long load_since(long long since, load_cb cb, void *arg);
+
+private:
+    // 透明比较器：用 const char * 查找时不构造临时 string
+    typedef std::map<std::string, std::string, std::less<> > User_map;
+
+    std::string m_path; // 用户文件路径：每行 "用户名 密码"
+    FILE *m_fp; // 以追加方式打开的用户文件
+    User_map m_users;
+    std::vector<User_map::iterator> m_order; // 按注册顺序记录用户，下标加一即为用户编号
+    Locker m_mutex;
+};
+
+#ifdef USE_MYSQL
+/*
+MySQL 用户表：不在启动时全表扫描，每次查找直接查询数据库
+    user 表需要有自增主键 id，load_recent 按 id 从大到小取最近注册的用户，
+    load_since 以 id 作为高水位
+    注册用一条 INSERT ... SELECT ... WHERE NOT EXISTS 完成重名检查和写入，并由互斥锁串行执行：
+    user 表的 username 没有唯一约束，两个并发注册同名用户的请求不能都写入
+*/
+class Mysql_user_store : public User_store {
+public:
+    Mysql_user_store(Connection_pool *conn_pool) : m_conn_pool(conn_pool) {}
+
+    bool init();
+    LOOKUP_CODE lookup(const char *name, std::string &passwd);
+    // 重名检查和写入是同一条语句，调用者确认不存在的用户也走同样的路径（insert_new 使用默认实现）
+    bool insert(const char *name, const char *passwd);
+    int load_recent(int limit, load_cb cb, void *arg);
+    long long load_since(long long since, load_cb cb, void *arg);
+
+private:
+    Connection_pool *m_conn_pool;
+    Locker m_mutex; // 串行执行注册
+};
+#endif
+
+#endif